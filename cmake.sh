@@ -76,6 +76,11 @@ _test()
     ./tests/test.sh
 }
 
+_bench()
+{
+    ./tests/bench.sh "$@"
+}
+
 cd $(dirname $0)
 
 case "$1" in
@@ -88,5 +93,6 @@ case "$1" in
     uninstall) _uninstall ;;
     clean) _clean ;;
     test) _test ;;
+    bench) _bench "${@:2}" ;;
     *) build ;;
 esac
@@ -28,7 +28,7 @@ typedef struct ThreadPool
     TaskQ qTasks;
 } ThreadPool;
 
-bool
+static inline bool
 ThreadPoolBusy(ThreadPool* self)
 {
     mtx_lock(&self->mtxQ);
@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include <time.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
 #define LENGTH(A) (sizeof(A) / sizeof(A[0]))
 
 static inline size_t
@@ -27,6 +31,29 @@ hashMurmurOAAT64(const char* key)
     return h;
 }
 
+/* byte-wise variants that can be chained over several buffers through `hash` */
+static inline size_t
+hashFNVBytes(const void* data, size_t size, size_t hash)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ p[i]) * 0x100000001B3;
+    return hash;
+}
+
+static inline size_t
+hashMurmurOAAT64Bytes(const void* data, size_t size, size_t h)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= p[i];
+        h *= 0x5bd1e9955bd1e995;
+        h ^= h >> 47;
+    }
+    return h;
+}
+
 static inline size_t
 hashInt(int num)
 {
@@ -68,3 +95,16 @@ msTimeNow()
     micros += ts.tv_nsec;
     return micros / 1000000.0;
 }
+
+/* cheap monotonic tick counter for interval measurements, calibrate against msTimeNow() */
+static inline unsigned long long
+tscNow()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+/*
+ * pl0par -- the threads behind forall.
+ *
+ * The iterations are split into one chunk per thread, and chunks smaller
+ * than PL0PAR_CHUNK_MIN aren't worth a thread.  The calling thread runs the
+ * first chunk and waits for the others on the pool, which starts with the
+ * first forall.  PL0THREADS sets the number of threads, one per CPU by
+ * default.  Only the unit with main includes this, at its end; like the
+ * rest of include/adt, it needs a C23 compiler.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "adt/threadpool.h"
+
+#ifndef PL0PAR_CHUNK_MIN
+#define PL0PAR_CHUNK_MIN 1024
+#endif
+#define PL0PAR_THREADS_MAX 256
+
+typedef struct __pl0_chunk
+{
+    __pl0_body fn;
+    long lo, hi;
+    bool last;
+    void** c;
+    atomic_size_t* pLeft; /* chunks the caller waits for */
+} __pl0_chunk;
+
+static ThreadPool __pl0_pool;
+static size_t __pl0_nthreads; /* including the caller */
+static once_flag __pl0_poolonce = ONCE_FLAG_INIT;
+static mtx_t __pl0_mtxdone;
+static cnd_t __pl0_cnddone;
+static mtx_t __pl0_mtxreduce;
+
+static void
+__pl0_poolinit(void)
+{
+    const char* env = getenv("PL0THREADS");
+    long n = env != nullptr ? strtol(env, nullptr, 10) : hwConcurrency();
+
+    __pl0_nthreads = n < 1 ? 1 : n > PL0PAR_THREADS_MAX ? PL0PAR_THREADS_MAX : n;
+    mtx_init(&__pl0_mtxdone, mtx_plain);
+    cnd_init(&__pl0_cnddone);
+    mtx_init(&__pl0_mtxreduce, mtx_plain);
+
+    if (__pl0_nthreads > 1)
+    {
+        __pl0_pool = ThreadPoolCreate(__pl0_nthreads - 1);
+        ThreadPoolStart(&__pl0_pool);
+    }
+}
+
+static int
+__pl0_chunkrun(void* p)
+{
+    __pl0_chunk* pc = p;
+
+    pc->fn(pc->lo, pc->hi, pc->last, pc->c);
+
+    if (atomic_fetch_sub(pc->pLeft, 1) == 1)
+    {
+        mtx_lock(&__pl0_mtxdone);
+        cnd_broadcast(&__pl0_cnddone);
+        mtx_unlock(&__pl0_mtxdone);
+    }
+
+    return 0;
+}
+
+void
+__pl0_forall(long lo, long hi, __pl0_body fn, void** c)
+{
+    __pl0_chunk aChunks[PL0PAR_THREADS_MAX];
+    atomic_size_t left;
+    unsigned long n, size, extra, first;
+    size_t nChunks;
+
+    if (hi < lo)
+        return;
+
+    call_once(&__pl0_poolonce, __pl0_poolinit);
+
+    /* n wraps to 0 only for all of long, which no thread would finish anyway */
+    n = (unsigned long)hi - (unsigned long)lo + 1;
+    nChunks = n / PL0PAR_CHUNK_MIN < __pl0_nthreads ? n / PL0PAR_CHUNK_MIN : __pl0_nthreads;
+
+    if (nChunks < 2)
+    {
+        fn(lo, hi, true, c);
+        return;
+    }
+
+    size = n / nChunks;
+    extra = n % nChunks;
+    first = lo;
+    for (size_t i = 0; i < nChunks; i++)
+    {
+        unsigned long len = size + (i < extra);
+
+        aChunks[i] = (__pl0_chunk){.fn = fn, .lo = (long)first, .hi = (long)(first + len - 1), .last = i == nChunks - 1,
+                                   .c = c, .pLeft = &left};
+        first += len;
+    }
+
+    atomic_init(&left, nChunks - 1);
+    for (size_t i = 1; i < nChunks; i++)
+        ThreadPoolSubmit(&__pl0_pool, (TaskNode){.pFn = __pl0_chunkrun, .pArg = &aChunks[i]});
+
+    fn(aChunks[0].lo, aChunks[0].hi, aChunks[0].last, c);
+
+    mtx_lock(&__pl0_mtxdone);
+    while (atomic_load(&left) > 0)
+        cnd_wait(&__pl0_cnddone, &__pl0_mtxdone);
+    mtx_unlock(&__pl0_mtxdone);
+}
+
+/* only the functions __pl0_forall() runs call this, so the pool is there */
+void
+__pl0_reduce(void* p, long v, int op)
+{
+    long* pl = p;
+
+    mtx_lock(&__pl0_mtxreduce);
+    if (op == '+')
+        *pl += v;
+    else if (op == '<' ? v < *pl : v > *pl)
+        *pl = v;
+    mtx_unlock(&__pl0_mtxreduce);
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+/*
+ * pl0rt -- runtime for the C that pl0c generates.
+ *
+ * writeInt, writeChar and writeStr fill one large buffer that goes out with
+ * write(2) when it is full, before input is read and at exit; readInt and
+ * readChar read through another one.  This avoids stdio's locking and format
+ * parsing on every value.  The translation unit that defines PL0RT_MAIN
+ * before including this owns the buffers, the others share them.
+ *
+ * forall runs on the thread pool in pl0par.h, which the C includes at its
+ * end when it needs it.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PL0RT_BUF_SIZE (1 << 16)
+#define PL0RT_LONG_MAX_DIGITS 20
+
+#ifdef PL0RT_MAIN
+char __pl0_out[PL0RT_BUF_SIZE];
+size_t __pl0_outpos;
+char __pl0_in[PL0RT_BUF_SIZE];
+size_t __pl0_inpos, __pl0_inend;
+#else
+extern char __pl0_out[PL0RT_BUF_SIZE];
+extern size_t __pl0_outpos;
+extern char __pl0_in[PL0RT_BUF_SIZE];
+extern size_t __pl0_inpos, __pl0_inend;
+#endif
+
+static const char __pl0_digits[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static inline void
+__pl0_flush(void)
+{
+    size_t done = 0;
+
+    while (done < __pl0_outpos)
+    {
+        ssize_t n = write(STDOUT_FILENO, __pl0_out + done, __pl0_outpos - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    __pl0_outpos = 0;
+}
+
+static inline void
+__pl0_writechar(long c)
+{
+    if (__pl0_outpos == PL0RT_BUF_SIZE)
+        __pl0_flush();
+
+    __pl0_out[__pl0_outpos++] = (unsigned char)c;
+}
+
+/* two digits per step, right to left, then one copy into the buffer */
+static inline void
+__pl0_writeint(long n)
+{
+    char buf[PL0RT_LONG_MAX_DIGITS + 1];
+    char* p = buf + sizeof(buf);
+    unsigned long u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+
+    while (u >= 100)
+    {
+        unsigned long i = u % 100 * 2;
+        u /= 100;
+        *--p = __pl0_digits[i + 1];
+        *--p = __pl0_digits[i];
+    }
+
+    if (u >= 10)
+    {
+        *--p = __pl0_digits[u * 2 + 1];
+        *--p = __pl0_digits[u * 2];
+    }
+    else
+    {
+        *--p = '0' + u;
+    }
+
+    if (n < 0)
+        *--p = '-';
+
+    if (__pl0_outpos > PL0RT_BUF_SIZE - sizeof(buf))
+        __pl0_flush();
+
+    for (char* q = p; q < buf + sizeof(buf); q++)
+        __pl0_out[__pl0_outpos++] = *q;
+}
+
+static inline void
+__pl0_writestr(const char* s)
+{
+    while (*s)
+        __pl0_writechar(*s++);
+}
+
+/* output that pl0c --evaluate worked out at compile time */
+static inline void
+__pl0_writebytes(const char* s, size_t n)
+{
+    while (n > 0)
+    {
+        size_t k = PL0RT_BUF_SIZE - __pl0_outpos < n ? PL0RT_BUF_SIZE - __pl0_outpos : n;
+
+        memcpy(__pl0_out + __pl0_outpos, s, k);
+        __pl0_outpos += k;
+        s += k;
+        n -= k;
+        if (__pl0_outpos == PL0RT_BUF_SIZE)
+            __pl0_flush();
+    }
+}
+
+/* --safe: `i` indexes an array of `n` elements on PL/0 line `line` */
+static inline long
+__pl0_index(long i, long n, long line)
+{
+    if (__builtin_expect((unsigned long)i >= (unsigned long)n, 0))
+    {
+        __pl0_flush();
+        (void)fprintf(stderr, "line %ld: index %ld out of bounds for size %ld\n", line, i, n);
+        exit(1);
+    }
+
+    return i;
+}
+
+#define PL0RT_MEMO_SLOTS 1024 /* results pl0c --memoize keeps of a procedure, a power of two */
+
+/* the slot of the result for inputs `k[0..n)` in a procedure's table, which a later one may take */
+static inline size_t
+__pl0_memohash(const long* k, size_t n)
+{
+    unsigned long h = 0x9E3779B97F4A7C15ul;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        h = (h ^ (unsigned long)k[i]) * 0xFF51AFD7ED558CCDul;
+        h ^= h >> 32;
+    }
+
+    return h & (PL0RT_MEMO_SLOTS - 1);
+}
+
+/* a forall body: its iterations [lo, hi], the last ones of the loop if `last`, with what it captured */
+typedef void (*__pl0_body)(long lo, long hi, bool last, void** c);
+
+void __pl0_forall(long lo, long hi, __pl0_body fn, void** c);
+
+/* adds `v`, a chunk's part of a reduction, to *p: '+' for a sum, '<' for a minimum, '>' for a maximum */
+void __pl0_reduce(void* p, long v, int op);
+
+/* the next input byte, or EOF; pending output goes out first, like a prompt would */
+static inline int
+__pl0_getc(void)
+{
+    if (__pl0_inpos == __pl0_inend)
+    {
+        ssize_t n;
+
+        __pl0_flush();
+        do
+            n = read(STDIN_FILENO, __pl0_in, PL0RT_BUF_SIZE);
+        while (n < 0 && errno == EINTR);
+
+        if (n <= 0)
+            return EOF;
+
+        __pl0_inpos = 0;
+        __pl0_inend = n;
+    }
+
+    return (unsigned char)__pl0_in[__pl0_inpos++];
+}
+
+static inline long
+__pl0_readchar(void)
+{
+    return (unsigned char)__pl0_getc();
+}
+
+/* one line holding a number in the range of long, anything else ends the program */
+static inline long
+__pl0_readint(void)
+{
+    char line[PL0RT_LONG_MAX_DIGITS + 8];
+    size_t len = 0;
+    unsigned long u = 0, limit = LONG_MAX;
+    bool bNeg = false, bDigits = false, bBad = false;
+    int c;
+
+    while ((c = __pl0_getc()) == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r')
+        if (len < sizeof(line) - 1)
+            line[len++] = c;
+
+    if (c == '-' || c == '+')
+    {
+        bNeg = c == '-';
+        limit += bNeg;
+        if (len < sizeof(line) - 1)
+            line[len++] = c;
+        c = __pl0_getc();
+    }
+
+    for (; c != EOF && c != '\n'; c = __pl0_getc())
+    {
+        if (len < sizeof(line) - 1)
+            line[len++] = c;
+
+        if (c < '0' || c > '9' || u > (limit - (c - '0')) / 10)
+            bBad = true;
+        else
+            u = u * 10 + (c - '0');
+        bDigits = true;
+    }
+
+    if (bBad || !bDigits)
+    {
+        line[len] = '\0';
+        __pl0_flush();
+        (void)fprintf(stderr, "invalid number: %s\n", line);
+        exit(1);
+    }
+
+    return bNeg ? (long)-u : (long)u;
+}
@@ -0,0 +1,625 @@
+#include "bcgen.h"
+#include "compile.h"
+#include "token.h"
+#include "adt/array.h"
+#include "adt/hashmap.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#define UNROLL_FULL_MAX 16 /* iterations of a loop with a known count that --unroll unrolls all of */
+#define UNROLL_MAX_INSTRS 256 /* bytecode an unrolled body may grow to */
+#define TAIL_CLEAR_MAX 32 /* locals the bytecode clears before starting a procedure over */
+
+typedef struct PoolEntry
+{
+    long value;
+    uint32_t idx;
+} PoolEntry;
+
+static inline int
+PoolEntryCmp(const PoolEntry e0, const PoolEntry e1)
+{
+    return e0.value != e1.value;
+}
+
+static inline size_t
+PoolEntryHash(const PoolEntry e0)
+{
+    return hashFNVBytes(&e0.value, sizeof(e0.value), 0xCBF29CE484222325);
+}
+
+HASHMAP_GEN_CODE(PoolMap, PoolEntry, PoolEntryHash, PoolEntryCmp, ADT_HASHMAP_DEFAULT_LOAD_FACTOR);
+ARRAY_GEN_CODE(ArrPool, int64_t);
+ARRAY_GEN_CODE(ArrPl0bSymbol, Pl0bSymbol);
+ARRAY_GEN_CODE(ArrPl0bProc, Pl0bProc);
+ARRAY_GEN_CODE(ArrPl0bInstr, Pl0bInstr);
+ARRAY_GEN_CODE(ArrPl0bLine, Pl0bLine);
+
+thread_local bool bModule = false;
+static thread_local ArrPool bcPool;
+static thread_local PoolMap bcPoolMap; /* constant to its index in bcPool */
+static thread_local ArrPl0bSymbol bcSyms;
+static thread_local ArrPl0bProc bcProcs; /* main first, then in the order they are declared */
+static thread_local uint32_t bcCur; /* the procedure being emitted */
+static thread_local ArrPl0bInstr bcCode;
+static thread_local ArrPl0bLine bcLines;
+static thread_local Bytes bcStrings;
+static thread_local uint32_t bcGlobals; /* slots */
+static thread_local long bcDepth; /* operands on the stack at this point of the code */
+
+static uint32_t
+bcString(const char* s)
+{
+    uint32_t off = bcStrings.size;
+
+    bytesPut(&bcStrings, s, strlen(s) + 1);
+
+    return off;
+}
+
+/* appends an instruction to the procedure being emitted, returns its pc */
+size_t
+bcEmit(int op, uint32_t arg)
+{
+    Pl0bProc* pp;
+
+    if (!bModule)
+        return 0;
+
+    if (bcLines.size == 0 || bcLines.pData[bcLines.size - 1].line != prevLine)
+        ArrPl0bLinePush(&bcLines, (Pl0bLine){.pc = bcCode.size, .line = prevLine});
+
+    pp = &bcProcs.pData[bcCur];
+    bcDepth += pl0bStackEffect(op);
+    if (bcDepth > pp->maxStack)
+        pp->maxStack = bcDepth;
+
+    ArrPl0bInstrPush(&bcCode, (Pl0bInstr){.op = op, .arg = arg});
+
+    return bcCode.size - 1;
+}
+
+void
+bcLiteral(long value)
+{
+    PoolMapReturnNode f = PoolMapSearch(&bcPoolMap, (PoolEntry){.value = value});
+
+    if (f.pData == nullptr)
+    {
+        f = PoolMapInsert(&bcPoolMap, (PoolEntry){.value = value, .idx = bcPool.size});
+        ArrPoolPush(&bcPool, value);
+    }
+
+    bcEmit(PL0B_LIT, f.pData->idx);
+}
+
+/* the number in `s`, which the lexer made sure fits */
+void
+bcNumber(const char* s)
+{
+    if (bModule)
+        bcLiteral(strtol(s, nullptr, 10));
+}
+
+/* the operator `kind` on the two topmost operands */
+void
+bcBinary(int kind)
+{
+    switch (kind)
+    {
+        case TOK_PLUS: bcEmit(PL0B_ADD, 0); break;
+        case TOK_MINUS: bcEmit(PL0B_SUB, 0); break;
+        case TOK_MULTIPLY: bcEmit(PL0B_MUL, 0); break;
+        case TOK_DIVIDE: bcEmit(PL0B_DIV, 0); break;
+        case TOK_EQUAL: bcEmit(PL0B_EQ, 0); break;
+        case TOK_HASH: bcEmit(PL0B_NE, 0); break;
+        case TOK_LESSTHAN: bcEmit(PL0B_LT, 0); break;
+        case TOK_GREATERTHAN: bcEmit(PL0B_GT, 0); break;
+    }
+}
+
+/* the C compiler catches these in C, here nothing would */
+static void
+bcAccessCheck(const SymListNode* pSym, bool bIndexed)
+{
+    if (bIndexed && pSym->data.size == 0)
+        compileError("not an array: %s", pSym->data.name);
+    if (!bIndexed && pSym->data.size != 0)
+        compileError("array without an index: %s", pSym->data.name);
+}
+
+/* pushes the constant or variable `pSym`, an element if `bIndexed`, whose index is on the stack */
+void
+bcLoad(const SymListNode* pSym, bool bIndexed)
+{
+    if (!bModule)
+        return;
+
+    bcAccessCheck(pSym, bIndexed);
+
+    if (pSym->data.type == TOK_CONST)
+        bcLiteral(pSym->data.value);
+    else if (pSym->data.depth != 0 && pSym->data.depth != scopeLevel())
+        bcEmit(bIndexed ? PL0B_LDUX : PL0B_LDU, pSym->data.iSym);
+    else if (bIndexed)
+        bcEmit(pSym->data.depth == 0 ? PL0B_LDGX : PL0B_LDLX, pSym->data.iSym);
+    else
+        bcEmit(pSym->data.depth == 0 ? PL0B_LDG : PL0B_LDL, bcSyms.pData[pSym->data.iSym].slot);
+}
+
+/* pops into the variable `pSym`, an element if `bIndexed`, whose index is below the value */
+void
+bcStore(const SymListNode* pSym, bool bIndexed)
+{
+    if (!bModule)
+        return;
+
+    bcAccessCheck(pSym, bIndexed);
+
+    if (pSym->data.depth != 0 && pSym->data.depth != scopeLevel())
+        bcEmit(bIndexed ? PL0B_STUX : PL0B_STU, pSym->data.iSym);
+    else if (bIndexed)
+        bcEmit(pSym->data.depth == 0 ? PL0B_STGX : PL0B_STLX, pSym->data.iSym);
+    else
+        bcEmit(pSym->data.depth == 0 ? PL0B_STG : PL0B_STL, bcSyms.pData[pSym->data.iSym].slot);
+}
+
+/* after the arguments, drops the result unless `bValue` */
+void
+bcCall(const SymListNode* pSym, bool bValue)
+{
+    Pl0bProc* pp;
+
+    if (!bModule)
+        return;
+
+    bcEmit(PL0B_CALL, bcSyms.pData[pSym->data.iSym].slot);
+
+    pp = &bcProcs.pData[bcCur];
+    bcDepth += pSym->data.bResult - pSym->data.nParams;
+    if (bcDepth > pp->maxStack)
+        pp->maxStack = bcDepth;
+
+    if (pSym->data.bResult && !bValue)
+        bcEmit(PL0B_POP, 0);
+}
+
+/*
+ * After the arguments of a call of `pSym`, the procedure being compiled,
+ * that ends it, see cgTailEnd(): they go into its parameters, its other
+ * locals are cleared like a call would, and it starts over.  One with more
+ * than TAIL_CLEAR_MAX of those keeps the call and returns after it.
+ */
+void
+bcTail(const SymListNode* pSym, bool bValue)
+{
+    const Pl0bProc* pp;
+    uint32_t first;
+
+    if (!bModule)
+        return;
+
+    pp = &bcProcs.pData[bcCur];
+    first = pp->nParams + pSym->data.depth;
+    if (pp->nLocals - first > TAIL_CLEAR_MAX)
+    {
+        bcCall(pSym, bValue);
+        if (bValue)
+            bcEmit(PL0B_RETV, 0);
+        return;
+    }
+
+    for (uint32_t i = pp->nParams; i-- > 0;)
+        bcEmit(PL0B_STL, i);
+    for (uint32_t i = first; i < pp->nLocals; i++)
+    {
+        bcLiteral(0);
+        bcEmit(PL0B_STL, i);
+    }
+    bcEmit(PL0B_JMP, pp->entry);
+}
+
+/* with cgEpilogue(), running off the end of a function returns 0 */
+void
+bcEpilogue(void)
+{
+    if (!bModule)
+        return;
+
+    if (pProcSym != nullptr && pProcSym->data.bResult)
+    {
+        bcLiteral(0);
+        bcEmit(PL0B_RETV, 0);
+    }
+    else
+    {
+        bcEmit(PL0B_RET, 0);
+    }
+
+    bcProcs.pData[bcCur].end = bcCode.size;
+}
+
+/* nullptr for the string `s`, written a character at a time */
+void
+bcWriteStr(const SymListNode* pSym, const char* s)
+{
+    if (!bModule)
+        return;
+
+    if (pSym == nullptr)
+    {
+        for (const char* p = s + 1; *p != '"'; p++)
+        {
+            char c = *p;
+
+            if (c == '\\')
+                c = *++p == 'n' ? '\n' : *p == 't' ? '\t' : *p;
+            bcLiteral((unsigned char)c);
+            bcEmit(PL0B_WRITECHAR, 0);
+        }
+        return;
+    }
+
+    bcEmit(PL0B_WRITESTR, pSym->data.iSym);
+}
+
+/* the pc the next instruction gets */
+size_t
+bcLabel(void)
+{
+    return bcCode.size;
+}
+
+/* makes the jump at `at` go to the next instruction */
+void
+bcPatch(size_t at)
+{
+    if (bModule)
+        bcCode.pData[at].arg = bcCode.size;
+}
+
+/* the procedure whose scope is being compiled, 0 for main */
+static uint32_t
+bcScope(void)
+{
+    return pProcSym != nullptr ? bcSyms.pData[pProcSym->data.iSym].slot : 0;
+}
+
+/* after addSymbol() of `pn`: the symbol's entry in the module, and a slot for a variable */
+void
+bcDeclare(SymNode* pn)
+{
+    Pl0bSymbol sym;
+
+    if (!bModule)
+        return;
+
+    sym = (Pl0bSymbol){.name = bcString(pn->name), .depth = pn->depth};
+
+    switch (pn->type)
+    {
+        case TOK_CONST:
+            sym.kind = PL0B_SYM_CONST;
+            break;
+
+        case TOK_VAR:
+            sym.kind = PL0B_SYM_VAR;
+            if (pn->depth == 0)
+            {
+                sym.slot = bcGlobals++;
+            }
+            else
+            {
+                sym.proc = bcScope();
+                sym.slot = bcProcs.pData[sym.proc].nLocals++;
+            }
+            break;
+
+        case TOK_PROCEDURE:
+            sym.kind = PL0B_SYM_PROC;
+            break;
+    }
+
+    pn->iSym = bcSyms.size;
+    ArrPl0bSymbolPush(&bcSyms, sym);
+}
+
+/* after constValue() */
+void
+bcConst(const SymNode* pn)
+{
+    if (bModule)
+        bcSyms.pData[pn->iSym].value = pn->value;
+}
+
+/* after arraySize(): the rest of the array's slots */
+void
+bcArray(const SymNode* pn)
+{
+    Pl0bSymbol* ps;
+    uint32_t* pSlots;
+
+    if (!bModule)
+        return;
+
+    ps = &bcSyms.pData[pn->iSym];
+    pSlots = pn->depth == 0 ? &bcGlobals : &bcProcs.pData[ps->proc].nLocals;
+
+    if (pn->size > UINT32_MAX - *pSlots)
+        compileError("array too large: %s", pn->name);
+
+    ps->kind = PL0B_SYM_ARRAY;
+    ps->value = pn->size;
+    *pSlots += pn->size - 1;
+}
+
+/* after bcDeclare() of a procedure: its entry in the procedures, declared in the one being compiled */
+void
+bcProcedure(const SymNode* pn)
+{
+    Pl0bSymbol* ps;
+
+    if (!bModule)
+        return;
+
+    ps = &bcSyms.pData[pn->iSym];
+    ps->slot = bcProcs.size;
+    ArrPl0bProcPush(&bcProcs, (Pl0bProc){.name = ps->name, .depth = pn->depth + 1, .parent = bcScope()});
+}
+
+/* with cgProcedure(), the code of the procedure being compiled starts here */
+void
+bcBody(void)
+{
+    if (!bModule)
+        return;
+
+    bcCur = bcScope();
+    bcProcs.pData[bcCur].entry = bcCode.size;
+    bcDepth = 0;
+}
+
+/* after the parameters, which bcDeclare() gave the first slots, and before the display */
+void
+bcParameters(void)
+{
+    Pl0bProc* pp;
+
+    if (!bModule)
+        return;
+
+    pp = &bcProcs.pData[bcScope()];
+    pp->nParams = pProcSym->data.nParams;
+    pp->nResults = pProcSym->data.bResult;
+    pp->nLocals += pProcSym->data.depth;
+}
+
+void
+bcInit(void)
+{
+    if (!bModule)
+        return;
+
+    /* arrays stay allocated across compilations on the same thread */
+    if (bcCode.capacity == 0)
+    {
+        bcPool = ArrPoolCreate(ADT_DEFAULT_SIZE);
+        bcSyms = ArrPl0bSymbolCreate(ADT_DEFAULT_SIZE);
+        bcProcs = ArrPl0bProcCreate(ADT_DEFAULT_SIZE);
+        bcCode = ArrPl0bInstrCreate(ADT_DEFAULT_SIZE);
+        bcLines = ArrPl0bLineCreate(ADT_DEFAULT_SIZE);
+    }
+
+    bcPoolMap = PoolMapCreate(ADT_DEFAULT_SIZE);
+
+    /* symtab's "main" */
+    ArrPl0bSymbolPush(&bcSyms, (Pl0bSymbol){.name = bcString("main"), .kind = PL0B_SYM_PROC});
+    ArrPl0bProcPush(&bcProcs, (Pl0bProc){.name = bcSyms.pData[0].name});
+}
+
+/* the step of the counted loop `pl`, whose statement the parser skips */
+void
+bcStep(const CountedLoop* pl)
+{
+    if (!bModule)
+        return;
+
+    bcLoad(pl->pVar, false);
+    bcLiteral(pl->step);
+    bcEmit(PL0B_ADD, 0);
+    bcStore(pl->pVar, false);
+}
+
+/* appends `in`, emitted before from source line `line`, which leaves the operands as they were */
+static void
+bcPut(Pl0bInstr in, uint32_t line)
+{
+    if (bcLines.size == 0 || bcLines.pData[bcLines.size - 1].line != line)
+        ArrPl0bLinePush(&bcLines, (Pl0bLine){.pc = bcCode.size, .line = line});
+
+    ArrPl0bInstrPush(&bcCode, in);
+}
+
+/* appends the `n` instructions that were at `from`, jumps between them going to their copies */
+static void
+bcCopy(const Pl0bInstr* aCode, const uint32_t* aLine, size_t n, size_t from)
+{
+    size_t to = bcCode.size;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        Pl0bInstr in = aCode[i];
+
+        if ((in.op == PL0B_JMP || in.op == PL0B_JZ) && in.arg >= from && in.arg < from + n)
+            in.arg = to + (in.arg - from);
+        bcPut(in, aLine[i]);
+    }
+}
+
+/*
+ * With --unroll, at the end of the body of counted loop `pl`, whose test
+ * is at `top` and jumps out from `at`: replaces the loop by one that runs
+ * `unroll` copies of the body per test while that many iterations are left,
+ * then one per test:
+ *
+ *	top:	test; JZ out; bound - var > (unroll - 1) * step; JZ one
+ *		body; ...; body; JMP top
+ *	one:	body; JMP top
+ *	out:
+ *
+ * bound - var only wraps around where it is too large to tell, which sends
+ * the loop the slow way.  A loop that `init` starts, to a constant bound,
+ * runs a known number of times, and if that is small it becomes as many
+ * copies of the body.  The body changes neither var nor bound but with its
+ * step, its last statement, see loopCounted().  Returns BC_ROLLED if it
+ * left the loop's end to emit.
+ */
+int
+bcUnroll(const CountedLoop* pl, RangeInit init, size_t top, size_t at, size_t unroll)
+{
+    size_t body = at + 1, n = bcCode.size - body;
+    size_t trips = SIZE_MAX, line, one;
+    bool bFull;
+    Pl0bInstr* aCode;
+    uint32_t* aLine;
+
+    if (!bModule || unroll < 2 || pl->step > LONG_MAX / UNROLL_MAX)
+        return BC_ROLLED;
+
+    if (init.pVar == pl->pVar && pl->pBound == nullptr && pl->step > 0)
+        trips = init.value < pl->bound ? (pl->bound - init.value - 1) / pl->step + 1 : 0;
+    bFull = trips <= UNROLL_FULL_MAX && trips * n <= UNROLL_MAX_INSTRS;
+    if (!bFull && unroll * n > UNROLL_MAX_INSTRS)
+        return BC_ROLLED;
+
+    if ((aCode = malloc(n * sizeof(*aCode))) == nullptr || (aLine = malloc(n * sizeof(*aLine))) == nullptr)
+        LOG_FATAL("malloc failed");
+    memcpy(aCode, bcCode.pData + body, n * sizeof(*aCode));
+    for (line = bcLines.size - 1; bcLines.pData[line].pc > body; line--)
+        ;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (line + 1 < bcLines.size && bcLines.pData[line + 1].pc <= body + i)
+            ++line;
+        aLine[i] = bcLines.pData[line].line;
+    }
+
+    /* unrolled all the way, the test never runs and the copies go where it was */
+    bcCode.size = bFull ? top : body;
+    while (bcLines.size > 0 && bcLines.pData[bcLines.size - 1].pc >= bcCode.size)
+        --bcLines.size;
+
+    if (bFull)
+    {
+        for (size_t i = 0; i < trips; i++)
+            bcCopy(aCode, aLine, n, body);
+    }
+    else
+    {
+        if (pl->pBound != nullptr)
+            bcLoad(pl->pBound, false);
+        else
+            bcLiteral(pl->bound);
+        bcLoad(pl->pVar, false);
+        bcEmit(PL0B_SUB, 0);
+        bcLiteral((unroll - 1) * pl->step);
+        bcEmit(PL0B_GT, 0);
+        one = bcEmit(PL0B_JZ, 0);
+        for (size_t i = 0; i < unroll; i++)
+            bcCopy(aCode, aLine, n, body);
+        bcEmit(PL0B_JMP, top);
+        bcPatch(one);
+        bcCopy(aCode, aLine, n, body);
+        bcEmit(PL0B_JMP, top);
+        bcPatch(at);
+    }
+
+    free(aCode);
+    free(aLine);
+
+    return bFull ? BC_UNROLLED_FULLY : BC_UNROLLED;
+}
+
+/* with both bounds on the stack: the loop variable `pVar` starts at the lower one */
+void
+bcForall(const SymListNode* pVar, ForallLoop* pl)
+{
+    if (!bModule)
+        return;
+
+    /* a slot no symbol has, main's are globals */
+    pl->hi = bcCur == 0 ? bcGlobals++ : bcProcs.pData[bcCur].nLocals++;
+    bcEmit(bcCur == 0 ? PL0B_STG : PL0B_STL, pl->hi);
+    bcStore(pVar, false);
+
+    pl->top = bcLabel();
+    bcLoad(pVar, false);
+    bcEmit(bcCur == 0 ? PL0B_LDG : PL0B_LDL, pl->hi);
+    bcEmit(PL0B_GT, 0);
+    bcLiteral(0);
+    bcEmit(PL0B_EQ, 0);
+    pl->exit = bcEmit(PL0B_JZ, 0);
+}
+
+/* after the body */
+void
+bcForallEnd(const SymListNode* pVar, const ForallLoop* pl)
+{
+    if (!bModule)
+        return;
+
+    bcLoad(pVar, false);
+    bcLiteral(1);
+    bcEmit(PL0B_ADD, 0);
+    bcStore(pVar, false);
+    bcEmit(PL0B_JMP, pl->top);
+    bcPatch(pl->exit);
+}
+
+/* the module in the arrays, with only the parts of `pHeader` vmRun() uses */
+Pl0bModule
+bcModule(Pl0bHeader* pHeader)
+{
+    *pHeader = (Pl0bHeader){.nGlobals = bcGlobals, .mainProc = 0};
+
+    return (Pl0bModule){
+        .pHeader = pHeader,
+        .aPool = bcPool.pData,
+        .aSymbols = bcSyms.pData,
+        .aProcs = bcProcs.pData,
+        .aCode = bcCode.pData,
+        .aLines = bcLines.pData,
+        .pStrings = bcStrings.pData,
+        .nPool = bcPool.size,
+        .nSymbols = bcSyms.size,
+        .nProcs = bcProcs.size,
+        .nCode = bcCode.size,
+        .nLines = bcLines.size,
+        .nStrings = bcStrings.size,
+    };
+}
+
+/* for the next compilation on this thread */
+void
+bcReset(void)
+{
+    if (bcPoolMap.pBuckets)
+    {
+        PoolMapClean(&bcPoolMap);
+        bcPoolMap.pBuckets = nullptr;
+    }
+    bcPool.size = bcSyms.size = bcProcs.size = bcCode.size = bcLines.size = bcStrings.size = 0;
+    bcGlobals = 0;
+}
+
+void
+bcDestroy(void)
+{
+    ArrPoolClean(&bcPool);
+    ArrPl0bSymbolClean(&bcSyms);
+    ArrPl0bProcClean(&bcProcs);
+    ArrPl0bInstrClean(&bcCode);
+    ArrPl0bLineClean(&bcLines);
+    free(bcStrings.pData);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "pl0c.h"
+#include "pl0b.h"
+
+/*
+ * The bytecode emitter: the parser calls it alongside the C code
+ * generator, and it builds a .pl0b module in memory for --bytecode, -o
+ * and --evaluate.  Without bModule every call does nothing.
+ */
+
+/* a forall, whose iterations the bytecode runs in order */
+typedef struct ForallLoop
+{
+    uint32_t hi; /* the slot of its upper bound */
+    size_t top; /* of the test */
+    size_t exit; /* the jump out */
+} ForallLoop;
+
+/* what bcUnroll() did */
+enum
+{
+    BC_ROLLED, /* nothing, the loop's end is still to emit */
+    BC_UNROLLED,
+    BC_UNROLLED_FULLY,
+};
+
+extern thread_local bool bModule; /* the parser emits bytecode, for --bytecode or --evaluate */
+
+void bcInit(void);
+void bcReset(void);
+void bcDestroy(void);
+Pl0bModule bcModule(Pl0bHeader* pHeader);
+
+size_t bcEmit(int op, uint32_t arg);
+void bcLiteral(long value);
+void bcNumber(const char* s);
+void bcBinary(int kind);
+void bcLoad(const SymListNode* pSym, bool bIndexed);
+void bcStore(const SymListNode* pSym, bool bIndexed);
+void bcCall(const SymListNode* pSym, bool bValue);
+void bcTail(const SymListNode* pSym, bool bValue);
+void bcEpilogue(void);
+void bcWriteStr(const SymListNode* pSym, const char* s);
+size_t bcLabel(void);
+void bcPatch(size_t at);
+
+void bcDeclare(SymNode* pn);
+void bcConst(const SymNode* pn);
+void bcArray(const SymNode* pn);
+void bcProcedure(const SymNode* pn);
+void bcBody(void);
+void bcParameters(void);
+
+void bcStep(const CountedLoop* pl);
+int bcUnroll(const CountedLoop* pl, RangeInit init, size_t top, size_t at, size_t unroll);
+void bcForall(const SymListNode* pVar, ForallLoop* pl);
+void bcForallEnd(const SymListNode* pVar, const ForallLoop* pl);
@@ -0,0 +1,236 @@
+#include "cache.h"
+#include "misc.h"
+#include "adt/array.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_TMP_STALE_SEC 600 /* no compiler takes this long to write an entry */
+
+typedef struct CacheEntry
+{
+    char* path;
+    off_t size;
+    struct timespec mtime;
+} CacheEntry;
+
+ARRAY_GEN_CODE(ArrCacheEntry, CacheEntry);
+
+CacheKey
+cacheKeyInit(void)
+{
+    return (CacheKey){.h0 = 0xCBF29CE484222325, .h1 = 525201411107845655ull};
+}
+
+void
+cacheKeyAdd(CacheKey* self, const void* data, size_t size)
+{
+    /* the length goes in too, so that chained parts can't shift into each other */
+    self->h0 = hashFNVBytes(&size, sizeof(size), self->h0);
+    self->h0 = hashFNVBytes(data, size, self->h0);
+    self->h1 = hashMurmurOAAT64Bytes(&size, sizeof(size), self->h1);
+    self->h1 = hashMurmurOAAT64Bytes(data, size, self->h1);
+}
+
+static void
+entryPath(char* buf, size_t size, const char* dir, CacheKey key)
+{
+    snprintf(buf, size, "%s/%016zx%016zx.c", dir, key.h0, key.h1);
+}
+
+int
+cacheLookup(const char* dir, CacheKey key, FILE* out)
+{
+    char path[PATH_MAX];
+    char buf[1 << 16];
+    size_t written = 0;
+    ssize_t n;
+    int fd, err;
+
+    entryPath(path, sizeof(path), dir, key);
+
+    /* an entry evicted after this open stays readable through fd */
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return CACHE_MISS;
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            break;
+        written += fwrite(buf, 1, n, out);
+    }
+
+    err = errno;
+    close(fd);
+
+    /* nothing is lost before the first byte, compiling anew still gives the whole output */
+    if (n == -1)
+    {
+        errno = err;
+        return written == 0 ? CACHE_MISS : CACHE_BROKEN;
+    }
+
+    /* refresh the LRU position */
+    utimensat(AT_FDCWD, path, nullptr, 0);
+
+    return CACHE_HIT;
+}
+
+static int
+entryCmp(const void* p0, const void* p1)
+{
+    const CacheEntry* a = p0;
+    const CacheEntry* b = p1;
+
+    if (a->mtime.tv_sec != b->mtime.tv_sec)
+        return a->mtime.tv_sec < b->mtime.tv_sec ? -1 : 1;
+
+    return a->mtime.tv_nsec < b->mtime.tv_nsec ? -1 : a->mtime.tv_nsec > b->mtime.tv_nsec;
+}
+
+/* whether `name` is an entry as entryPath() names it, the directory may hold anything else */
+static bool
+isEntry(const char* name, size_t len)
+{
+    if (len != CACHE_KEY_LEN + 2 || strcmp(name + CACHE_KEY_LEN, ".c") != 0)
+        return false;
+
+    for (size_t i = 0; i < CACHE_KEY_LEN; i++)
+    {
+        if (!(name[i] >= '0' && name[i] <= '9') && !(name[i] >= 'a' && name[i] <= 'f'))
+            return false;
+    }
+
+    return true;
+}
+
+/* whether `name` is a temporary file of cacheStore(), ".pl0c-XXXXXX.tmp" */
+static bool
+isTmp(const char* name, size_t len)
+{
+    return len == 16 && strncmp(name, ".pl0c-", 6) == 0 && strcmp(name + 12, ".tmp") == 0;
+}
+
+/*
+ * Drop the least recently used entries until the directory fits into
+ * maxBytes, and temporary files no compiler is writing any more.
+ */
+static void
+evict(const char* dir, size_t maxBytes)
+{
+    DIR* d;
+    struct dirent* de;
+    struct stat st;
+    struct timespec now;
+    char path[PATH_MAX];
+    size_t total = 0;
+    ArrCacheEntry aEntries;
+
+    if ((d = opendir(dir)) == nullptr)
+        return;
+
+    aEntries = ArrCacheEntryCreate(ADT_DEFAULT_SIZE);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    while ((de = readdir(d)) != nullptr)
+    {
+        size_t len = strlen(de->d_name);
+        bool bTmp = isTmp(de->d_name, len);
+
+        if (!bTmp && !isEntry(de->d_name, len))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) == -1)
+            continue; /* evicted by someone else meanwhile */
+
+        if (bTmp)
+        {
+            if (now.tv_sec - st.st_mtim.tv_sec > CACHE_TMP_STALE_SEC)
+                unlink(path);
+            continue;
+        }
+
+        total += st.st_size;
+        ArrCacheEntryPush(&aEntries, (CacheEntry){.path = strdup(path), .size = st.st_size, .mtime = st.st_mtim});
+    }
+
+    closedir(d);
+
+    if (total > maxBytes)
+    {
+        qsort(aEntries.pData, aEntries.size, sizeof(CacheEntry), entryCmp);
+
+        for (size_t i = 0; i < aEntries.size && total > maxBytes; i++)
+        {
+            /* ENOENT means a concurrent eviction got there first, the space is gone either way */
+            unlink(aEntries.pData[i].path);
+            total -= aEntries.pData[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < aEntries.size; i++)
+        free(aEntries.pData[i].path);
+    ArrCacheEntryClean(&aEntries);
+}
+
+void
+cacheStore(const char* dir, CacheKey key, const char* data, size_t size, size_t maxBytes)
+{
+    char path[PATH_MAX], tmp[PATH_MAX];
+    int fd;
+
+    if (mkdir(dir, 0777) == -1 && errno != EEXIST)
+    {
+        fprintf(stderr, "pl0c: cache: couldn't create %s: %s\n", dir, strerror(errno));
+        return;
+    }
+
+    entryPath(path, sizeof(path), dir, key);
+    snprintf(tmp, sizeof(tmp), "%s/.pl0c-XXXXXX.tmp", dir);
+
+    if ((fd = mkstemps(tmp, 4)) == -1)
+    {
+        fprintf(stderr, "pl0c: cache: couldn't create %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+
+    for (size_t off = 0; off < size;)
+    {
+        ssize_t n = write(fd, data + off, size - off);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "pl0c: cache: couldn't write %s: %s\n", tmp, strerror(errno));
+            close(fd);
+            unlink(tmp);
+            return;
+        }
+        off += n;
+    }
+
+    /* mkstemps() creates 0600, entries should be shared like any build output */
+    fchmod(fd, 0644);
+    close(fd);
+
+    /* atomic: readers see either no entry or a complete one */
+    if (rename(tmp, path) == -1)
+    {
+        fprintf(stderr, "pl0c: cache: couldn't rename %s: %s\n", tmp, strerror(errno));
+        unlink(tmp);
+        return;
+    }
+
+    evict(dir, maxBytes);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdio.h>
+
+/*
+ * On-disk cache of compiler output keyed by a hash of everything that
+ * determines it (source, compiler version, flags).  Entries are written to a
+ * temporary file and renamed into place, so concurrent compilers never see a
+ * partial entry, and the directory is kept under a size bound by evicting the
+ * least recently used entries (hits refresh an entry's mtime).  Temporary
+ * files that compilers left behind when they died go with the eviction.
+ */
+
+#define CACHE_KEY_LEN 32
+#define CACHE_DEFAULT_MAX_MB 256
+
+typedef struct CacheKey
+{
+    size_t h0;
+    size_t h1;
+} CacheKey;
+
+CacheKey cacheKeyInit(void);
+void cacheKeyAdd(CacheKey* self, const void* data, size_t size);
+
+/* what cacheLookup() found */
+enum
+{
+    CACHE_MISS,
+    CACHE_HIT,
+    CACHE_BROKEN, /* reading failed after part of the entry was written, errno says why */
+};
+
+int cacheLookup(const char* dir, CacheKey key, FILE* out);
+void cacheStore(const char* dir, CacheKey key, const char* data, size_t size, size_t maxBytes);
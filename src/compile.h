@@ -0,0 +1,41 @@
+#pragma once
+#include <stdio.h>
+
+#define SPLIT_DEFAULT_UNITS 8
+#define SPLIT_MAX_UNITS 4096
+#define UNROLL_MAX 16
+
+/* everything that changes how a single file is compiled */
+typedef struct Options
+{
+    bool bStats;
+    bool bInstrument;
+    bool bSafe; /* --safe: check array indices at run time */
+    bool bParallel; /* --parallel: run loops whose iterations are independent on all CPUs */
+    bool bMemoize; /* --memoize: cache the results of procedures that only compute */
+    size_t unroll; /* --unroll: copies of a counted loop's body per test, 0 or 1 to leave loops as they are */
+    const char* profPath; /* --profile, or nullptr */
+    const char* cacheDir; /* --cache, or nullptr */
+    size_t cacheMaxBytes;
+    bool bStream; /* --stream: read `path` through a fixed window */
+    const char* splitDir; /* --split: write translation units there, or nullptr */
+    size_t nUnits; /* --units: how many, at most */
+    bool bBytecode; /* --bytecode: write a .pl0b module instead of C */
+    bool bExecutable; /* -o: write a static x86-64 executable instead of C */
+    size_t evalSteps; /* --evaluate: loop iterations and calls to run at compile time, or 0 */
+} Options;
+
+/*
+ * Compiles `path`, or `src` if it isn't nullptr (`size` bytes, NUL-terminated
+ * and owned by compile() from then on), writing C, a module or an executable to `out` and
+ * diagnostics to `err`.  Returns the exit status.  Compiler state is thread-local, so
+ * threads may compile concurrently once compilerInit() has run.
+ */
+int compile(const Options* pOpts, const char* path, char* src, size_t size, FILE* out, FILE* err);
+
+/* `nThreads` lex large inputs and format procedures in parallel, 0 for one per CPU */
+void compilerInit(size_t nThreads);
+void compilerDestroy(void);
+
+/* all of `fp`, NUL-terminated */
+char* readAll(FILE* fp, size_t* pSize);
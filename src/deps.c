@@ -0,0 +1,562 @@
+#include "deps.h"
+#include "token.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MEMO_INPUTS_MAX 4 /* parameters and globals a cached result may depend on */
+#define MEMO_OUTPUTS_MAX 4 /* globals it may assign */
+
+thread_local const SymListNode* pForallVar;
+static thread_local int forallNested; /* statements of its body that don't always run, around the current one */
+thread_local ArrForallVar aForallVars;
+static thread_local const SymListNode* pReduceRead; /* the next read, and write, of it is the reduction's */
+static thread_local const SymListNode* pReduceWrite;
+static thread_local bool bForallAuto; /* a counted loop, see cgParallel(), which is only parallel if nothing fails */
+static thread_local bool bForallFailed;
+
+thread_local bool bEffAlways;
+thread_local bool bEffReturned;
+thread_local size_t nMemoized;
+
+/*
+ * The body of a forall is checked as it is parsed, so that running its
+ * iterations at the same time is the same as running them in order.  Each
+ * iteration has its own copy of the scalars the body assigns, which it must
+ * assign before it reads them, and the copy of the last iteration is the
+ * value after the loop; the body may only read the others, or use them in
+ * a sum, minimum or maximum.  An array it assigns an element of must be
+ * indexed by the variable of the forall plus the same constant throughout.
+ * With --parallel, a counted loop is checked the same way, and what would
+ * be an error just keeps it in order.
+ */
+
+/* from here the body of the forall over `pVar` is checked, a counted loop's `bAuto` */
+void
+forallBegin(const SymListNode* pVar, bool bAuto)
+{
+    /* the array stays allocated across compilations on the same thread */
+    if (aForallVars.capacity == 0)
+        aForallVars = ArrForallVarCreate(ADT_DEFAULT_SIZE);
+
+    pForallVar = pVar;
+    forallNested = 0;
+    aForallVars.size = 0;
+    bForallAuto = bAuto;
+    bForallFailed = false;
+}
+
+/* after the body: whether it kept the rules */
+bool
+forallFinish(void)
+{
+    pForallVar = nullptr;
+    bForallAuto = false;
+
+    return !bForallFailed;
+}
+
+/* the body breaks a rule */
+static void
+forallFail(const char* fmt, ...)
+{
+    char msg[256];
+    va_list ap;
+
+    if (bForallAuto)
+    {
+        bForallFailed = true;
+        return;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    compileError("%s", msg);
+}
+
+/* the entry of variable `pSym` in the forall being compiled, nullptr if it has none */
+ForallVar*
+forallVar(const SymListNode* pSym, int use)
+{
+    if (pForallVar == nullptr || pSym->data.type != TOK_VAR || pSym == pForallVar)
+        return nullptr;
+
+    for (size_t i = 0; i < aForallVars.size; i++)
+    {
+        if (aForallVars.pData[i].pSym == pSym)
+            return &aForallVars.pData[i];
+    }
+
+    if (pSym->data.size != 0)
+        use = FORALL_ARRAY;
+
+    ArrForallVarPush(&aForallVars,
+                     (ForallVar){.pSym = pSym, .use = use, .assignedAt = INT_MAX, .offset = FORALL_NO_OFFSET});
+
+    return &aForallVars.pData[aForallVars.size - 1];
+}
+
+static bool
+forallReduced(const ForallVar* pv)
+{
+    return pv->use == FORALL_SUM || pv->use == FORALL_MIN || pv->use == FORALL_MAX;
+}
+
+void
+forallRead(const SymListNode* pSym)
+{
+    const ForallVar* pv;
+
+    if (pSym == pReduceRead)
+    {
+        pReduceRead = nullptr;
+        return;
+    }
+
+    if ((pv = forallVar(pSym, FORALL_READ)) == nullptr)
+        return;
+
+    if (pv->use == FORALL_PRIVATE && pv->assignedAt == INT_MAX)
+        forallFail("a forall body reads %s before it assigns it", pSym->data.name);
+    else if (forallReduced(pv))
+        forallFail("a forall body uses %s other than to reduce it", pSym->data.name);
+}
+
+void
+forallWrite(const SymListNode* pSym)
+{
+    ForallVar* pv;
+
+    if (pSym == pReduceWrite)
+    {
+        pReduceWrite = nullptr;
+        return;
+    }
+
+    if (pForallVar != nullptr && pSym == pForallVar)
+        forallFail("a forall body assigns its variable %s", pSym->data.name);
+    if ((pv = forallVar(pSym, FORALL_PRIVATE)) == nullptr)
+        return;
+
+    if (pv->use == FORALL_READ)
+        forallFail("a forall body reads %s before it assigns it", pSym->data.name);
+    else if (forallReduced(pv))
+        forallFail("a forall body uses %s other than to reduce it", pSym->data.name);
+    else if (pv->bLoop)
+        forallFail("a forall body assigns its variable %s", pSym->data.name);
+    else if (forallNested < pv->assignedAt)
+        pv->assignedAt = forallNested;
+}
+
+/*
+ * The statement uses scalar `pSym` only in reduction `use`, if this is its
+ * first use or it is one already: then its next read and write don't count.
+ */
+void
+forallReduce(const SymListNode* pSym, int use)
+{
+    ForallVar* pv;
+
+    if (pForallVar == nullptr || pSym == pForallVar || pSym->data.type != TOK_VAR || pSym->data.size != 0)
+        return;
+
+    for (size_t i = 0; i < aForallVars.size; i++)
+    {
+        if (aForallVars.pData[i].pSym == pSym && aForallVars.pData[i].use != use)
+            return;
+    }
+
+    pv = forallVar(pSym, use);
+    pReduceRead = pReduceWrite = pv->pSym;
+}
+
+/* at the name of scalar `pSym` being assigned: whether it is `var := var + ...` or `var := var - ...` */
+bool
+forallSum(const SymListNode* pSym)
+{
+    TokenCursor c = cur;
+    const char* p;
+    size_t len;
+    int kind;
+
+    if (!bTokens || pForallVar == nullptr || cursorNext(&c, &p, &len) != TOK_ASSIGN ||
+        cursorNext(&c, &p, &len) != TOK_IDENT || symFind(p, len) != pSym)
+        return false;
+
+    kind = cursorNext(&c, &p, &len);
+
+    return kind == TOK_PLUS || kind == TOK_MINUS;
+}
+
+/* whether the `n` tokens at `a` and `b` are the same, and none of them is `pNot` */
+static bool
+cursorSame(TokenCursor a, TokenCursor b, size_t n, const SymListNode* pNot)
+{
+    const char* p;
+    const char* q;
+    size_t len, qlen;
+
+    for (; n > 0; n--)
+    {
+        int kind = cursorNext(&a, &p, &len);
+
+        if (cursorNext(&b, &q, &qlen) != kind || len != qlen || memcmp(p, q, len) != 0 ||
+            (kind == TOK_IDENT && symFind(p, len) == pNot))
+            return false;
+    }
+
+    return true;
+}
+
+/* whether the `n` tokens at `c` are just the name of `pSym` */
+static bool
+cursorIs(TokenCursor c, size_t n, const SymListNode* pSym)
+{
+    const char* p;
+    size_t len;
+
+    return n == 1 && cursorNext(&c, &p, &len) == TOK_IDENT && symFind(p, len) == pSym;
+}
+
+/*
+ * At "if" with the next token current: FORALL_MIN if it is `if value < var
+ * then var := value` or `if var > value then var := value` with var in
+ * *ppSym and a value that doesn't use it, FORALL_MAX the other way round,
+ * else -1.
+ */
+int
+forallMinMax(const SymListNode** ppSym)
+{
+    TokenCursor c = cur, left = cur, right, value;
+    const char* p;
+    size_t len, nLeft = 0, nRight = 0, nValue = 0;
+    int kind, op, depth = 0;
+
+    if (!bTokens || pForallVar == nullptr)
+        return -1;
+
+    for (;;)
+    {
+        kind = cursorNext(&c, &p, &len);
+        if (depth == 0 && (kind == TOK_LESSTHAN || kind == TOK_GREATERTHAN || kind == TOK_EQUAL ||
+                           kind == TOK_HASH || kind == TOK_THEN || isStatementEnd(kind)))
+            break;
+        depth += (kind == TOK_LBRACK || kind == TOK_LPAREN) - (kind == TOK_RBRACK || kind == TOK_RPAREN);
+        ++nLeft;
+    }
+    if ((op = kind) != TOK_LESSTHAN && op != TOK_GREATERTHAN)
+        return -1;
+
+    right = c;
+    while ((kind = cursorNext(&c, &p, &len)) != TOK_THEN && !isStatementEnd(kind))
+        ++nRight;
+    if (kind != TOK_THEN || cursorNext(&c, &p, &len) != TOK_IDENT || (*ppSym = symFind(p, len)) == nullptr ||
+        (*ppSym)->data.type != TOK_VAR || (*ppSym)->data.size != 0 || cursorNext(&c, &p, &len) != TOK_ASSIGN)
+        return -1;
+
+    value = c;
+    while (!isStatementEnd(cursorNext(&c, &p, &len)))
+        ++nValue;
+
+    if (cursorIs(right, nRight, *ppSym) && nLeft == nValue && cursorSame(left, value, nValue, *ppSym))
+        return op == TOK_LESSTHAN ? FORALL_MIN : FORALL_MAX;
+    if (cursorIs(left, nLeft, *ppSym) && nRight == nValue && cursorSame(right, value, nValue, *ppSym))
+        return op == TOK_LESSTHAN ? FORALL_MAX : FORALL_MIN;
+
+    return -1;
+}
+
+/* an element of array `pSym`, whose index is the variable of the forall plus `offset` unless FORALL_NO_OFFSET */
+void
+forallElement(const SymListNode* pSym, bool bWrite, long offset)
+{
+    ForallVar* pv = forallVar(pSym, FORALL_ARRAY);
+
+    if (pv == nullptr)
+        return;
+
+    pv->bWritten |= bWrite;
+    if (pv->offset == FORALL_NO_OFFSET && pv->otherLine == 0)
+        pv->offset = offset;
+    if ((offset == FORALL_NO_OFFSET || offset != pv->offset) && pv->otherLine == 0)
+        pv->otherLine = line;
+    if (pv->bWritten && pv->otherLine != 0)
+        forallFail("a forall body assigns elements of %s that other iterations use, see line %zu", pSym->data.name,
+                   pv->otherLine);
+}
+
+/* with the first token of an index current: its offset from the variable of the forall, or FORALL_NO_OFFSET */
+long
+forallOffset(void)
+{
+    TokenCursor c = cur;
+    const char* p;
+    size_t len;
+    int kind, sign;
+    long value;
+
+    if (pForallVar == nullptr || type != TOK_IDENT || symLookup(token) != pForallVar || !bTokens)
+        return FORALL_NO_OFFSET;
+
+    if ((kind = cursorNext(&c, &p, &len)) == TOK_RBRACK)
+        return 0;
+    if (kind != TOK_PLUS && kind != TOK_MINUS)
+        return FORALL_NO_OFFSET;
+
+    sign = kind;
+    kind = cursorNext(&c, &p, &len);
+    value = rangeValue(kind, p, len);
+    if (value < 0 || cursorNext(&c, &p, &len) != TOK_RBRACK)
+        return FORALL_NO_OFFSET;
+
+    return sign == TOK_MINUS ? -value : value;
+}
+
+void
+forallForbid(const char* what)
+{
+    if (pForallVar != nullptr)
+        forallFail("%s in a forall body", what);
+}
+
+/* around a statement of the body that may not run */
+void
+forallEnter(void)
+{
+    if (pForallVar != nullptr)
+        ++forallNested;
+}
+
+/* what the statement assigned isn't assigned after it */
+void
+forallLeave(void)
+{
+    if (pForallVar == nullptr)
+        return;
+
+    for (size_t i = 0; i < aForallVars.size; i++)
+    {
+        if (aForallVars.pData[i].assignedAt == forallNested)
+            aForallVars.pData[i].assignedAt = INT_MAX;
+    }
+    --forallNested;
+}
+
+/* after the body of the forall over `pVar`: the value of each scalar after the loop is that of the last iteration */
+void
+forallEnd(const SymListNode* pVar)
+{
+    if (pForallVar != pVar)
+        return;
+
+    for (size_t i = 0; i < aForallVars.size; i++)
+    {
+        const ForallVar* pv = &aForallVars.pData[i];
+
+        if (pv->use == FORALL_PRIVATE && pv->assignedAt != 0)
+            forallFail("a forall body assigns %s only in statements that may not run", pv->pSym->data.name);
+    }
+}
+
+/*
+ * Effect summaries, with --memoize.  The parser adds what the statements
+ * of a procedure read and assign to its summary, and a call adds that of
+ * the procedure it calls.  Only a recursive call finds the summary
+ * incomplete, and it adds nothing that the procedures around it, which
+ * contain the call, don't add themselves.
+ */
+
+/* the summary of a procedure, with --memoize */
+Effects*
+effCreate(void)
+{
+    Effects* pe = calloc(1, sizeof(*pe));
+
+    if (pe == nullptr)
+        LOG_FATAL("calloc failed");
+
+    pe->aReads = ArrSymRefCreate(ADT_DEFAULT_SIZE);
+    pe->aWrites = ArrSymRefCreate(ADT_DEFAULT_SIZE);
+    pe->aAlways = ArrSymRefCreate(ADT_DEFAULT_SIZE);
+    pe->aInputs = ArrSymRefCreate(ADT_DEFAULT_SIZE);
+
+    return pe;
+}
+
+void
+effFree(Effects* pe)
+{
+    if (pe == nullptr)
+        return;
+
+    ArrSymRefClean(&pe->aReads);
+    ArrSymRefClean(&pe->aWrites);
+    ArrSymRefClean(&pe->aAlways);
+    ArrSymRefClean(&pe->aInputs);
+    free(pe);
+}
+
+/* the summary of the procedure being compiled, nullptr in main or without --memoize */
+static Effects*
+effCurrent(void)
+{
+    return pProcSym != nullptr ? pProcSym->data.pEff : nullptr;
+}
+
+static bool
+effHas(const ArrSymRef* pArr, const SymListNode* pSym)
+{
+    for (size_t i = 0; i < pArr->size; i++)
+    {
+        if (pArr->pData[i] == pSym)
+            return true;
+    }
+
+    return false;
+}
+
+static void
+effAdd(ArrSymRef* pArr, const SymListNode* pSym)
+{
+    if (!effHas(pArr, pSym))
+        ArrSymRefPush(pArr, pSym);
+}
+
+/* whether `pSym` is a global the summaries track, marks the procedure impure for an array */
+static bool
+effGlobal(Effects* pe, const SymListNode* pSym)
+{
+    if (pe == nullptr || pSym->data.depth != 0 || pSym->data.type != TOK_VAR)
+        return false;
+
+    if (pSym->data.size > 0)
+        pe->bImpure = true;
+
+    return pSym->data.size == 0;
+}
+
+void
+effRead(const SymListNode* pSym)
+{
+    Effects* pe = effCurrent();
+
+    if (effGlobal(pe, pSym))
+        effAdd(&pe->aReads, pSym);
+}
+
+void
+effWrite(const SymListNode* pSym)
+{
+    Effects* pe = effCurrent();
+
+    if (!effGlobal(pe, pSym))
+        return;
+
+    effAdd(&pe->aWrites, pSym);
+    if (bEffAlways)
+        effAdd(&pe->aAlways, pSym);
+}
+
+/* I/O, which only running the procedure does */
+void
+effImpure(void)
+{
+    Effects* pe = effCurrent();
+
+    if (pe != nullptr)
+        pe->bImpure = true;
+}
+
+/* around the body of a loop, or the statement after "then" */
+void
+effEnter(bool bLoop)
+{
+    Effects* pe = effCurrent();
+
+    if (pe != nullptr && bLoop)
+        pe->bWork = true;
+    bEffAlways = false;
+}
+
+/* a call of `pCallee`, which does what it does to the globals */
+void
+effCall(const SymListNode* pCallee)
+{
+    Effects* pe = effCurrent();
+    const Effects* pc = pCallee->data.pEff;
+
+    if (pe == nullptr)
+        return;
+
+    pe->bWork = true;
+    if (pc == nullptr || !pc->bDone)
+        return;
+
+    pe->bImpure |= pc->bImpure;
+    for (size_t i = 0; i < pc->aReads.size; i++)
+        effAdd(&pe->aReads, pc->aReads.pData[i]);
+    for (size_t i = 0; i < pc->aWrites.size; i++)
+        effAdd(&pe->aWrites, pc->aWrites.pData[i]);
+    for (size_t i = 0; bEffAlways && i < pc->aAlways.size; i++)
+        effAdd(&pe->aAlways, pc->aAlways.pData[i]);
+}
+
+/*
+ * After the body of the procedure being compiled: its summary is complete,
+ * and it gets a cache if it is at the top level, does enough work, and its
+ * results depend on few parameters and globals, none of which a parameter
+ * hides from the function that looks them up, see cgMemo().  The globals
+ * it reads are inputs, and so are those it may leave as they were.
+ */
+void
+effEnd(void)
+{
+    Effects* pe = effCurrent();
+    const SymNode* pn;
+    const SymListNode* it;
+
+    if (pe == nullptr)
+        return;
+
+    pe->bDone = true;
+    pn = &pProcSym->data;
+    if (bInstrument || pn->depth != 0 || pe->bImpure || !pe->bWork || pe->aWrites.size > MEMO_OUTPUTS_MAX)
+        return;
+
+    for (size_t i = 0; i < pe->aReads.size; i++)
+        effAdd(&pe->aInputs, pe->aReads.pData[i]);
+    for (size_t i = 0; i < pe->aWrites.size; i++)
+        if (!effHas(&pe->aAlways, pe->aWrites.pData[i]))
+            effAdd(&pe->aInputs, pe->aWrites.pData[i]);
+    if (pn->nParams + pe->aInputs.size > MEMO_INPUTS_MAX)
+        return;
+
+    it = pProcSym->pNext;
+    for (int i = 0; i < pn->nParams; i++, it = it->pNext)
+    {
+        for (size_t j = 0; j < pe->aInputs.size; j++)
+            if (!strcmp(it->data.name, pe->aInputs.pData[j]->data.name))
+                return;
+        for (size_t j = 0; j < pe->aWrites.size; j++)
+            if (!strcmp(it->data.name, pe->aWrites.pData[j]->data.name))
+                return;
+    }
+
+    pProcSym->data.bMemo = true;
+    ++nMemoized;
+}
+
+/* for the next compilation on this thread */
+void
+depsReset(void)
+{
+    pForallVar = nullptr;
+    forallNested = 0;
+    aForallVars.size = 0;
+    pReduceRead = pReduceWrite = nullptr;
+    bForallAuto = false;
+    nMemoized = 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "pl0c.h"
+#include "adt/array.h"
+
+#include <limits.h>
+
+/*
+ * What the statements being parsed depend on: the checks that the
+ * iterations of a forall, or of a counted loop with --parallel, don't
+ * depend on each other, and the summaries of what procedures do to the
+ * globals, which --memoize caches results by.
+ */
+
+enum FORALL_USE
+{
+    FORALL_READ, /* a scalar the body only reads */
+    FORALL_PRIVATE, /* a scalar the body assigns, each iteration has its own */
+    FORALL_ARRAY,
+    FORALL_SUM, /* a scalar the body only adds to or subtracts from */
+    FORALL_MIN, /* a scalar the body only lowers to a value, with if value < min then min := value */
+    FORALL_MAX,
+};
+
+/* a variable the body of a forall uses, and how */
+typedef struct ForallVar
+{
+    const SymListNode* pSym;
+    int use; /* FORALL_USE, what the body did with it first */
+    int assignedAt; /* FORALL_PRIVATE: forallNested of the statement that assigned it, INT_MAX if none has yet */
+    bool bLoop; /* the variable of an inner forall around the current statement */
+    bool bWritten; /* FORALL_ARRAY: any element */
+    long offset; /* FORALL_ARRAY: of the first index from the loop variable, FORALL_NO_OFFSET if none yet */
+    size_t otherLine; /* FORALL_ARRAY: of the first index with another offset, 0 if none */
+} ForallVar;
+
+#define FORALL_NO_OFFSET LONG_MIN
+
+ARRAY_GEN_CODE(ArrForallVar, ForallVar);
+
+typedef const SymListNode* SymRef;
+ARRAY_GEN_CODE(ArrSymRef, SymRef);
+
+/*
+ * What a procedure does to the global scalars, with the procedures it
+ * calls: which it reads, which it assigns, and which of those it assigns
+ * in statements that always run, so their values before the call don't
+ * matter.  Locals, the frames of enclosing procedures included, don't
+ * count: a procedure at the top level can't see any but its own.
+ */
+typedef struct Effects
+{
+    ArrSymRef aReads;
+    ArrSymRef aWrites;
+    ArrSymRef aAlways;
+    ArrSymRef aInputs; /* once it's compiled, what its results depend on besides its parameters */
+    bool bImpure; /* I/O or a global array, which a cache can't replay */
+    bool bWork; /* a loop or a call, without which a lookup costs more than the body */
+    bool bDone; /* the procedure is compiled, calls in it still see it incomplete */
+} Effects;
+
+extern thread_local const SymListNode* pForallVar; /* of the outermost forall being compiled */
+extern thread_local ArrForallVar aForallVars;
+extern thread_local bool bEffAlways; /* the current statement of a procedure body always runs */
+extern thread_local bool bEffReturned; /* a return came before it */
+extern thread_local size_t nMemoized;
+
+void depsReset(void);
+
+void forallBegin(const SymListNode* pVar, bool bAuto);
+bool forallFinish(void);
+ForallVar* forallVar(const SymListNode* pSym, int use);
+void forallRead(const SymListNode* pSym);
+void forallWrite(const SymListNode* pSym);
+void forallReduce(const SymListNode* pSym, int use);
+bool forallSum(const SymListNode* pSym);
+int forallMinMax(const SymListNode** ppSym);
+void forallElement(const SymListNode* pSym, bool bWrite, long offset);
+long forallOffset(void);
+void forallForbid(const char* what);
+void forallEnter(void);
+void forallLeave(void);
+void forallEnd(const SymListNode* pVar);
+
+Effects* effCreate(void);
+void effFree(Effects* pe);
+void effRead(const SymListNode* pSym);
+void effWrite(const SymListNode* pSym);
+void effImpure(void);
+void effEnter(bool bLoop);
+void effCall(const SymListNode* pCallee);
+void effEnd(void);
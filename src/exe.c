@@ -0,0 +1,154 @@
+#include "exe.h"
+#include "jit.h"
+#include "logs.h"
+
+#include <elf.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXE_BASE 0x400000 /* where the headers and the code are loaded */
+#define EXE_PAGE 4096
+
+enum EXE_SECTION
+{
+    EXE_SEC_NULL,
+    EXE_SEC_TEXT,
+    EXE_SEC_BSS,
+    EXE_SEC_SHSTRTAB,
+    EXE_SEC_ENUM_SIZE
+};
+
+/* the names of the sections, at the offsets in aShNames */
+static const char aShStrtab[] = "\0.text\0.bss\0.shstrtab";
+static const uint32_t aShNames[EXE_SEC_ENUM_SIZE] = {0, 1, 7, 12};
+
+static size_t
+alignTo(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+size_t
+exeWrite(FILE* fp, const Pl0bModule* pMod)
+{
+    JitImage image;
+    Elf64_Ehdr eh;
+    Elf64_Phdr aPh[3];
+    Elf64_Shdr aSh[EXE_SEC_ENUM_SIZE];
+    size_t codeOff = alignTo(sizeof(eh) + sizeof(aPh), 16);
+    size_t strOff, shOff, size;
+    uint64_t dataAddr;
+    uint8_t* pBuf;
+
+    if (!jitImage(pMod, &image))
+        return 0;
+
+    /* the code reaches the data with 32-bit addresses */
+    dataAddr = alignTo(EXE_BASE + codeOff + image.size, EXE_PAGE);
+    if (dataAddr + image.dataSize > INT32_MAX)
+    {
+        free(image.pCode);
+        free(image.aRelocs);
+        return 0;
+    }
+
+    for (size_t i = 0; i < image.nRelocs; i++)
+    {
+        uint32_t v;
+
+        memcpy(&v, image.pCode + image.aRelocs[i], 4);
+        v += (uint32_t)dataAddr;
+        memcpy(image.pCode + image.aRelocs[i], &v, 4);
+    }
+
+    strOff = codeOff + image.size;
+    shOff = alignTo(strOff + sizeof(aShStrtab), 8);
+    size = shOff + sizeof(aSh);
+
+    eh = (Elf64_Ehdr){
+        .e_type = ET_EXEC,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_entry = EXE_BASE + codeOff + image.entry,
+        .e_phoff = sizeof(eh),
+        .e_shoff = shOff,
+        .e_ehsize = sizeof(eh),
+        .e_phentsize = sizeof(Elf64_Phdr),
+        .e_phnum = sizeof(aPh) / sizeof(aPh[0]),
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = EXE_SEC_ENUM_SIZE,
+        .e_shstrndx = EXE_SEC_SHSTRTAB,
+    };
+    memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS64;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_ident[EI_VERSION] = EV_CURRENT;
+    eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+
+    aPh[0] = (Elf64_Phdr){
+        .p_type = PT_LOAD,
+        .p_flags = PF_R | PF_X,
+        .p_offset = 0,
+        .p_vaddr = EXE_BASE,
+        .p_paddr = EXE_BASE,
+        .p_filesz = strOff,
+        .p_memsz = strOff,
+        .p_align = EXE_PAGE,
+    };
+    aPh[1] = (Elf64_Phdr){
+        .p_type = PT_LOAD,
+        .p_flags = PF_R | PF_W,
+        .p_offset = alignTo(size, EXE_PAGE),
+        .p_vaddr = dataAddr,
+        .p_paddr = dataAddr,
+        .p_filesz = 0,
+        .p_memsz = image.dataSize,
+        .p_align = EXE_PAGE,
+    };
+    aPh[2] = (Elf64_Phdr){.p_type = PT_GNU_STACK, .p_flags = PF_R | PF_W, .p_align = 16};
+
+    aSh[EXE_SEC_NULL] = (Elf64_Shdr){0};
+    aSh[EXE_SEC_TEXT] = (Elf64_Shdr){
+        .sh_name = aShNames[EXE_SEC_TEXT],
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+        .sh_addr = EXE_BASE + codeOff,
+        .sh_offset = codeOff,
+        .sh_size = image.size,
+        .sh_addralign = 16,
+    };
+    aSh[EXE_SEC_BSS] = (Elf64_Shdr){
+        .sh_name = aShNames[EXE_SEC_BSS],
+        .sh_type = SHT_NOBITS,
+        .sh_flags = SHF_ALLOC | SHF_WRITE,
+        .sh_addr = dataAddr,
+        .sh_offset = aPh[1].p_offset,
+        .sh_size = image.dataSize,
+        .sh_addralign = EXE_PAGE,
+    };
+    aSh[EXE_SEC_SHSTRTAB] = (Elf64_Shdr){
+        .sh_name = aShNames[EXE_SEC_SHSTRTAB],
+        .sh_type = SHT_STRTAB,
+        .sh_offset = strOff,
+        .sh_size = sizeof(aShStrtab),
+        .sh_addralign = 1,
+    };
+
+    /* zeroed, so that the padding is too */
+    if ((pBuf = calloc(1, size)) == nullptr)
+        LOG_FATAL("calloc failed");
+
+    memcpy(pBuf, &eh, sizeof(eh));
+    memcpy(pBuf + sizeof(eh), aPh, sizeof(aPh));
+    memcpy(pBuf + codeOff, image.pCode, image.size);
+    memcpy(pBuf + strOff, aShStrtab, sizeof(aShStrtab));
+    memcpy(pBuf + shOff, aSh, sizeof(aSh));
+
+    fwrite(pBuf, 1, size, fp);
+    free(pBuf);
+    free(image.pCode);
+    free(image.aRelocs);
+
+    return size;
+}
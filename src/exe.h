@@ -0,0 +1,15 @@
+#pragma once
+#include "pl0b.h"
+
+/*
+ * exe -- statically linked ELF64 executables for x86-64 Linux, as written by
+ * `pl0c -o`.
+ *
+ * The image is one read-only, executable segment with the headers and the
+ * code jitImage() makes of the module, and one zeroed, writable segment
+ * after it with the I/O buffers, the stacks and the globals.  Nothing else
+ * is loaded: the runtime in the code makes the system calls itself.
+ */
+
+/* writes `pMod` as an executable, returns its size, or 0 if it can't be made one */
+size_t exeWrite(FILE* fp, const Pl0bModule* pMod);
@@ -0,0 +1,540 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * pl0gen -- synthetic PL/0 program generator.
+ *
+ * Emits a valid PL/0 program to stdout, fully determined by the seed and the
+ * size parameters, so that benchmark inputs of any size can be reproduced.
+ * Every loop is counted, every division is by a non-zero literal, every
+ * array index is in bounds and every local is assigned on entry, so the
+ * generated programs also run to completion.
+ * Every fourth procedure is a leaf, the others only call leaves and the
+ * procedure nested in them, down to -x levels, and the main body calls
+ * anything, which keeps the dynamic call tree shallow.  Nested procedures
+ * work on the locals of the outermost one around them.
+ *
+ * With -r the output is restricted to the subset that ref understands
+ * (no arrays, no nesting), which allows comparing pl0c against ref on the
+ * same input.
+ */
+
+typedef struct Params
+{
+    unsigned long seed;
+    long nConsts;
+    long nVars;
+    long nArrays;
+    long nProcs;
+    long nLocals;
+    long nStmts;
+    long exprDepth;
+    long stmtDepth;
+    long procDepth;
+    bool bRefCompat;
+} Params;
+
+static Params p = {
+    .seed = 1,
+    .nConsts = 16,
+    .nVars = 16,
+    .nArrays = 4,
+    .nProcs = 16,
+    .nLocals = 4,
+    .nStmts = 16,
+    .exprDepth = 4,
+    .stmtDepth = 3,
+    .procDepth = 2,
+    .bRefCompat = false,
+};
+
+static unsigned long rngState;
+static unsigned long nTokens;
+static long nCallable; /* procedures callable from the current body */
+static long callStride;
+static long nestedProc, nestedLevel; /* p<proc>n<level> is callable too, if the level isn't 0 */
+static long nCurLocals;
+static long nLoop; /* loop counters in use by enclosing whiles */
+static int col;
+static bool bGlue; /* no space before the next token */
+
+/* xorshift64*: fast and stable across libc implementations */
+static unsigned long
+rnd(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+static long
+rndRange(long n)
+{
+    return n > 0 ? (long)(rnd() % (unsigned long)n) : 0;
+}
+
+static void
+out(const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    col += vfprintf(stdout, fmt, ap);
+    va_end(ap);
+}
+
+/* one token, with a line break once the line gets long */
+static void
+tok(const char* fmt, ...)
+{
+    va_list ap;
+
+    if (col > 72)
+    {
+        fputc('\n', stdout);
+        col = 0;
+        bGlue = true;
+    }
+
+    if (!bGlue && !strchr(";,[]", fmt[0]))
+        out(" ");
+
+    va_start(ap, fmt);
+    col += vfprintf(stdout, fmt, ap);
+    va_end(ap);
+
+    bGlue = fmt[0] == '[';
+    ++nTokens;
+}
+
+static void
+nl(int indent)
+{
+    fputc('\n', stdout);
+    col = 0;
+    for (int i = 0; i < indent; i++)
+        out("  ");
+    bGlue = true;
+}
+
+static void expression(int d);
+
+static void
+scalarRvalue(void)
+{
+    long n = p.nConsts + p.nVars + nCurLocals;
+    long r = rndRange(n);
+
+    if (r < p.nConsts)
+        tok("c%ld", r);
+    else if (r < p.nConsts + p.nVars)
+        tok("v%ld", r - p.nConsts);
+    else
+        tok("l%ld", r - p.nConsts - p.nVars);
+}
+
+static void
+arrayRef(void)
+{
+    long a = rndRange(p.nArrays);
+
+    tok("a%ld", a);
+    tok("[");
+    /* loop counters never exceed the array size, see loop() */
+    if (nLoop > 0 && rndRange(2))
+        tok("k%ld", rndRange(nLoop));
+    else
+        tok("%ld", rndRange(a + 1));
+    tok("]");
+}
+
+static void
+factor(int d)
+{
+    long r = rndRange(d > 0 ? 4 : 3);
+
+    if (r == 0)
+        tok("%ld", rndRange(1000));
+    else if (r == 1 && !p.bRefCompat && p.nArrays > 0)
+        arrayRef();
+    else if (r <= 2)
+        scalarRvalue();
+    else
+    {
+        tok("(");
+        expression(d - 1);
+        tok(")");
+    }
+}
+
+static void
+term(int d)
+{
+    factor(d);
+
+    for (long i = rndRange(3); i > 0; i--)
+    {
+        if (rndRange(3) == 0)
+        {
+            /* never divide by something that could be zero */
+            tok("/");
+            tok("%ld", rndRange(99) + 1);
+        }
+        else
+        {
+            tok("*");
+            factor(d);
+        }
+    }
+}
+
+static void
+expression(int d)
+{
+    if (rndRange(4) == 0)
+        tok(rndRange(2) ? "-" : "+");
+
+    term(d);
+
+    for (long i = rndRange(3); i > 0; i--)
+    {
+        tok(rndRange(2) ? "+" : "-");
+        term(d);
+    }
+}
+
+static void
+condition(void)
+{
+    static const char* ops[] = {"=", "#", "<", ">"};
+
+    if (rndRange(5) == 0)
+    {
+        tok("odd");
+        expression(p.exprDepth);
+    }
+    else
+    {
+        expression(p.exprDepth);
+        tok("%s", ops[rndRange(4)]);
+        expression(p.exprDepth);
+    }
+}
+
+static void
+lvalue(void)
+{
+    long n = p.nVars + nCurLocals;
+    long r = rndRange(n + (p.bRefCompat ? 0 : p.nArrays));
+
+    if (r < p.nVars)
+        tok("v%ld", r);
+    else if (r < n)
+        tok("l%ld", r - p.nVars);
+    else
+        arrayRef();
+}
+
+static void statement(int d, int indent);
+
+static void
+loop(int d, int indent)
+{
+    /*
+     * Loop counters are dedicated variables that no other statement assigns
+     * and procedures shadow with locals, so calls can't clobber them.  The
+     * bound never exceeds 2, the smallest array size, so they can index any
+     * array.  The loop is one statement, also where it is what "if" runs.
+     */
+    long k = nLoop++;
+
+    tok("begin");
+    nl(++indent);
+    tok("k%ld", k);
+    tok(":=");
+    tok("0");
+    tok(";");
+    nl(indent);
+    tok("while");
+    tok("k%ld", k);
+    tok("<");
+    tok("%ld", rndRange(2) + 1);
+    tok("do");
+    nl(indent);
+    tok("begin");
+    nl(indent + 1);
+    statement(d - 1, indent + 1);
+    tok(";");
+    nl(indent + 1);
+    tok("k%ld", k);
+    tok(":=");
+    tok("k%ld", k);
+    tok("+");
+    tok("1");
+    nl(indent);
+    tok("end");
+    nl(--indent);
+    tok("end");
+
+    --nLoop;
+}
+
+static void
+statement(int d, int indent)
+{
+    long r = rndRange(d > 0 ? 6 : 3);
+
+    switch (r)
+    {
+        case 0:
+        case 1:
+            lvalue();
+            tok(":=");
+            expression(p.exprDepth);
+            break;
+
+        case 2:
+            if (nestedLevel > 0 && (nCallable == 0 || rndRange(2)))
+            {
+                tok("call");
+                tok("p%ldn%ld", nestedProc, nestedLevel);
+            }
+            else if (nCallable > 0)
+            {
+                tok("call");
+                tok("p%ld", rndRange(nCallable) * callStride);
+            }
+            else
+            {
+                tok("writeInt");
+                tok("%ld", rndRange(100));
+            }
+            break;
+
+        case 3:
+            tok("if");
+            condition();
+            tok("then");
+            nl(indent + 1);
+            statement(d - 1, indent + 1);
+            break;
+
+        case 4:
+            if (nLoop < p.stmtDepth)
+            {
+                loop(d, indent);
+                break;
+            }
+            [[fallthrough]];
+
+        default:
+            tok("begin");
+            for (long i = rndRange(4) + 1; i > 0; i--)
+            {
+                nl(indent + 1);
+                statement(d - 1, indent + 1);
+                if (i > 1)
+                    tok(";");
+            }
+            nl(indent);
+            tok("end");
+            break;
+    }
+}
+
+/* the statements of a block, after assigning its first `nLocals` locals */
+static void
+body(int indent, long nLocals)
+{
+    tok("begin");
+    for (long i = 0; i < nLocals; i++)
+    {
+        nl(indent + 1);
+        tok("l%ld", i);
+        tok(":=");
+        tok("%ld", rndRange(1000));
+        tok(";");
+    }
+    for (long i = 0; i < p.nStmts; i++)
+    {
+        nl(indent + 1);
+        statement(p.stmtDepth, indent + 1);
+        if (i + 1 < p.nStmts)
+            tok(";");
+    }
+    nl(indent);
+    tok("end");
+}
+
+static void
+declarations(void)
+{
+    if (p.nConsts > 0)
+    {
+        tok("const");
+        for (long i = 0; i < p.nConsts; i++)
+        {
+            tok("c%ld", i);
+            tok("=");
+            tok("%ld", rndRange(100000));
+            tok(i + 1 < p.nConsts ? "," : ";");
+        }
+        nl(0);
+    }
+
+    tok("var");
+    for (long i = 0; i < p.nVars; i++)
+    {
+        tok("v%ld", i);
+        tok(",");
+    }
+    if (!p.bRefCompat)
+    {
+        for (long i = 0; i < p.nArrays; i++)
+        {
+            tok("a%ld", i);
+            tok("size");
+            tok("%ld", i + 2);
+            tok(",");
+        }
+    }
+    for (long i = 0; i < p.stmtDepth; i++)
+    {
+        tok("k%ld", i);
+        tok(i + 1 < p.stmtDepth ? "," : ";");
+    }
+    nl(0);
+}
+
+/*
+ * Procedure `i` at nesting `level`, 1 outside any other, and the procedure
+ * nested in it.  Only the outermost one has locals besides its own loop
+ * counters, the ones in it use those through the display.
+ */
+static void
+procedure(long i, long level)
+{
+    bool bNested = i % 4 != 0 && level < p.procDepth;
+
+    nl(0);
+    tok("procedure");
+    tok(level == 1 ? "p%ld" : "p%ldn%ld", i, level);
+    tok(";");
+    nl(0);
+
+    if (level == 1)
+        nCurLocals = p.nLocals;
+    tok("var");
+    for (long j = 0; j < (level == 1 ? nCurLocals : 0); j++)
+    {
+        tok("l%ld", j);
+        tok(",");
+    }
+    for (long j = 0; j < p.stmtDepth; j++)
+    {
+        tok("k%ld", j);
+        tok(j + 1 < p.stmtDepth ? "," : ";");
+    }
+    nl(0);
+
+    if (bNested)
+        procedure(i, level + 1);
+
+    /* leaves call nothing, the rest call earlier leaves, nested ones only the one in them */
+    nCallable = level > 1 || i % 4 == 0 ? 0 : (i - 1) / 4 + 1;
+    callStride = 4;
+    nestedProc = i;
+    nestedLevel = bNested ? level + 1 : 0;
+    body(0, level == 1 ? nCurLocals : 0);
+    tok(";");
+    nl(0);
+}
+
+static void
+procedures(void)
+{
+    for (long i = 0; i < p.nProcs; i++)
+        procedure(i, 1);
+
+    nCurLocals = 0;
+    nCallable = p.nProcs;
+    callStride = 1;
+    nestedLevel = 0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: pl0gen [-r] [-s seed] [-c consts] [-v vars] [-a arrays] [-p procs]\n"
+                    "              [-l locals] [-n stmts] [-e exprdepth] [-d stmtdepth]\n"
+                    "              [-x procdepth] [-t]\n");
+    exit(1);
+}
+
+static long
+numArg(const char* s)
+{
+    char* end;
+    long n = strtol(s, &end, 10);
+
+    if (*s == '\0' || *end != '\0' || n < 0)
+        usage();
+
+    return n;
+}
+
+int
+main(int argc, char* argv[])
+{
+    int ch;
+    bool bTokens = false;
+
+    while ((ch = getopt(argc, argv, "rs:c:v:a:p:l:n:e:d:x:t")) != -1)
+    {
+        switch (ch)
+        {
+            case 'r': p.bRefCompat = true; break;
+            case 's': p.seed = numArg(optarg); break;
+            case 'c': p.nConsts = numArg(optarg); break;
+            case 'v': p.nVars = numArg(optarg); break;
+            case 'a': p.nArrays = numArg(optarg); break;
+            case 'p': p.nProcs = numArg(optarg); break;
+            case 'l': p.nLocals = numArg(optarg); break;
+            case 'n': p.nStmts = numArg(optarg); break;
+            case 'e': p.exprDepth = numArg(optarg); break;
+            case 'd': p.stmtDepth = numArg(optarg); break;
+            case 'x': p.procDepth = numArg(optarg); break;
+            case 't': bTokens = true; break;
+            default: usage();
+        }
+    }
+
+    if (optind != argc || p.nStmts < 1 || p.stmtDepth < 1 || p.procDepth < 1)
+        usage();
+    if (p.bRefCompat)
+        p.procDepth = 1;
+
+    /* keep the state non-zero for xorshift */
+    rngState = p.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    out("{ pl0gen -s %lu -c %ld -v %ld -a %ld -p %ld -l %ld -n %ld -e %ld -d %ld -x %ld%s }", p.seed,
+        p.nConsts, p.nVars, p.nArrays, p.nProcs, p.nLocals, p.nStmts, p.exprDepth, p.stmtDepth, p.procDepth,
+        p.bRefCompat ? " -r" : "");
+    nl(0);
+
+    declarations();
+    procedures();
+    nl(0);
+    body(0, 0);
+    tok(".");
+    nl(0);
+
+    if (bTokens)
+        fprintf(stderr, "%lu\n", nTokens);
+
+    return 0;
+}
@@ -0,0 +1,1158 @@
+#include "jit.h"
+#include "logs.h"
+#include "vm.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* the output buffers are the interpreter's */
+#include "pl0rt.h"
+
+typedef uint32_t JitEntry(long** psp, long* aLocals, long* aGlobals, const uint8_t* pTarget);
+
+typedef struct JitProc
+{
+    uint8_t* pCode; /* entry stub, exit stub, then the procedure */
+    size_t size;
+    uint32_t* aOffsets; /* of each instruction's code, by pc - entry */
+    bool bTried;
+} JitProc;
+
+struct Jit
+{
+    const Pl0bModule* pMod;
+    JitProc* aProcs;
+    size_t nCompiled, nEntries;
+};
+
+Jit*
+jitCreate(const Pl0bModule* pMod)
+{
+    Jit* self = calloc(1, sizeof(*self));
+
+    if (self == nullptr || (self->aProcs = calloc(pMod->nProcs, sizeof(JitProc))) == nullptr)
+        LOG_FATAL("malloc failed");
+    self->pMod = pMod;
+
+    return self;
+}
+
+void
+jitDestroy(Jit* self)
+{
+    for (size_t i = 0; i < self->pMod->nProcs; i++)
+    {
+        if (self->aProcs[i].pCode != nullptr)
+            munmap(self->aProcs[i].pCode, self->aProcs[i].size);
+        free(self->aProcs[i].aOffsets);
+    }
+    free(self->aProcs);
+    free(self);
+}
+
+bool
+jitReady(const Jit* self, uint32_t proc)
+{
+    return self->aProcs[proc].pCode != nullptr;
+}
+
+size_t
+jitCompiled(const Jit* self)
+{
+    return self->nCompiled;
+}
+
+size_t
+jitEntries(const Jit* self)
+{
+    return self->nEntries;
+}
+
+uint32_t
+jitRun(Jit* self, uint32_t proc, uint32_t pc, long** psp, long* aLocals, long* aGlobals)
+{
+    const JitProc* pj = &self->aProcs[proc];
+    JitEntry* fn = (JitEntry*)(void*)pj->pCode;
+
+    self->nEntries++;
+
+    return fn(psp, aLocals, aGlobals, pj->pCode + pj->aOffsets[pc - self->pMod->aProcs[proc].entry]);
+}
+
+#if defined(__x86_64__)
+
+/*
+ * Register use in the generated code: rbx is the operand stack pointer (the
+ * top is at [rbx - 8]), r12 the frame's locals, r13 the globals and r14
+ * where rbx is stored on the way out.  eax holds the pc being returned.
+ *
+ * An executable has no interpreter to leave to: calls and returns use the
+ * machine stack, which holds the caller's r12 under the return address, r15
+ * counts the calls that may still be made, and failures go to the runtime.
+ */
+
+#define JIT_MAX_TEMPLATE 64 /* bytes of code for one instruction, at most */
+#define JIT_STUBS 64
+
+typedef struct Emitter
+{
+    uint8_t* p;
+    uint8_t* pStart;
+    size_t exit; /* offset of the exit stub */
+    const Pl0bModule* pImage; /* the module of an executable being written, or nullptr */
+    uint32_t* aRelocs; /* of an executable: offsets of the data offsets */
+    size_t nRelocs;
+} Emitter;
+
+typedef struct Fixup
+{
+    uint32_t at; /* of a rel32 */
+    uint32_t pc; /* it jumps to */
+} Fixup;
+
+#define EMIT(e, ...) emitBytes(e, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void
+emitBytes(Emitter* e, const uint8_t* p, size_t n)
+{
+    memcpy(e->p, p, n);
+    e->p += n;
+}
+
+static void
+emit32(Emitter* e, uint32_t v)
+{
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void
+emit64(Emitter* e, uint64_t v)
+{
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+static size_t
+emitOffset(const Emitter* e)
+{
+    return e->p - e->pStart;
+}
+
+/*
+ * The runtime of an executable, which starts its image: the read and write
+ * built-ins and the failures, as in pl0rt.h and vmError() but over raw
+ * system calls, then aRuntimeText.  OUTPOS to INB in the listing are the
+ * JIT_DATA_* offsets; jitImage() relocates them at aRuntimeRelocs.
+ */
+
+#define JIT_DATA_OUTPOS 0
+#define JIT_DATA_INPOS 8
+#define JIT_DATA_INEND 16
+#define JIT_DATA_OUT 64 /* BUF bytes */
+#define JIT_DATA_IN (JIT_DATA_OUT + PL0RT_BUF_SIZE)
+#define JIT_DATA_CALLS (JIT_DATA_IN + PL0RT_BUF_SIZE) /* the machine stack, down from JIT_DATA_STACK */
+#define JIT_DATA_STACK (JIT_DATA_CALLS + VM_MAX_CALLS * 16 + 4096) /* locals and operands, as in the interpreter */
+#define JIT_DATA_GLOBALS (JIT_DATA_STACK + VM_STACK_SLOTS * 8)
+
+static_assert(PL0RT_BUF_SIZE == 1 << 16, "BUF in aRuntime");
+
+enum JIT_RT
+{
+    JIT_RT_FLUSHFD = 0x005, /* edi: the file descriptor the output buffer goes to */
+    JIT_RT_WRITECHAR = 0x058, /* rdi */
+    JIT_RT_WRITEINT = 0x085, /* rdi */
+    JIT_RT_WRITESTR = 0x0E1, /* rsi: the elements, rdx: how many at most */
+    JIT_RT_READCHAR = 0x15A, /* rax */
+    JIT_RT_READINT = 0x163, /* rax */
+    JIT_RT_FAIL = 0x252, /* edi: the line, rsi and ecx: the message */
+    JIT_RT_FAILINDEX = 0x28B, /* edi: the line, rax: the index, rdx: the size */
+    JIT_RT_EXIT = 0x2F8, /* edi: the status */
+    JIT_RT_TEXT = 0x306,
+    JIT_RT_DIV = JIT_RT_TEXT + 56, /* "division by zero" */
+    JIT_RT_OVERFLOW = JIT_RT_TEXT + 72 /* "stack overflow" */
+};
+
+static const uint8_t aRuntime[] = {
+    /* flush: the output buffer to stdout */
+    0xBF, 0x01, 0x00, 0x00, 0x00, /* mov edi, 1 */
+    /* flushfd: to edi */
+    0xBE, 0x40, 0x00, 0x00, 0x00, /* mov esi, OUTB */
+    0x48, 0x8B, 0x14, 0x25, 0x00, 0x00, 0x00, 0x00, /* mov rdx, [OUTPOS] */
+    /* flushfd.1: */
+    0x48, 0x85, 0xD2, /* test rdx, rdx */
+    0x74, 0x1A, /* jz flushfd.2 */
+    0xB8, 0x01, 0x00, 0x00, 0x00, /* mov eax, 1 */
+    0x0F, 0x05, /* syscall */
+    0x48, 0x83, 0xF8, 0xFC, /* cmp rax, -4 */
+    0x74, 0xEE, /* je flushfd.1 */
+    0x48, 0x85, 0xC0, /* test rax, rax */
+    0x7E, 0x08, /* jle flushfd.2 */
+    0x48, 0x01, 0xC6, /* add rsi, rax */
+    0x48, 0x29, 0xC2, /* sub rdx, rax */
+    0xEB, 0xE1, /* jmp flushfd.1 */
+    /* flushfd.2: */
+    0x48, 0xC7, 0x04, 0x25, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* mov qword ptr [OUTPOS], 0 */
+    0xC3, /* ret */
+    /* append: rcx bytes from rsi to the output buffer, which has room for them */
+    0x48, 0x8B, 0x3C, 0x25, 0x00, 0x00, 0x00, 0x00, /* mov rdi, [OUTPOS] */
+    0x48, 0x01, 0x0C, 0x25, 0x00, 0x00, 0x00, 0x00, /* add [OUTPOS], rcx */
+    0x48, 0x81, 0xC7, 0x40, 0x00, 0x00, 0x00, /* add rdi, OUTB */
+    0xF3, 0xA4, /* rep movsb */
+    0xC3, /* ret */
+    /* writechar: */
+    0x48, 0x8B, 0x14, 0x25, 0x00, 0x00, 0x00, 0x00, /* mov rdx, [OUTPOS] */
+    0x48, 0x81, 0xFA, 0x00, 0x00, 0x01, 0x00, /* cmp rdx, BUF */
+    0x75, 0x09, /* jne writechar.1 */
+    0x57, /* push rdi */
+    0xE8, 0x91, 0xFF, 0xFF, 0xFF, /* call flush */
+    0x5F, /* pop rdi */
+    0x31, 0xD2, /* xor edx, edx */
+    /* writechar.1: */
+    0x40, 0x88, 0xBA, 0x40, 0x00, 0x00, 0x00, /* mov [OUTB + rdx], dil */
+    0x48, 0xFF, 0xC2, /* inc rdx */
+    0x48, 0x89, 0x14, 0x25, 0x00, 0x00, 0x00, 0x00, /* mov [OUTPOS], rdx */
+    0xC3, /* ret */
+    /* writeint: */
+    0x48, 0x81, 0x3C, 0x25, 0x00, 0x00, 0x00, 0x00, 0xE8, 0xFF, 0x00, 0x00, /* cmp qword ptr [OUTPOS], BUF - 24 */
+    0x76, 0x07, /* jbe writeint.1 */
+    0x57, /* push rdi */
+    0xE8, 0x67, 0xFF, 0xFF, 0xFF, /* call flush */
+    0x5F, /* pop rdi */
+    /* writeint.1: */
+    0x48, 0x83, 0xEC, 0x18, /* sub rsp, 24 */
+    0x48, 0x8D, 0x74, 0x24, 0x18, /* lea rsi, [rsp + 24] */
+    0x48, 0x89, 0xF8, /* mov rax, rdi */
+    0x48, 0xF7, 0xD8, /* neg rax */
+    0x48, 0x0F, 0x48, 0xC7, /* cmovs rax, rdi */
+    0xB9, 0x0A, 0x00, 0x00, 0x00, /* mov ecx, 10 */
+    /* writeint.2: */
+    0x31, 0xD2, /* xor edx, edx */
+    0x48, 0xF7, 0xF1, /* div rcx */
+    0x80, 0xC2, 0x30, /* add dl, 0x30 */
+    0x48, 0xFF, 0xCE, /* dec rsi */
+    0x88, 0x16, /* mov [rsi], dl */
+    0x48, 0x85, 0xC0, /* test rax, rax */
+    0x75, 0xEE, /* jnz writeint.2 */
+    0x48, 0x85, 0xFF, /* test rdi, rdi */
+    0x79, 0x06, /* jns writeint.3 */
+    0x48, 0xFF, 0xCE, /* dec rsi */
+    0xC6, 0x06, 0x2D, /* mov byte ptr [rsi], 0x2d */
+    /* writeint.3: */
+    0x48, 0x8D, 0x4C, 0x24, 0x18, /* lea rcx, [rsp + 24] */
+    0x48, 0x29, 0xF1, /* sub rcx, rsi */
+    0xE8, 0x62, 0xFF, 0xFF, 0xFF, /* call append */
+    0x48, 0x83, 0xC4, 0x18, /* add rsp, 24 */
+    0xC3, /* ret */
+    /* writestr: */
+    0x49, 0x89, 0xF0, /* mov r8, rsi */
+    0x49, 0x89, 0xD1, /* mov r9, rdx */
+    /* writestr.1: */
+    0x4D, 0x85, 0xC9, /* test r9, r9 */
+    0x74, 0x16, /* jz writestr.2 */
+    0x49, 0x8B, 0x38, /* mov rdi, [r8] */
+    0x48, 0x85, 0xFF, /* test rdi, rdi */
+    0x74, 0x0E, /* jz writestr.2 */
+    0xE8, 0x5F, 0xFF, 0xFF, 0xFF, /* call writechar */
+    0x49, 0x83, 0xC0, 0x08, /* add r8, 8 */
+    0x49, 0xFF, 0xC9, /* dec r9 */
+    0xEB, 0xE5, /* jmp writestr.1 */
+    /* writestr.2: */
+    0xC3, /* ret */
+    /* getc: the next input byte in eax, or -1 at the end; the output goes out first */
+    0x48, 0x8B, 0x04, 0x25, 0x08, 0x00, 0x00, 0x00, /* mov rax, [INPOS] */
+    0x48, 0x3B, 0x04, 0x25, 0x10, 0x00, 0x00, 0x00, /* cmp rax, [INEND] */
+    0x75, 0x2A, /* jne getc.2 */
+    0xE8, 0xE6, 0xFE, 0xFF, 0xFF, /* call flush */
+    /* getc.1: */
+    0x31, 0xC0, /* xor eax, eax */
+    0x31, 0xFF, /* xor edi, edi */
+    0xBE, 0x40, 0x00, 0x01, 0x00, /* mov esi, INB */
+    0xBA, 0x00, 0x00, 0x01, 0x00, /* mov edx, BUF */
+    0x0F, 0x05, /* syscall */
+    0x48, 0x83, 0xF8, 0xFC, /* cmp rax, -4 */
+    0x74, 0xEA, /* je getc.1 */
+    0x48, 0x85, 0xC0, /* test rax, rax */
+    0x7E, 0x1F, /* jle getc.3 */
+    0x48, 0x89, 0x04, 0x25, 0x10, 0x00, 0x00, 0x00, /* mov [INEND], rax */
+    0x31, 0xC0, /* xor eax, eax */
+    /* getc.2: */
+    0x0F, 0xB6, 0x88, 0x40, 0x00, 0x01, 0x00, /* movzx ecx, byte ptr [INB + rax] */
+    0x48, 0xFF, 0xC0, /* inc rax */
+    0x48, 0x89, 0x04, 0x25, 0x08, 0x00, 0x00, 0x00, /* mov [INPOS], rax */
+    0x89, 0xC8, /* mov eax, ecx */
+    0xC3, /* ret */
+    /* getc.3: */
+    0xB8, 0xFF, 0xFF, 0xFF, 0xFF, /* mov eax, -1 */
+    0xC3, /* ret */
+    /* readchar: */
+    0xE8, 0xA4, 0xFF, 0xFF, 0xFF, /* call getc */
+    0x0F, 0xB6, 0xC0, /* movzx eax, al */
+    0xC3, /* ret */
+    /* readint: r8 bytes of the line kept at rsp, r9 the value, r10 its limit, r14d 1 if negative, 2 with digits, 4 if bad */
+    0x48, 0x83, 0xEC, 0x20, /* sub rsp, 32 */
+    0x45, 0x31, 0xC0, /* xor r8d, r8d */
+    0x45, 0x31, 0xC9, /* xor r9d, r9d */
+    0x49, 0xBA, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F, /* mov r10, 0x7fffffffffffffff */
+    0x45, 0x31, 0xF6, /* xor r14d, r14d */
+    /* readint.1: */
+    0xE8, 0x84, 0xFF, 0xFF, 0xFF, /* call getc */
+    0x83, 0xF8, 0x20, /* cmp eax, 32 */
+    0x74, 0x0D, /* je readint.2 */
+    0x83, 0xF8, 0x09, /* cmp eax, 9 */
+    0x74, 0x08, /* je readint.2 */
+    0x8D, 0x48, 0xF5, /* lea ecx, [rax - 11] */
+    0x83, 0xF9, 0x02, /* cmp ecx, 2 */
+    0x77, 0x0F, /* ja readint.3 */
+    /* readint.2: */
+    0x49, 0x83, 0xF8, 0x1B, /* cmp r8, 27 */
+    0x73, 0xE3, /* jae readint.1 */
+    0x42, 0x88, 0x04, 0x04, /* mov [rsp + r8], al */
+    0x49, 0xFF, 0xC0, /* inc r8 */
+    0xEB, 0xDA, /* jmp readint.1 */
+    /* readint.3: */
+    0x83, 0xF8, 0x2B, /* cmp eax, 0x2b */
+    0x74, 0x0C, /* je readint.4 */
+    0x83, 0xF8, 0x2D, /* cmp eax, 0x2d */
+    0x75, 0x19, /* jne readint.6 */
+    0x41, 0x83, 0xCE, 0x01, /* or r14d, 1 */
+    0x49, 0xFF, 0xC2, /* inc r10 */
+    /* readint.4: */
+    0x49, 0x83, 0xF8, 0x1B, /* cmp r8, 27 */
+    0x73, 0x07, /* jae readint.5 */
+    0x42, 0x88, 0x04, 0x04, /* mov [rsp + r8], al */
+    0x49, 0xFF, 0xC0, /* inc r8 */
+    /* readint.5: */
+    0xE8, 0x40, 0xFF, 0xFF, 0xFF, /* call getc */
+    /* readint.6: */
+    0x83, 0xF8, 0xFF, /* cmp eax, -1 */
+    0x74, 0x45, /* je readint.9 */
+    0x83, 0xF8, 0x0A, /* cmp eax, 10 */
+    0x74, 0x40, /* je readint.9 */
+    0x49, 0x83, 0xF8, 0x1B, /* cmp r8, 27 */
+    0x73, 0x07, /* jae readint.7 */
+    0x42, 0x88, 0x04, 0x04, /* mov [rsp + r8], al */
+    0x49, 0xFF, 0xC0, /* inc r8 */
+    /* readint.7: */
+    0x41, 0x83, 0xCE, 0x02, /* or r14d, 2 */
+    0x83, 0xE8, 0x30, /* sub eax, 0x30 */
+    0x83, 0xF8, 0x09, /* cmp eax, 9 */
+    0x77, 0x21, /* ja readint.8 */
+    0x89, 0xC1, /* mov ecx, eax */
+    0x4C, 0x89, 0xD0, /* mov rax, r10 */
+    0x48, 0x29, 0xC8, /* sub rax, rcx */
+    0x31, 0xD2, /* xor edx, edx */
+    0x41, 0xBB, 0x0A, 0x00, 0x00, 0x00, /* mov r11d, 10 */
+    0x49, 0xF7, 0xF3, /* div r11 */
+    0x49, 0x39, 0xC1, /* cmp r9, rax */
+    0x77, 0x09, /* ja readint.8 */
+    0x4D, 0x6B, 0xC9, 0x0A, /* imul r9, r9, 10 */
+    0x49, 0x01, 0xC9, /* add r9, rcx */
+    0xEB, 0xB7, /* jmp readint.5 */
+    /* readint.8: */
+    0x41, 0x83, 0xCE, 0x04, /* or r14d, 4 */
+    0xEB, 0xB1, /* jmp readint.5 */
+    /* readint.9: */
+    0x41, 0x83, 0xFE, 0x02, /* cmp r14d, 2 */
+    0x75, 0x08, /* jne readint.10 */
+    0x4C, 0x89, 0xC8, /* mov rax, r9 */
+    0x48, 0x83, 0xC4, 0x20, /* add rsp, 32 */
+    0xC3, /* ret */
+    /* readint.10: */
+    0x41, 0x83, 0xFE, 0x03, /* cmp r14d, 3 */
+    0x75, 0x0B, /* jne readint.11 */
+    0x4C, 0x89, 0xC8, /* mov rax, r9 */
+    0x48, 0xF7, 0xD8, /* neg rax */
+    0x48, 0x83, 0xC4, 0x20, /* add rsp, 32 */
+    0xC3, /* ret */
+    /* readint.11: */
+    0xE8, 0xCF, 0xFD, 0xFF, 0xFF, /* call flush */
+    0x48, 0x8D, 0x35, 0xCE, 0x00, 0x00, 0x00, /* lea rsi, [rip + msginvalid] */
+    0xB9, 0x10, 0x00, 0x00, 0x00, /* mov ecx, 16 */
+    0xE8, 0xFC, 0xFD, 0xFF, 0xFF, /* call append */
+    0x48, 0x89, 0xE6, /* mov rsi, rsp */
+    0x4C, 0x89, 0xC1, /* mov rcx, r8 */
+    0xE8, 0xF1, 0xFD, 0xFF, 0xFF, /* call append */
+    0xE9, 0x86, 0x00, 0x00, 0x00, /* jmp failend */
+    /* fail: */
+    0x56, /* push rsi */
+    0x51, /* push rcx */
+    0x57, /* push rdi */
+    0xE8, 0xA6, 0xFD, 0xFF, 0xFF, /* call flush */
+    0x48, 0x8D, 0x35, 0xB5, 0x00, 0x00, 0x00, /* lea rsi, [rip + msgline] */
+    0xB9, 0x05, 0x00, 0x00, 0x00, /* mov ecx, 5 */
+    0xE8, 0xD3, 0xFD, 0xFF, 0xFF, /* call append */
+    0x5F, /* pop rdi */
+    0xE8, 0x14, 0xFE, 0xFF, 0xFF, /* call writeint */
+    0x48, 0x8D, 0x35, 0xA3, 0x00, 0x00, 0x00, /* lea rsi, [rip + msgcolon] */
+    0xB9, 0x02, 0x00, 0x00, 0x00, /* mov ecx, 2 */
+    0xE8, 0xBC, 0xFD, 0xFF, 0xFF, /* call append */
+    0x59, /* pop rcx */
+    0x5E, /* pop rsi */
+    0xE8, 0xB5, 0xFD, 0xFF, 0xFF, /* call append */
+    0xEB, 0x4D, /* jmp failend */
+    /* failindex: */
+    0x52, /* push rdx */
+    0x50, /* push rax */
+    0x57, /* push rdi */
+    0xE8, 0x6D, 0xFD, 0xFF, 0xFF, /* call flush */
+    0x48, 0x8D, 0x35, 0x7C, 0x00, 0x00, 0x00, /* lea rsi, [rip + msgline] */
+    0xB9, 0x05, 0x00, 0x00, 0x00, /* mov ecx, 5 */
+    0xE8, 0x9A, 0xFD, 0xFF, 0xFF, /* call append */
+    0x5F, /* pop rdi */
+    0xE8, 0xDB, 0xFD, 0xFF, 0xFF, /* call writeint */
+    0x48, 0x8D, 0x35, 0x6C, 0x00, 0x00, 0x00, /* lea rsi, [rip + msgindex] */
+    0xB9, 0x08, 0x00, 0x00, 0x00, /* mov ecx, 8 */
+    0xE8, 0x83, 0xFD, 0xFF, 0xFF, /* call append */
+    0x5F, /* pop rdi */
+    0xE8, 0xC4, 0xFD, 0xFF, 0xFF, /* call writeint */
+    0x48, 0x8D, 0x35, 0x5D, 0x00, 0x00, 0x00, /* lea rsi, [rip + msgbounds] */
+    0xB9, 0x18, 0x00, 0x00, 0x00, /* mov ecx, 24 */
+    0xE8, 0x6C, 0xFD, 0xFF, 0xFF, /* call append */
+    0x5F, /* pop rdi */
+    0xE8, 0xAD, 0xFD, 0xFF, 0xFF, /* call writeint */
+    /* failend: the end of the message, which goes to stderr, then exit 1 */
+    0x48, 0x8D, 0x35, 0x5E, 0x00, 0x00, 0x00, /* lea rsi, [rip + msgnl] */
+    0xB9, 0x01, 0x00, 0x00, 0x00, /* mov ecx, 1 */
+    0xE8, 0x55, 0xFD, 0xFF, 0xFF, /* call append */
+    0xBF, 0x02, 0x00, 0x00, 0x00, /* mov edi, 2 */
+    0xE8, 0x12, 0xFD, 0xFF, 0xFF, /* call flushfd */
+    0xBF, 0x01, 0x00, 0x00, 0x00, /* mov edi, 1 */
+    /* exit: */
+    0x57, /* push rdi */
+    0xE8, 0x02, 0xFD, 0xFF, 0xFF, /* call flush */
+    0x5F, /* pop rdi */
+    0xB8, 0xE7, 0x00, 0x00, 0x00, /* mov eax, 231 */
+    0x0F, 0x05, /* syscall */
+};
+
+static const char aRuntimeText[] = "invalid number: "
+                                   "line "
+                                   ": "
+                                   ": index "
+                                   " out of bounds for size "
+                                   "\n"
+                                   "division by zero"
+                                   "stack overflow";
+
+static const uint16_t aRuntimeRelocs[] = {
+    0x006, 0x00E, 0x035, 0x042, 0x04A, 0x051, 0x05C, 0x075, 0x080, 0x089, 0x107, 0x10F, 0x11F, 0x139, 0x142, 0x14D
+};
+
+static_assert(sizeof(aRuntime) == JIT_RT_TEXT, "aRuntimeText follows aRuntime");
+
+/* mov edi, the line of `pc`; lea rsi, message; mov ecx, its length; jmp fail */
+static void
+emitFail(Emitter* e, uint32_t pc, uint32_t msg, uint32_t len)
+{
+    EMIT(e, 0xBF);
+    emit32(e, pl0bLine(e->pImage, pc));
+    EMIT(e, 0x48, 0x8D, 0x35);
+    emit32(e, (uint32_t)(msg - (emitOffset(e) + 4)));
+    EMIT(e, 0xB9);
+    emit32(e, len);
+    EMIT(e, 0xE9);
+    emit32(e, (uint32_t)(JIT_RT_FAIL - (emitOffset(e) + 4)));
+}
+
+/* the 32 bits of a data offset, which the address of the data is added to */
+static void
+emitData(Emitter* e, uint32_t offset)
+{
+    e->aRelocs[e->nRelocs++] = (uint32_t)emitOffset(e);
+    emit32(e, offset);
+}
+
+/* leaves for the interpreter at `pc` unless the flags say condition `cc` (its jcc rel8 opcode) */
+static void
+emitExitUnless(Emitter* e, uint8_t cc, uint32_t pc)
+{
+    /* an executable fails instead, with the index in rax */
+    if (e->pImage != nullptr)
+    {
+        const Pl0bInstr* pi = &e->pImage->aCode[pc];
+
+        if (pi->op == PL0B_DIV)
+        {
+            EMIT(e, cc, 22);
+            emitFail(e, pc, JIT_RT_DIV, 16);
+        }
+        else
+        {
+            EMIT(e, cc, 15);
+            EMIT(e, 0xBF); /* mov edi, line */
+            emit32(e, pl0bLine(e->pImage, pc));
+            EMIT(e, 0xBA); /* mov edx, size */
+            emit32(e, (uint32_t)e->pImage->aSymbols[pi->arg].value);
+            EMIT(e, 0xE9); /* jmp failindex */
+            emit32(e, (uint32_t)(JIT_RT_FAILINDEX - (emitOffset(e) + 4)));
+        }
+        return;
+    }
+
+    EMIT(e, cc, 10);
+    EMIT(e, 0xB8); /* mov eax, pc */
+    emit32(e, pc);
+    EMIT(e, 0xE9); /* jmp exit */
+    emit32(e, (uint32_t)(e->exit - (emitOffset(e) + 4)));
+}
+
+static void
+emitExit(Emitter* e, uint32_t pc)
+{
+    EMIT(e, 0xB8);
+    emit32(e, pc);
+    EMIT(e, 0xE9);
+    emit32(e, (uint32_t)(e->exit - (emitOffset(e) + 4)));
+}
+
+/* calls `fn`, or routine `rt` of the runtime in an executable */
+static void
+emitCall(Emitter* e, const void* fn, uint32_t rt)
+{
+    if (e->pImage != nullptr)
+    {
+        EMIT(e, 0xE8); /* call rt */
+        emit32(e, (uint32_t)(rt - (emitOffset(e) + 4)));
+        return;
+    }
+
+    EMIT(e, 0x48, 0xB8); /* mov rax, fn */
+    emit64(e, (uint64_t)(uintptr_t)fn);
+    EMIT(e, 0xFF, 0xD0); /* call rax */
+}
+
+static void
+emitPush(Emitter* e)
+{
+    EMIT(e, 0x48, 0x89, 0x03); /* mov [rbx], rax */
+    EMIT(e, 0x48, 0x83, 0xC3, 0x08); /* add rbx, 8 */
+}
+
+static void
+emitPop(Emitter* e)
+{
+    EMIT(e, 0x48, 0x83, 0xEB, 0x08); /* sub rbx, 8 */
+    EMIT(e, 0x48, 0x8B, 0x03); /* mov rax, [rbx] */
+}
+
+static void
+jitWriteInt(long n)
+{
+    __pl0_writeint(n);
+}
+
+static void
+jitWriteChar(long c)
+{
+    __pl0_writechar(c);
+}
+
+static long
+jitReadInt(void)
+{
+    return __pl0_readint();
+}
+
+static long
+jitReadChar(void)
+{
+    return __pl0_readchar();
+}
+
+/* the displacement of a slot, or -1 if it doesn't fit one */
+static int64_t
+slotDisp(uint64_t slot, uint64_t n)
+{
+    return slot + n > INT32_MAX / 8 ? -1 : (int64_t)slot * 8;
+}
+
+/* mov `reg`, the frame of the procedure at the local `ps`'s depth, from the display of `pp` */
+static bool
+emitOuter(Emitter* e, const Pl0bProc* pp, const Pl0bSymbol* ps, uint8_t reg)
+{
+    int64_t disp = slotDisp((uint64_t)pp->nParams + ps->depth - 1, 1);
+
+    if (disp < 0)
+        return false;
+
+    EMIT(e, 0x49, 0x8B, 0x84 | reg << 3, 0x24); /* mov reg, [r12 + disp] */
+    emit32(e, (uint32_t)disp);
+
+    return true;
+}
+
+/*
+ * A call in an executable, which does what the interpreter's does: the
+ * checks, the callee's frame over the arguments with the rest of its locals
+ * zeroed and its display filled in, then a call that keeps r12 on the stack.
+ */
+static bool
+emitProcCall(Emitter* e, const Pl0bModule* pMod, const Pl0bProc* pp, const Pl0bInstr* pi, uint32_t pc, Fixup* pFix)
+{
+    const Pl0bProc* pCallee = &pMod->aProcs[pi->arg];
+    uint32_t nZero = pCallee->nLocals - pCallee->nParams;
+    int64_t frame = slotDisp((uint64_t)pCallee->nLocals + pCallee->maxStack, 0);
+
+    if (frame < 0)
+        return false;
+
+    EMIT(e, 0x48, 0x8D, 0x83); /* lea rax, [rbx + frame] */
+    emit32(e, (uint32_t)frame);
+    EMIT(e, 0x48, 0x3D); /* cmp rax, stack end */
+    emitData(e, JIT_DATA_GLOBALS);
+    EMIT(e, 0x77, 0x06); /* ja overflow */
+    EMIT(e, 0x49, 0x83, 0xEF, 0x01); /* sub r15, 1 */
+    EMIT(e, 0x73, 22); /* jae ok */
+    emitFail(e, pc, JIT_RT_OVERFLOW, 14); /* overflow: */
+
+    if (nZero <= 2)
+    {
+        for (uint32_t i = 0; i < nZero; i++)
+            EMIT(e, 0x48, 0xC7, 0x43, (uint8_t)(i * 8), 0x00, 0x00, 0x00, 0x00); /* mov qword [rbx + 8 * i], 0 */
+    }
+    else
+    {
+        EMIT(e, 0x48, 0x89, 0xDF); /* mov rdi, rbx */
+        EMIT(e, 0xB9); /* mov ecx, nZero */
+        emit32(e, nZero);
+        EMIT(e, 0x31, 0xC0); /* xor eax, eax */
+        EMIT(e, 0xF3, 0x48, 0xAB); /* rep stosq */
+    }
+
+    EMIT(e, 0x48, 0x8D, 0x93); /* lea rdx, [rbx - 8 * nParams] */
+    emit32(e, (uint32_t)(-(int64_t)pCallee->nParams * 8));
+
+    /* the display: the caller is at least as deep as the callee's parent */
+    for (uint32_t d = 1; d < pCallee->depth; d++)
+    {
+        uint32_t slot = (pCallee->nParams + d - 1) * 8;
+
+        if (d == pp->depth)
+        {
+            EMIT(e, 0x4C, 0x89, 0xA2); /* mov [rdx + slot], r12 */
+        }
+        else
+        {
+            EMIT(e, 0x49, 0x8B, 0x84, 0x24); /* mov rax, [r12 + caller's slot] */
+            emit32(e, (pp->nParams + d - 1) * 8);
+            EMIT(e, 0x48, 0x89, 0x82); /* mov [rdx + slot], rax */
+        }
+        emit32(e, slot);
+    }
+
+    EMIT(e, 0x41, 0x54); /* push r12 */
+    EMIT(e, 0x49, 0x89, 0xD4); /* mov r12, rdx */
+    EMIT(e, 0x49, 0x8D, 0x9C, 0x24); /* lea rbx, [r12 + 8 * nLocals] */
+    emit32(e, pCallee->nLocals * 8);
+    EMIT(e, 0xE8); /* call entry */
+    *pFix = (Fixup){.at = (uint32_t)emitOffset(e), .pc = pCallee->entry};
+    emit32(e, 0);
+    EMIT(e, 0x41, 0x5C); /* pop r12 */
+    EMIT(e, 0x49, 0xFF, 0xC7); /* inc r15 */
+
+    return true;
+}
+
+static bool
+emitInstr(Emitter* e, const Pl0bModule* pMod, const Pl0bProc* pp, const Pl0bInstr* pi, uint32_t pc, Fixup* pFix)
+{
+    const Pl0bSymbol* ps = nullptr;
+    int64_t disp = 0;
+
+    pFix->at = 0;
+
+    switch (pi->op)
+    {
+        case PL0B_LDG:
+        case PL0B_STG:
+        case PL0B_LDL:
+        case PL0B_STL:
+            if ((disp = slotDisp(pi->arg, 1)) < 0)
+                return false;
+            break;
+
+        case PL0B_LDU:
+        case PL0B_STU:
+            ps = &pMod->aSymbols[pi->arg];
+            if ((disp = slotDisp(ps->slot, 1)) < 0)
+                return false;
+            break;
+
+        case PL0B_LDGX:
+        case PL0B_STGX:
+        case PL0B_LDLX:
+        case PL0B_STLX:
+        case PL0B_LDUX:
+        case PL0B_STUX:
+            ps = &pMod->aSymbols[pi->arg];
+            if ((disp = slotDisp(ps->slot, ps->value)) < 0)
+                return false;
+            break;
+    }
+
+    switch (pi->op)
+    {
+        case PL0B_LIT:
+        {
+            int64_t v = pMod->aPool[pi->arg];
+
+            if (v >= INT32_MIN && v <= INT32_MAX)
+            {
+                EMIT(e, 0x48, 0xC7, 0x03); /* mov qword [rbx], v */
+                emit32(e, (uint32_t)v);
+                EMIT(e, 0x48, 0x83, 0xC3, 0x08);
+            }
+            else
+            {
+                EMIT(e, 0x48, 0xB8);
+                emit64(e, (uint64_t)v);
+                emitPush(e);
+            }
+            break;
+        }
+
+        case PL0B_LDG:
+            EMIT(e, 0x49, 0x8B, 0x85); /* mov rax, [r13 + disp] */
+            emit32(e, (uint32_t)disp);
+            emitPush(e);
+            break;
+
+        case PL0B_STG:
+            emitPop(e);
+            EMIT(e, 0x49, 0x89, 0x85); /* mov [r13 + disp], rax */
+            emit32(e, (uint32_t)disp);
+            break;
+
+        case PL0B_LDL:
+            EMIT(e, 0x49, 0x8B, 0x84, 0x24); /* mov rax, [r12 + disp] */
+            emit32(e, (uint32_t)disp);
+            emitPush(e);
+            break;
+
+        case PL0B_STL:
+            emitPop(e);
+            EMIT(e, 0x49, 0x89, 0x84, 0x24); /* mov [r12 + disp], rax */
+            emit32(e, (uint32_t)disp);
+            break;
+
+        case PL0B_LDGX:
+        case PL0B_LDLX:
+            EMIT(e, 0x48, 0x8B, 0x43, 0xF8); /* mov rax, [rbx - 8] */
+            EMIT(e, 0x48, 0x3D); /* cmp rax, size */
+            emit32(e, (uint32_t)ps->value);
+            emitExitUnless(e, 0x72, pc); /* jb */
+            EMIT(e, 0x49, 0x8B, 0x84, pi->op == PL0B_LDGX ? 0xC5 : 0xC4); /* mov rax, [r13/r12 + rax*8 + disp] */
+            emit32(e, (uint32_t)disp);
+            EMIT(e, 0x48, 0x89, 0x43, 0xF8); /* mov [rbx - 8], rax */
+            break;
+
+        case PL0B_STGX:
+        case PL0B_STLX:
+            EMIT(e, 0x48, 0x8B, 0x43, 0xF0); /* mov rax, [rbx - 16] */
+            EMIT(e, 0x48, 0x3D);
+            emit32(e, (uint32_t)ps->value);
+            emitExitUnless(e, 0x72, pc);
+            EMIT(e, 0x48, 0x8B, 0x4B, 0xF8); /* mov rcx, [rbx - 8] */
+            EMIT(e, 0x49, 0x89, 0x8C, pi->op == PL0B_STGX ? 0xC5 : 0xC4); /* mov [r13/r12 + rax*8 + disp], rcx */
+            emit32(e, (uint32_t)disp);
+            EMIT(e, 0x48, 0x83, 0xEB, 0x10); /* sub rbx, 16 */
+            break;
+
+        case PL0B_LDU:
+            if (!emitOuter(e, pp, ps, 1))
+                return false;
+            EMIT(e, 0x48, 0x8B, 0x81); /* mov rax, [rcx + disp] */
+            emit32(e, (uint32_t)disp);
+            emitPush(e);
+            break;
+
+        case PL0B_STU:
+            emitPop(e);
+            if (!emitOuter(e, pp, ps, 1))
+                return false;
+            EMIT(e, 0x48, 0x89, 0x81); /* mov [rcx + disp], rax */
+            emit32(e, (uint32_t)disp);
+            break;
+
+        case PL0B_LDUX:
+            EMIT(e, 0x48, 0x8B, 0x43, 0xF8); /* mov rax, [rbx - 8] */
+            EMIT(e, 0x48, 0x3D);
+            emit32(e, (uint32_t)ps->value);
+            emitExitUnless(e, 0x72, pc);
+            if (!emitOuter(e, pp, ps, 1))
+                return false;
+            EMIT(e, 0x48, 0x8B, 0x84, 0xC1); /* mov rax, [rcx + rax*8 + disp] */
+            emit32(e, (uint32_t)disp);
+            EMIT(e, 0x48, 0x89, 0x43, 0xF8);
+            break;
+
+        case PL0B_STUX:
+            EMIT(e, 0x48, 0x8B, 0x43, 0xF0); /* mov rax, [rbx - 16] */
+            EMIT(e, 0x48, 0x3D);
+            emit32(e, (uint32_t)ps->value);
+            emitExitUnless(e, 0x72, pc);
+            EMIT(e, 0x48, 0x8B, 0x4B, 0xF8); /* mov rcx, [rbx - 8] */
+            if (!emitOuter(e, pp, ps, 2))
+                return false;
+            EMIT(e, 0x48, 0x89, 0x8C, 0xC2); /* mov [rdx + rax*8 + disp], rcx */
+            emit32(e, (uint32_t)disp);
+            EMIT(e, 0x48, 0x83, 0xEB, 0x10); /* sub rbx, 16 */
+            break;
+
+        case PL0B_NEG:
+            EMIT(e, 0x48, 0xF7, 0x5B, 0xF8); /* neg qword [rbx - 8] */
+            break;
+
+        case PL0B_ADD:
+            emitPop(e);
+            EMIT(e, 0x48, 0x01, 0x43, 0xF8); /* add [rbx - 8], rax */
+            break;
+
+        case PL0B_SUB:
+            emitPop(e);
+            EMIT(e, 0x48, 0x29, 0x43, 0xF8); /* sub [rbx - 8], rax */
+            break;
+
+        case PL0B_MUL:
+            emitPop(e);
+            EMIT(e, 0x48, 0x0F, 0xAF, 0x43, 0xF8); /* imul rax, [rbx - 8] */
+            EMIT(e, 0x48, 0x89, 0x43, 0xF8);
+            break;
+
+        case PL0B_DIV:
+            EMIT(e, 0x48, 0x8B, 0x4B, 0xF8); /* mov rcx, [rbx - 8] */
+            EMIT(e, 0x48, 0x85, 0xC9); /* test rcx, rcx */
+            emitExitUnless(e, 0x75, pc); /* jnz */
+            EMIT(e, 0x48, 0x83, 0xF9, 0xFF); /* cmp rcx, -1 */
+            EMIT(e, 0x75, 0x06); /* jne idiv */
+            EMIT(e, 0x48, 0xF7, 0x5B, 0xF0); /* neg qword [rbx - 16], which wraps where idiv would trap */
+            EMIT(e, 0xEB, 0x0D); /* jmp done */
+            EMIT(e, 0x48, 0x8B, 0x43, 0xF0); /* idiv: mov rax, [rbx - 16] */
+            EMIT(e, 0x48, 0x99); /* cqo */
+            EMIT(e, 0x48, 0xF7, 0xF9); /* idiv rcx */
+            EMIT(e, 0x48, 0x89, 0x43, 0xF0); /* mov [rbx - 16], rax */
+            EMIT(e, 0x48, 0x83, 0xEB, 0x08); /* done: sub rbx, 8 */
+            break;
+
+        case PL0B_ODD:
+            EMIT(e, 0x48, 0x83, 0x63, 0xF8, 0x01); /* and qword [rbx - 8], 1 */
+            break;
+
+        case PL0B_EQ:
+        case PL0B_NE:
+        case PL0B_LT:
+        case PL0B_GT:
+        {
+            static const uint8_t aSetcc[] = {[PL0B_EQ] = 0x94, [PL0B_NE] = 0x95, [PL0B_LT] = 0x9C, [PL0B_GT] = 0x9F};
+
+            emitPop(e);
+            EMIT(e, 0x48, 0x8B, 0x4B, 0xF8); /* mov rcx, [rbx - 8] */
+            EMIT(e, 0x31, 0xD2); /* xor edx, edx */
+            EMIT(e, 0x48, 0x39, 0xC1); /* cmp rcx, rax */
+            EMIT(e, 0x0F, aSetcc[pi->op], 0xC2); /* setcc dl */
+            EMIT(e, 0x48, 0x89, 0x53, 0xF8); /* mov [rbx - 8], rdx */
+            break;
+        }
+
+        case PL0B_JMP:
+            EMIT(e, 0xE9);
+            *pFix = (Fixup){.at = (uint32_t)emitOffset(e), .pc = pi->arg};
+            emit32(e, 0);
+            break;
+
+        case PL0B_JZ:
+            emitPop(e);
+            EMIT(e, 0x48, 0x85, 0xC0); /* test rax, rax */
+            EMIT(e, 0x0F, 0x84); /* jz */
+            *pFix = (Fixup){.at = (uint32_t)emitOffset(e), .pc = pi->arg};
+            emit32(e, 0);
+            break;
+
+        case PL0B_WRITEINT:
+        case PL0B_WRITECHAR:
+            EMIT(e, 0x48, 0x83, 0xEB, 0x08); /* sub rbx, 8 */
+            EMIT(e, 0x48, 0x8B, 0x3B); /* mov rdi, [rbx] */
+            if (pi->op == PL0B_WRITEINT)
+                emitCall(e, (const void*)jitWriteInt, JIT_RT_WRITEINT);
+            else
+                emitCall(e, (const void*)jitWriteChar, JIT_RT_WRITECHAR);
+            break;
+
+        case PL0B_READINT:
+        case PL0B_READCHAR:
+            if (pi->op == PL0B_READINT)
+                emitCall(e, (const void*)jitReadInt, JIT_RT_READINT);
+            else
+                emitCall(e, (const void*)jitReadChar, JIT_RT_READCHAR);
+            emitPush(e);
+            break;
+
+        case PL0B_POP:
+            EMIT(e, 0x48, 0x83, 0xEB, 0x08); /* sub rbx, 8 */
+            break;
+
+        case PL0B_CALL:
+            if (e->pImage == nullptr)
+                emitExit(e, pc);
+            else if (!emitProcCall(e, pMod, pp, pi, pc, pFix))
+                return false;
+            break;
+
+        case PL0B_RET:
+            if (e->pImage == nullptr)
+            {
+                emitExit(e, pc);
+            }
+            else if (pp == &pMod->aProcs[pMod->pHeader->mainProc])
+            {
+                EMIT(e, 0x31, 0xFF); /* xor edi, edi */
+                EMIT(e, 0xE9); /* jmp exit */
+                emit32(e, (uint32_t)(JIT_RT_EXIT - (emitOffset(e) + 4)));
+            }
+            else
+            {
+                EMIT(e, 0x4C, 0x89, 0xE3); /* mov rbx, r12 */
+                EMIT(e, 0xC3); /* ret */
+            }
+            break;
+
+        case PL0B_RETV:
+            if (e->pImage == nullptr)
+            {
+                emitExit(e, pc);
+                break;
+            }
+            EMIT(e, 0x48, 0x8B, 0x43, 0xF8); /* mov rax, [rbx - 8] */
+            EMIT(e, 0x4C, 0x89, 0xE3); /* mov rbx, r12 */
+            emitPush(e);
+            EMIT(e, 0xC3); /* ret */
+            break;
+
+        case PL0B_WRITESTR:
+            if (e->pImage == nullptr)
+            {
+                emitExit(e, pc);
+                break;
+            }
+            ps = &pMod->aSymbols[pi->arg];
+            if ((disp = slotDisp(ps->slot, ps->value)) < 0)
+                return false;
+            if (ps->depth == 0)
+            {
+                EMIT(e, 0x49, 0x8D, 0xB5); /* lea rsi, [r13 + disp] */
+            }
+            else if (&pMod->aProcs[ps->proc] == pp)
+            {
+                EMIT(e, 0x49, 0x8D, 0xB4, 0x24); /* lea rsi, [r12 + disp] */
+            }
+            else
+            {
+                if (!emitOuter(e, pp, ps, 1))
+                    return false;
+                EMIT(e, 0x48, 0x8D, 0xB1); /* lea rsi, [rcx + disp] */
+            }
+            emit32(e, (uint32_t)disp);
+            EMIT(e, 0xBA); /* mov edx, size */
+            emit32(e, (uint32_t)ps->value);
+            emitCall(e, nullptr, JIT_RT_WRITESTR);
+            break;
+    }
+
+    return true;
+}
+
+bool
+jitCompile(Jit* self, uint32_t proc)
+{
+    const Pl0bModule* pMod = self->pMod;
+    JitProc* pj = &self->aProcs[proc];
+    uint32_t entry = pMod->aProcs[proc].entry;
+    uint32_t end = pMod->aProcs[proc].end;
+    size_t size = ((end - entry) * JIT_MAX_TEMPLATE + JIT_STUBS + 4095) & ~(size_t)4095;
+    Fixup* aFixups;
+    uint8_t* pCode;
+    Emitter e;
+
+    if (pj->bTried)
+        return pj->pCode != nullptr;
+    pj->bTried = true;
+
+    pCode = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pCode == MAP_FAILED)
+        return false;
+
+    pj->aOffsets = malloc((end - entry) * sizeof(uint32_t));
+    aFixups = malloc((end - entry) * sizeof(Fixup));
+    if (pj->aOffsets == nullptr || aFixups == nullptr)
+        LOG_FATAL("malloc failed");
+
+    e = (Emitter){.p = pCode, .pStart = pCode};
+
+    /* entry: save the registers the code uses, then jump to the pc */
+    EMIT(&e, 0x55, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56); /* push rbp, rbx, r12, r13, r14 */
+    EMIT(&e, 0x49, 0x89, 0xFE); /* mov r14, rdi */
+    EMIT(&e, 0x48, 0x8B, 0x1F); /* mov rbx, [rdi] */
+    EMIT(&e, 0x49, 0x89, 0xF4); /* mov r12, rsi */
+    EMIT(&e, 0x49, 0x89, 0xD5); /* mov r13, rdx */
+    EMIT(&e, 0xFF, 0xE1); /* jmp rcx */
+
+    /* exit: store the stack pointer and return the pc in eax */
+    e.exit = emitOffset(&e);
+    EMIT(&e, 0x49, 0x89, 0x1E); /* mov [r14], rbx */
+    EMIT(&e, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0x5D); /* pop r14, r13, r12, rbx, rbp */
+    EMIT(&e, 0xC3); /* ret */
+
+    for (uint32_t pc = entry; pc < end; pc++)
+    {
+        pj->aOffsets[pc - entry] = (uint32_t)emitOffset(&e);
+        if (!emitInstr(&e, pMod, &pMod->aProcs[proc], &pMod->aCode[pc], pc, &aFixups[pc - entry]))
+        {
+            munmap(pCode, size);
+            free(aFixups);
+            free(pj->aOffsets);
+            pj->aOffsets = nullptr;
+            return false;
+        }
+    }
+
+    /* pl0bOpen() has checked that jumps stay in the procedure */
+    for (uint32_t i = 0; i < end - entry; i++)
+    {
+        if (aFixups[i].at != 0)
+        {
+            uint32_t rel = pj->aOffsets[aFixups[i].pc - entry] - (aFixups[i].at + 4);
+            memcpy(pCode + aFixups[i].at, &rel, 4);
+        }
+    }
+    free(aFixups);
+
+    if (mprotect(pCode, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(pCode, size);
+        free(pj->aOffsets);
+        pj->aOffsets = nullptr;
+        return false;
+    }
+
+    pj->pCode = pCode;
+    pj->size = size;
+    self->nCompiled++;
+
+    return true;
+}
+
+/* the most code an instruction of an executable gets */
+static size_t
+imageTemplate(const Pl0bModule* pMod, const Pl0bInstr* pi)
+{
+    if (pi->op == PL0B_CALL)
+        return 2 * JIT_MAX_TEMPLATE + 16 * (size_t)pMod->aProcs[pi->arg].depth;
+
+    return JIT_MAX_TEMPLATE;
+}
+
+bool
+jitImage(const Pl0bModule* pMod, JitImage* pImage)
+{
+    const Pl0bProc* pMain = &pMod->aProcs[pMod->pHeader->mainProc];
+    size_t size = sizeof(aRuntime) + sizeof(aRuntimeText) - 1 + JIT_STUBS;
+    size_t nRelocs = sizeof(aRuntimeRelocs) / sizeof(aRuntimeRelocs[0]) + 3;
+    uint32_t* aOffsets = calloc(pMod->nCode, sizeof(uint32_t));
+    Fixup* aFixups = calloc(pMod->nCode + 1, sizeof(Fixup));
+    Emitter e;
+
+    if (aOffsets == nullptr || aFixups == nullptr)
+        LOG_FATAL("malloc failed");
+
+    for (size_t pc = 0; pc < pMod->nCode; pc++)
+    {
+        size += imageTemplate(pMod, &pMod->aCode[pc]);
+        nRelocs += pMod->aCode[pc].op == PL0B_CALL;
+    }
+
+    e = (Emitter){.pImage = pMod};
+    if ((e.p = e.pStart = malloc(size)) == nullptr || (e.aRelocs = malloc(nRelocs * sizeof(uint32_t))) == nullptr)
+        LOG_FATAL("malloc failed");
+
+    emitBytes(&e, aRuntime, sizeof(aRuntime));
+    emitBytes(&e, (const uint8_t*)aRuntimeText, sizeof(aRuntimeText) - 1);
+    for (size_t i = 0; i < sizeof(aRuntimeRelocs) / sizeof(aRuntimeRelocs[0]); i++)
+        e.aRelocs[e.nRelocs++] = aRuntimeRelocs[i];
+
+    /* the start: the stacks, main's frame at the bottom of the interpreter's, and the calls it may make */
+    pImage->entry = emitOffset(&e);
+    EMIT(&e, 0x48, 0xC7, 0xC4); /* mov rsp, stack */
+    emitData(&e, JIT_DATA_STACK);
+    EMIT(&e, 0x41, 0xBD); /* mov r13d, globals */
+    emitData(&e, JIT_DATA_GLOBALS);
+    EMIT(&e, 0x41, 0xBC); /* mov r12d, stack */
+    emitData(&e, JIT_DATA_STACK);
+    EMIT(&e, 0x49, 0x8D, 0x9C, 0x24); /* lea rbx, [r12 + 8 * nLocals] */
+    emit32(&e, pMain->nLocals * 8);
+    EMIT(&e, 0x41, 0xBF); /* mov r15d, calls */
+    emit32(&e, VM_MAX_CALLS);
+    EMIT(&e, 0xE9); /* jmp main */
+    aFixups[pMod->nCode] = (Fixup){.at = (uint32_t)emitOffset(&e), .pc = pMain->entry};
+    emit32(&e, 0);
+
+    for (size_t proc = 0; proc < pMod->nProcs; proc++)
+    {
+        const Pl0bProc* pp = &pMod->aProcs[proc];
+
+        for (uint32_t pc = pp->entry; pc < pp->end; pc++)
+        {
+            aOffsets[pc] = (uint32_t)emitOffset(&e);
+            if (!emitInstr(&e, pMod, pp, &pMod->aCode[pc], pc, &aFixups[pc]))
+            {
+                free(aOffsets);
+                free(aFixups);
+                free(e.pStart);
+                free(e.aRelocs);
+                return false;
+            }
+        }
+    }
+
+    for (size_t i = 0; i <= pMod->nCode; i++)
+    {
+        if (aFixups[i].at != 0)
+        {
+            uint32_t rel = aOffsets[aFixups[i].pc] - (aFixups[i].at + 4);
+            memcpy(e.pStart + aFixups[i].at, &rel, 4);
+        }
+    }
+    free(aOffsets);
+    free(aFixups);
+
+    pImage->pCode = e.pStart;
+    pImage->size = emitOffset(&e);
+    pImage->aRelocs = e.aRelocs;
+    pImage->nRelocs = e.nRelocs;
+    pImage->dataSize = JIT_DATA_GLOBALS + ((size_t)pMod->pHeader->nGlobals + 1) * 8;
+
+    return true;
+}
+
+#else
+
+bool
+jitCompile(Jit* self, uint32_t proc)
+{
+    (void)self;
+    (void)proc;
+
+    return false;
+}
+
+bool
+jitImage(const Pl0bModule* pMod, JitImage* pImage)
+{
+    (void)pMod;
+    (void)pImage;
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#include "pl0b.h"
+
+/*
+ * jit -- native code for the hot procedures of a module.
+ *
+ * A procedure is translated as a whole, one template per instruction, and
+ * keeps its operands in the same stack as the interpreter, so execution can
+ * move between the two at any instruction: native code is entered at the
+ * interpreter's pc and returns the pc of the first instruction it leaves to
+ * the interpreter (calls, returns, writeStr and anything that fails).
+ * Only x86-64 is supported; elsewhere nothing compiles and pl0run stays an
+ * interpreter.
+ *
+ * The same templates make the code of a whole executable for `pl0c -o`,
+ * with calls and returns of its own and a runtime over system calls.
+ */
+
+typedef struct Jit Jit;
+
+Jit* jitCreate(const Pl0bModule* pMod);
+void jitDestroy(Jit* self);
+
+/* compiles procedure `proc` unless it has been tried before, returns whether it has native code */
+bool jitCompile(Jit* self, uint32_t proc);
+bool jitReady(const Jit* self, uint32_t proc);
+
+/* runs `proc` natively from `pc` with the operand stack at `*psp`, returns the pc it stopped at */
+uint32_t jitRun(Jit* self, uint32_t proc, uint32_t pc, long** psp, long* aLocals, long* aGlobals);
+
+/* procedures compiled, and how often native code was entered */
+size_t jitCompiled(const Jit* self);
+size_t jitEntries(const Jit* self);
+
+/* the code of an executable: the runtime, the start, then every procedure */
+typedef struct JitImage
+{
+    uint8_t* pCode; /* malloc()ed */
+    size_t size;
+    size_t entry; /* offset of the start */
+    uint32_t* aRelocs; /* malloc()ed: offsets of 32-bit data offsets, to which the address of the data is added */
+    size_t nRelocs;
+    size_t dataSize; /* bytes of data, all zero at the start */
+} JitImage;
+
+/* false if some procedure's frame is too large, or on anything but x86-64 */
+bool jitImage(const Pl0bModule* pMod, JitImage* pImage);
@@ -1,15 +1,31 @@
 #include "logs.h"
 #include "token.h"
+#include "cache.h"
+#include "compile.h"
+#include "server.h"
+#include "pl0b.h"
+#include "vm.h"
+#include "exe.h"
+#include "pl0c.h"
+#include "bcgen.h"
+#include "deps.h"
 #include "adt/list.h"
 #include "adt/array.h"
+#include "adt/threadpool.h"
 #include "strtonum.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <limits.h>
+#include <setjmp.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <threads.h>
 #include <unistd.h>
 
 /*
@@ -17,77 +33,581 @@
  *
  * program	    = block "." .
  * block	    = [ "const" ident "=" number { "," ident "=" number } ";" ]
- *		          [ "var" ident { "," ident } ";" ]
- *		          { "procedure" ident ";" block ";" } statement .
- * statement	= [ ident ":=" expression
- *		          | "call" ident
+ *		          [ "var" ident [ "size" number ] { "," ident [ "size" number ] } ";" ]
+ *		          { "procedure" ident [ "(" [ ident { "," ident } ] ")" ] ";" block ";" } statement .
+ * statement	= [ ident [ "[" expression "]" ] ":=" expression
+ *		          | "call" ident [ arguments ]
+ *		          | "return" expression
  *		          | "begin" statement { ";" statement } "end"
  *		          | "if" condition "then" statement
- *		          | "while" condition "do" statement ] .
+ *		          | "while" condition "do" statement
+ *		          | "forall" ident ":=" expression "to" expression "do" statement ] .
  * condition	= "odd" expression
  *		          | expression ( "=" | "#" | "<" | ">" ) expression .
  * expression	= [ "+" | "-" ] term { ( "+" | "-" ) term } .
  * term		    = factor { ( "*" | "/" ) factor } .
- * factor	    = ident
+ * factor	    = ident [ "[" expression "]" ]
+ *		        | ident arguments
  *		        | number
  *		        | "(" expression ")" .
+ * arguments	= "(" [ expression { "," expression } ] ")" .
+ *
+ * A procedure declared with a parameter list is a function: its parameters
+ * are locals its callers set, and it returns a value, 0 if it runs off its
+ * end without a return.  Only functions can be called in a factor.
+ *
+ * Procedures nest, and each call has its own locals, so they can recurse.
+ * A procedure sees the variables of the procedures it is declared in.
+ *
+ * The iterations of a forall may run in any order and in parallel, so its
+ * body must not depend on other iterations: arrays it assigns are indexed
+ * by the loop variable only, and a scalar it assigns it must assign in a
+ * statement that always runs before it reads it.  It has no calls,
+ * returns or I/O.
+ * The result is that of running the iterations in order.
  */
 
 #define CHECK_LHS	0
 #define CHECK_RHS	1
 #define CHECK_CALL	2
+#define CHECK_FACTOR	3
+
+#define NESTING_MAX 255 /* procedures in procedures, a byte in .pl0b */
+
+static inline size_t
+SymNodeHash(const SymNode n0)
+{
+    return hashFNV(n0.name);
+}
+
+HASHMAP_GEN_CODE(SymMap, SymNode, SymNodeHash, SymNodeCmp, ADT_HASHMAP_DEFAULT_LOAD_FACTOR);
+
+static void expression(void);
+
+/*
+ * Compiler state is per thread so that the server can run compilations
+ * concurrently, compile() resets it for every file.
+ */
+static thread_local char* raw;
+thread_local char* token;
+static thread_local size_t tokenCap; /* bytes allocated for token */
+static thread_local char* rawStart;
+static thread_local char* rawEnd; /* the NUL after the last byte read */
+static thread_local size_t rawSize;
+thread_local int type;
+thread_local size_t line = 1;
+thread_local size_t prevLine = 1; /* of the token next() moved past */
+static thread_local int depth = 0;
+static thread_local int proc = 0;
+thread_local SymListNode* pProcSym; /* of the procedure being compiled, from its parameters on */
+
+static thread_local SymMap symmap;
+static thread_local SymList symtab;
+static thread_local SymList lClean;
+
+static thread_local FILE* fpErr; /* diagnostics */
+static thread_local jmp_buf* pErrJmp; /* where compileError() unwinds to */
+
+/* Streaming input (--stream) */
+
+#define STREAM_WINDOW (1 << 16) /* bytes of source held at a time */
+#define STREAM_TOKEN_MAX 1024 /* longest identifier or number in a stream */
+
+static thread_local bool bStream = false;
+static thread_local int fdIn = -1;
+static thread_local bool bEof; /* nothing left to read behind rawEnd */
+
+/* Token buffers */
+
+#define LEX_PARALLEL_MIN (1 << 20) /* smaller inputs are lexed in one piece */
+#define LEX_CHUNK_MIN (1 << 18)
+#define LEX_CHUNK_MAX (1 << 30) /* keeps a chunk's line numbers in 32 bits */
+#define LEX_CHUNKS_PER_THREAD 4
+#define EMIT_PARALLEL_MIN (1 << 20) /* smaller inputs are formatted by the compiling thread */
+
+/*
+ * Tokens as parallel arrays: kind, offset, length and line, offset and line
+ * relative to the chunk the token is in.  The parser mostly looks at kinds,
+ * which sit densely packed this way.
+ */
+typedef struct TokenBuf
+{
+    uint8_t* aKind;
+    uint32_t* aStart;
+    uint32_t* aLen;
+    uint32_t* aLine;
+    size_t size;
+    size_t capacity;
+} TokenBuf;
+
+static TokenBuf
+tokenBufCreate(size_t cap)
+{
+    TokenBuf tb = {.capacity = cap};
+
+    tb.aKind = malloc(cap * sizeof(*tb.aKind));
+    tb.aStart = malloc(cap * sizeof(*tb.aStart));
+    tb.aLen = malloc(cap * sizeof(*tb.aLen));
+    tb.aLine = malloc(cap * sizeof(*tb.aLine));
+    if (!tb.aKind || !tb.aStart || !tb.aLen || !tb.aLine)
+        LOG_FATAL("malloc failed");
+
+    return tb;
+}
+
+static void
+tokenBufClean(TokenBuf* self)
+{
+    free(self->aKind);
+    free(self->aStart);
+    free(self->aLen);
+    free(self->aLine);
+}
+
+static inline void
+tokenBufPush(TokenBuf* self, int kind, size_t start, size_t len, size_t line)
+{
+    if (self->size >= self->capacity)
+    {
+        self->capacity *= 2;
+        self->aKind = reallocarray(self->aKind, self->capacity, sizeof(*self->aKind));
+        self->aStart = reallocarray(self->aStart, self->capacity, sizeof(*self->aStart));
+        self->aLen = reallocarray(self->aLen, self->capacity, sizeof(*self->aLen));
+        self->aLine = reallocarray(self->aLine, self->capacity, sizeof(*self->aLine));
+        if (!self->aKind || !self->aStart || !self->aLen || !self->aLine)
+            LOG_FATAL("reallocarray failed");
+    }
+
+    self->aKind[self->size] = kind;
+    self->aStart[self->size] = start;
+    self->aLen[self->size] = len;
+    self->aLine[self->size] = line;
+    self->size++;
+}
+
+/* the parser reads tokens [first, first + n) of *pBuf, at `origin` in the source and line `base` */
+typedef struct TokenRun
+{
+    const TokenBuf* pBuf;
+    size_t first;
+    size_t n;
+    size_t origin;
+    size_t base;
+} TokenRun;
+
+ARRAY_GEN_CODE(ArrTokenRun, TokenRun);
+
+/* Worker threads, shared by the lexer and the code generator */
+
+/* counts a batch of tasks down to zero, so their submitter can wait for them */
+typedef struct Latch
+{
+    atomic_size_t n;
+    mtx_t mtx;
+    cnd_t cnd;
+} Latch;
+
+static void
+latchInit(Latch* self, size_t n)
+{
+    atomic_init(&self->n, n);
+    mtx_init(&self->mtx, mtx_plain);
+    cnd_init(&self->cnd);
+}
+
+static void
+latchCountDown(Latch* self)
+{
+    if (atomic_fetch_sub(&self->n, 1) == 1)
+    {
+        mtx_lock(&self->mtx);
+        cnd_signal(&self->cnd);
+        mtx_unlock(&self->mtx);
+    }
+}
+
+/* waits for the count to reach zero and destroys the latch */
+static void
+latchWait(Latch* self)
+{
+    mtx_lock(&self->mtx);
+    while (atomic_load(&self->n) > 0)
+        cnd_wait(&self->cnd, &self->mtx);
+    mtx_unlock(&self->mtx);
+
+    mtx_destroy(&self->mtx);
+    cnd_destroy(&self->cnd);
+}
+
+static ThreadPool workPool;
+static size_t nWorkThreads; /* including the compiling thread */
+static once_flag workPoolOnce = ONCE_FLAG_INIT;
+
+static void
+workPoolInit(void)
+{
+    if (nWorkThreads == 0)
+        nWorkThreads = hwConcurrency();
+    if (nWorkThreads < 2)
+        return;
+
+    workPool = ThreadPoolCreate(nWorkThreads - 1);
+    ThreadPoolStart(&workPool);
+}
+
+typedef struct LexJob LexJob;
 
-typedef struct SymNode
+/*
+ * A stretch of the source lexed on its own.  Every chunk but the first
+ * starts at a newline, which can only be whitespace or comment, and guesses
+ * that it is not in a comment; lexMerge() finds out whether it was right.
+ */
+typedef struct LexChunk
+{
+    LexJob* pJob;
+    size_t begin;
+    size_t end; /* tokens starting here or later belong to the next chunk */
+    size_t nLines; /* newlines in [begin, end) */
+    size_t next; /* start of the first token past `end`, or where lexing failed */
+    bool bFailed;
+    TokenBuf tokens;
+} LexChunk;
+
+struct LexJob
+{
+    const char* src;
+    size_t size;
+    size_t nChunks;
+    LexChunk* aChunks;
+    Latch done;
+};
+
+static thread_local char* rawTok; /* start of the token lex() returned last */
+thread_local bool bTokens = false; /* the parser reads aRuns instead of calling lex() */
+static thread_local LexChunk* aLexChunks; /* the runs point into these */
+static thread_local size_t nLexChunks;
+static thread_local TokenBuf resync; /* tokens lexMerge() had to lex itself */
+static thread_local ArrTokenRun aRuns;
+
+thread_local TokenCursor cur; /* the token after the current one */
+static thread_local size_t nRead; /* tokens the parser has read from aRuns */
+
+/* Statistics (--stats) */
+
+enum PHASE
+{
+    PHASE_READ,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_SYM,
+    PHASE_EMIT,
+    PHASE_EVAL,
+    PHASE_ENUM_SIZE
+};
+
+static const char* phaseStrings[] = {"readin", "lex", "parse", "symbols", "emit", "evaluate"};
+
+typedef struct Stats
+{
+    unsigned long long aTicks[PHASE_ENUM_SIZE];
+    unsigned long long lastTick;
+    int phase;
+    size_t nTokens;
+    size_t nIdents;
+    size_t nLookups;
+    size_t nProbes;
+    size_t nAllocs;
+    size_t nAllocBytes;
+    size_t nBytesOut;
+    size_t nChecks;
+    size_t nChecksProven;
+    size_t nUnrolled; /* loops in the bytecode */
+    size_t nUnrolledFully;
+    size_t nTailCalls;
+    int evalStatus; /* VM_STATUS */
+    size_t nEvalDone; /* of main's statements */
+    size_t nEvalStmts;
+} Stats;
+
+static thread_local bool bStats = false;
+static thread_local Stats stats;
+
+/* Bounds checks (--safe) */
+
+/* in the body of `while var < bound do`, from its first token up to token `killAt` */
+typedef struct RangeFact
+{
+    const SymListNode* pVar;
+    long bound;
+    size_t killAt;
+} RangeFact;
+
+ARRAY_GEN_CODE(ArrRangeFact, RangeFact);
+
+#define RANGE_MAX_NESTING 64 /* deeper loops in a loop body aren't analyzed */
+
+static thread_local bool bSafe = false;
+static thread_local bool bParallel = false; /* --parallel: run counted loops in parallel where that's the same */
+static thread_local ArrRangeFact aFacts; /* of the loops around the current token */
+static thread_local RangeInit lastInit; /* the statement before the current one, if it was an init */
+
+/* Counted loops */
+
+ARRAY_GEN_CODE(ArrCountedLoop, CountedLoop);
+
+static thread_local ArrCountedLoop aLoops; /* the counted loops around the current token */
+
+static thread_local size_t unroll; /* --unroll: copies of a counted loop's body per test */
+
+/* Tail calls */
+
+static thread_local int tailEnds = -1; /* ends between the current statement and its procedure's end, -1 if others */
+
+/* Profiling instrumentation (--instrument) */
+
+enum PROF
+{
+    PROF_PROC,
+    PROF_LOOP,
+    PROF_CALL,
+    PROF_ENUM_SIZE
+};
+
+static const char* profStrings[] = {"proc", "loop", "call"};
+
+/*
+ * One counter slot in the generated program's __prof[] table.  Procedures
+ * count entries and the inclusive ticks of their outermost activations,
+ * so that recursion is timed once, loops count iterations and ticks spent
+ * in the loop, call sites count calls.  `name` is the procedure the slot is
+ * about: the procedure itself, the one enclosing the loop, or the callee.
+ */
+typedef struct ProfSite
+{
+    int kind;
+    size_t line;
+    char* name;
+} ProfSite;
+
+ARRAY_GEN_CODE(ArrProf, ProfSite);
+typedef size_t Size;
+ARRAY_GEN_CODE(ArrSize, Size);
+
+thread_local bool bInstrument = false;
+static thread_local ArrProf aProfSites;
+static thread_local ArrSize aProfProcs; /* sites of procedures whose body is being emitted */
+
+/* Profile-guided optimization (--profile) */
+
+#define PGO_HOT_PERCENT 5 /* share of the whole run's ticks that makes a procedure hot */
+#define PGO_INLINE_MAX_BYTES 1024 /* largest emitted body that is forced inline */
+
+/* a "proc" line of a profile written by an --instrument build */
+typedef struct ProfEntry
 {
-    int depth;
-    int type;
-    long size;
     char* name;
-} SymNode;
+    unsigned long long count;
+    unsigned long long ticks;
+} ProfEntry;
 
 static inline int
-SymNodeCmp(const SymNode n0, const SymNode n1)
+ProfEntryCmp(const ProfEntry e0, const ProfEntry e1)
 {
-    return strcmp(n0.name, n1.name);
+    return strcmp(e0.name, e1.name);
 }
 
 static inline size_t
-SymNodeHash(const SymNode n0)
+ProfEntryHash(const ProfEntry e0)
 {
-    return hashFNV(n0.name);
+    return hashFNV(e0.name);
 }
 
-HASHMAP_GEN_CODE(SymMap, SymNode, SymNodeHash, SymNodeCmp, ADT_HASHMAP_DEFAULT_LOAD_FACTOR);
-LIST_GEN_CODE(SymList, SymNode, SymNodeCmp);
-typedef char* pChar;
-ARRAY_GEN_CODE(ArrStr, pChar);
+HASHMAP_GEN_CODE(ProfMap, ProfEntry, ProfEntryHash, ProfEntryCmp, ADT_HASHMAP_DEFAULT_LOAD_FACTOR);
 
-static void expression(void);
+/* body of a procedure held back until all procedures are known, see cgProcedures() */
+typedef struct ProcBuf
+{
+    char* name;
+    char* pBuf;
+    size_t size;
+    size_t idx;
+    bool bLeaf;
+    const ProfEntry* pProf;
+    const char* type; /* its C return type */
+    char* params; /* and parameter list */
+} ProcBuf;
+
+ARRAY_GEN_CODE(ArrProcBuf, ProcBuf);
+
+static thread_local bool bPgo = false;
+static thread_local ProfMap profMap;
+static thread_local unsigned long long profTotalTicks;
+static thread_local ArrProcBuf aProcBufs;
+
+/* the aout() calls of one procedure, or of what comes before the first one */
+typedef struct EmitSeg
+{
+    size_t recBegin; /* where its records start in emitRec */
+    Bytes out; /* the formatted C */
+} EmitSeg;
+
+ARRAY_GEN_CODE(ArrEmitSeg, EmitSeg);
+
+typedef struct EmitJob
+{
+    const Bytes* pRec;
+    EmitSeg* aSegs;
+    size_t nSegs;
+    atomic_size_t next; /* the next segment anybody formats */
+    Latch done;
+} EmitJob;
+
+static thread_local bool bDefer = false; /* aout() records into emitRec */
+static thread_local Bytes emitRec; /* format pointers, each followed by its arguments */
+static thread_local ArrEmitSeg aSegs;
+
+static thread_local const char* splitDir;
+static thread_local size_t nUnits;
+static thread_local Bytes splitDecls; /* frames and prototypes of the procedures, for the header */
+static thread_local const char* srcPath;
+
+static thread_local FILE* fpUnit; /* the generated C file */
+static thread_local FILE* fpOut; /* where aout() writes, fpUnit or a procedure's buffer with --profile */
+static thread_local Bytes refBuf; /* what cgRef() returns */
+static thread_local const char* profPath;
+
+/* Compilation cache (--cache) */
+
+static thread_local const char* cacheDir = nullptr;
+static thread_local size_t cacheMaxBytes = CACHE_DEFAULT_MAX_MB * 1024ul * 1024ul;
+static thread_local char* pUnit; /* the generated C file while it goes to the cache too */
+static thread_local size_t unitSize;
+
+/* Parallel loops (forall), checked in deps.c */
+
+static thread_local Bytes forallBody; /* the C of the forall being compiled, which aout() writes here */
+static thread_local Bytes forallFns; /* the functions of the foralls in the procedure, which follow it */
+static thread_local size_t nForalls;
+static thread_local size_t forallHead; /* the size of the loop's for in forallBody */
+static thread_local size_t forallLoops; /* the counted loops around it, whose copies of their variables it reads */
+
+/* Memoization (--memoize), with the effect summaries of deps.c */
+
+static thread_local bool bMemoize = false;
+
+/* Bytecode (--bytecode), emitted by bcgen.c */
+
+static thread_local bool bBytecode = false; /* aout() emits nothing, moduleWrite() writes the module */
+static thread_local bool bExecutable = false; /* or an executable of it */
+
+/* Compile-time evaluation (--evaluate) */
+
+#define EVAL_MAX_OUTPUT (1 << 20) /* bytes the residual program writes at once, at most */
+#define EVAL_MAX_SLOTS (1 << 16) /* nonzero globals it sets */
+
+/* where one of main's statements starts, in the module and in emitRec */
+typedef struct EvalMark
+{
+    uint32_t pc;
+    size_t rec;
+} EvalMark;
+
+ARRAY_GEN_CODE(ArrEvalMark, EvalMark);
+
+static const char* evalStrings[] = {"the end", "an error", "input", "the budget"}; /* by VM_STATUS */
+
+static thread_local size_t evalSteps; /* loop iterations and calls it may take, 0 to not evaluate */
+static thread_local bool bMainBody; /* the next statement is main's */
+static thread_local ArrEvalMark aMarks;
+
+/*
+ * Phases nest (the parser lexes, looks up symbols and emits), so time is
+ * charged to whatever phase is current between two switches.  Returns the
+ * phase to go back to with statsLeave().
+ */
+static inline int
+statsEnter(int phase)
+{
+    if (!bStats)
+        return 0;
+
+    unsigned long long now = tscNow();
+    int prev = stats.phase;
 
-char* raw, * token;
-static int type;
-static size_t line = 1;
-static int depth = 0;
-static int proc = 0;
+    stats.aTicks[prev] += now - stats.lastTick;
+    stats.lastTick = now;
+    stats.phase = phase;
 
-SymMap symmap;
-SymList symtab;
-ArrStr aClean;
-SymList lClean;
+    return prev;
+}
+
+static inline void
+statsLeave(int prev)
+{
+    statsEnter(prev);
+}
+
+static inline void
+statsAlloc(size_t size)
+{
+    stats.nAllocs++;
+    stats.nAllocBytes += size;
+}
 
 static void
-error(const char* fmt, ...)
+statsPrint(double ms)
+{
+    unsigned long long total = 0;
+
+    for (int i = 0; i < PHASE_ENUM_SIZE; i++)
+        total += stats.aTicks[i];
+
+    double ticksPerMs = total / ms;
+
+    fprintf(fpErr, "pl0c: stats:\n");
+    for (int i = 0; i < PHASE_ENUM_SIZE; i++)
+    {
+        fprintf(fpErr, "  %-10s %10.3f ms %6.1f%%\n",
+                phaseStrings[i], stats.aTicks[i] / ticksPerMs, 100.0 * stats.aTicks[i] / total);
+    }
+    fprintf(fpErr, "  %-10s %10.3f ms\n", "total", ms);
+    fprintf(fpErr, "  tokens: %zu, identifiers: %zu\n", stats.nTokens, stats.nIdents);
+    fprintf(fpErr, "  symbol lookups: %zu, average scan length: %.1f\n",
+            stats.nLookups, stats.nLookups ? (double)stats.nProbes / stats.nLookups : 0.0);
+    fprintf(fpErr, "  allocations: %zu (%zu bytes)\n", stats.nAllocs, stats.nAllocBytes);
+    fprintf(fpErr, "  bytes emitted: %zu\n", stats.nBytesOut);
+    if (bSafe)
+        fprintf(fpErr, "  bounds checks: %zu, proven in range: %zu\n", stats.nChecks, stats.nChecksProven);
+    if (bMemoize)
+        fprintf(fpErr, "  memoized procedures: %zu\n", nMemoized);
+    if (unroll > 1 && bModule)
+        fprintf(fpErr, "  loops unrolled: %zu, fully: %zu\n", stats.nUnrolled, stats.nUnrolledFully);
+    fprintf(fpErr, "  tail calls: %zu\n", stats.nTailCalls);
+    if (evalSteps && stats.evalStatus == VM_DONE)
+        fprintf(fpErr, "  evaluated: the whole program\n");
+    else if (evalSteps)
+        fprintf(fpErr, "  evaluated: %zu of %zu statements of main, stopped by %s\n", stats.nEvalDone,
+                stats.nEvalStmts, evalStrings[stats.evalStatus]);
+}
+
+void
+compileError(const char* fmt, ...)
 {
     va_list ap;
 
-    CERR("pl0c: error: %lu: ", line);
+    /* no fpErr while lexing a chunk, see lexChunk() */
+    if (fpErr)
+    {
+        fprintf(fpErr, "pl0c: error: %lu: ", line);
 
-    va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
-    va_end(ap);
+        va_start(ap, fmt);
+        vfprintf(fpErr, fmt, ap);
+        va_end(ap);
 
-    CERR("\n");
-    exit(1);
+        fprintf(fpErr, "\n");
+    }
+
+    longjmp(*pErrJmp, 1);
 }
 
 void
@@ -111,6 +631,9 @@ printToken(void)
         case TOK_ODD:
             COUT("'%s'", token);
             break;
+        case TOK_STRING:
+            COUT("%s", token);
+            break;
         case TOK_DOT:
         case TOK_EQUAL:
         case TOK_COMMA:
@@ -138,39 +661,82 @@ initSymtab(void)
     symmap = SymMapCreate(ADT_DEFAULT_SIZE);
     symtab = SymListCreate();
     lClean = SymListCreate();
-    aClean = ArrStrCreate(ADT_DEFAULT_SIZE);
+
+    /* arrays stay allocated across compilations on the same thread */
+    if (aProfSites.capacity == 0)
+    {
+        aProfSites = ArrProfCreate(ADT_DEFAULT_SIZE);
+        aProfProcs = ArrSizeCreate(ADT_DEFAULT_SIZE);
+        aProcBufs = ArrProcBufCreate(ADT_DEFAULT_SIZE);
+        resync = tokenBufCreate(ADT_DEFAULT_SIZE);
+        aRuns = ArrTokenRunCreate(ADT_DEFAULT_SIZE);
+        aSegs = ArrEmitSegCreate(ADT_DEFAULT_SIZE);
+        aFacts = ArrRangeFactCreate(ADT_DEFAULT_SIZE);
+        aLoops = ArrCountedLoopCreate(ADT_DEFAULT_SIZE);
+        aMarks = ArrEvalMarkCreate(ADT_DEFAULT_SIZE);
+    }
+
     SymListPushBack(&symtab, (SymNode){.depth = 0, .name = "main", .type = TOK_PROCEDURE});
     /*SymMapInsert(&symmap, (SymNode){.depth = 0, .name = "main", .type = TOK_PROCEDURE});*/
 }
 
+/* everything declared in procedure `pProc` */
 static void
-destroySymbols(void)
+destroySymbols(const SymListNode* pProc)
 {
     /*COUT("killing: ...\n");*/
     LIST_FOREACH_REV_SAFE(&symtab, it, itmp)
     {
-        if (it->data.type != TOK_PROCEDURE)
-        {
-            /*free(it->data.name);*/
-            /*COUT("\t'%s'\n", it->data.name);*/
-            SymListRemove(&symtab, it);
-        }
-        else
-        {
+        if (it == pProc)
             break;
-        }
+
+        /* a procedure's locals go with it, so the table never outgrows the program's scopes */
+        free(it->data.name);
+        free(it->data.params);
+        free(it->data.cname);
+        effFree(it->data.pEff);
+        /*COUT("\t'%s'\n", it->data.name);*/
+        SymListRemove(&symtab, it);
     }
 }
 
 static void
 destroySymtab(void)
 {
-    // for (size_t i = 0; i < aClean.size; i++)
-        // free(aClean.pData[i]);
+    /* all names but the static "main" in front */
+    LIST_FOREACH(&symtab, it)
+    {
+        if (it != symtab.pFirst)
+            free(it->data.name);
+        free(it->data.params);
+        free(it->data.cname);
+        effFree(it->data.pEff);
+    }
 
-    // ArrStrClean(&aClean);
     SymListClean(&symtab);
     SymMapClean(&symmap);
+
+    for (size_t i = 0; i < aProfSites.size; i++)
+        free(aProfSites.pData[i].name);
+    aProfSites.size = 0;
+    aProfProcs.size = 0;
+
+    for (size_t i = 0; i < aProcBufs.size; i++)
+    {
+        free(aProcBufs.pData[i].name);
+        free(aProcBufs.pData[i].pBuf);
+        free(aProcBufs.pData[i].params);
+    }
+    aProcBufs.size = 0;
+
+    if (profMap.pBuckets)
+    {
+        for (size_t i = 0; i < profMap.capacity; i++)
+            if (profMap.pBuckets[i].bOccupied)
+                free(profMap.pBuckets[i].data.name);
+        ProfMapClean(&profMap);
+        profMap.pBuckets = nullptr;
+    }
 }
 
 static void
@@ -179,14 +745,18 @@ addSymbol(int type)
     /*CERR("adding: '%s'\n", token);*/
 
     SymListNode* curr;
+    int prev = statsEnter(PHASE_SYM);
 
     curr = symtab.pFirst;
+    stats.nLookups++;
 
     while (true)
     {
+        stats.nProbes++;
+
         if (!strcmp(curr->data.name, token))
             if (curr->data.depth == (depth - 1))
-                error("duplicate symbol: %s", token);
+                compileError("duplicate symbol: %s", token);
 
         if (!curr->pNext)
             break;
@@ -197,42 +767,168 @@ addSymbol(int type)
     /*SymMapReturnNode f = SymMapTryInsert(&symmap);*/
 
     char* n = strdup(token);
+    statsAlloc(strlen(n) + 1);
+    statsAlloc(sizeof(SymListNode));
     /*CERR("added: '%s'\n", n);*/
-    ArrStrPush(&aClean, n);
-    SymListPushBack(&symtab, (SymNode){.depth = depth - 1, .type = type, .name = n});
+    SymListPushBack(&symtab, (SymNode){.depth = depth - 1, .type = type, .value = -1, .name = n});
     /*SymMapInsert(&symmap, (SymNode){.depth = depth - 1, .type = type, .name = n});*/
+
+    statsLeave(prev);
 }
 
-static void
-readin(char* file)
+/* innermost visible symbol named `name`, or nullptr */
+SymListNode*
+symLookup(const char* name)
+{
+    SymListNode* ret = nullptr;
+
+    stats.nLookups++;
+
+    LIST_FOREACH(&symtab, it)
+    {
+        stats.nProbes++;
+        if (!strcmp(name, it->data.name))
+            ret = it;
+    }
+
+    return ret;
+}
+
+static int
+openSource(const char* file)
 {
     int fd;
-    struct stat st;
+
+    if (!strcmp(file, "-"))
+        return STDIN_FILENO;
 
     if (strrchr(file, '.') == nullptr)
-        error("file must end in '.pl0'");
+        compileError("file must end in '.pl0'");
 
     if(strcmp(strrchr(file, '.'), ".pl0") != 0)
-        error("file must end in '.pl0'");
+        compileError("file must end in '.pl0'");
 
     if ((fd = open(file, O_RDONLY)) == -1)
-        error("couldn't open %s", file);
+        compileError("couldn't open %s", file);
+
+    return fd;
+}
+
+static void
+readin(char* file)
+{
+    int fd;
+    struct stat st;
+
+    fd = openSource(file);
 
     if (fstat(fd, &st) == -1)
-        error("couldn't get file size");
+        compileError("couldn't get file size");
 
     if ((raw = malloc(st.st_size + 1)) == nullptr)
         LOG_FATAL("malloc failed");
+    rawStart = raw;
+    statsAlloc(st.st_size + 1);
 
     if (read(fd, raw, st.st_size) != st.st_size)
-        error("couldn't read %s", file);
+        compileError("couldn't read %s", file);
 
     raw[st.st_size] = '\0';
+    rawEnd = raw + st.st_size;
+    rawSize = st.st_size;
     close(fd);
 }
 
 /* Lexer */
 
+/*
+ * Moves the unread rest of the window to its front and reads more behind it
+ * with --stream.  Returns false once there is nothing left to read.
+ */
+static bool
+refill(void)
+{
+    size_t keep = rawEnd - raw;
+    ssize_t n;
+
+    if (bEof)
+        return false;
+
+    int prev = statsEnter(PHASE_READ);
+
+    memmove(rawStart, raw, keep);
+    raw = rawStart;
+    rawEnd = rawStart + keep;
+
+    while (rawEnd < rawStart + STREAM_WINDOW)
+    {
+        if ((n = read(fdIn, rawEnd, rawStart + STREAM_WINDOW - rawEnd)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            compileError("couldn't read input");
+        }
+
+        if (n == 0)
+        {
+            bEof = true;
+            break;
+        }
+
+        rawEnd += n;
+        rawSize += n;
+    }
+    *rawEnd = '\0';
+
+    statsLeave(prev);
+
+    return rawEnd - raw > (ptrdiff_t)keep;
+}
+
+/* sets up the window that refill() slides over `file` */
+static void
+openStream(const char* file)
+{
+    fdIn = openSource(file);
+
+    if ((rawStart = malloc(STREAM_WINDOW + 1)) == nullptr)
+        LOG_FATAL("malloc failed");
+    statsAlloc(STREAM_WINDOW + 1);
+
+    raw = rawEnd = rawStart;
+    *raw = '\0';
+    bEof = false;
+    refill();
+}
+
+/* makes `len` bytes at `p` the token text, numbers without their '_' separators */
+static void
+tokenSet(const char* p, size_t len, bool bNumber)
+{
+    size_t i = 0;
+
+    if (len + 1 > tokenCap)
+    {
+        tokenCap = len + 1 > 64 ? len + 1 : 64;
+        if ((token = realloc(token, tokenCap)) == nullptr)
+            LOG_FATAL("realloc failed");
+        statsAlloc(tokenCap);
+    }
+
+    if (bNumber)
+    {
+        for (size_t j = 0; j < len; j++)
+            if (p[j] != '_')
+                token[i++] = p[j];
+    }
+    else
+    {
+        memcpy(token, p, len);
+        i = len;
+    }
+    token[i] = '\0';
+}
+
 static void
 comment(void)
 {
@@ -241,7 +937,11 @@ comment(void)
     while ((ch = *raw++) != '}')
     {
         if (ch == '\0')
-            error("unterminated comment");
+        {
+            if (--raw == rawEnd && refill())
+                continue;
+            compileError("unterminated comment");
+        }
         if (ch == '\n')
             ++line;
     }
@@ -251,7 +951,7 @@ static int
 ident(void)
 {
     char* p;
-    size_t i, len;
+    size_t len;
 
     p = raw;
     while (isalnum(*raw) || *raw == '_')
@@ -259,16 +959,13 @@ ident(void)
 
     len = raw - p;
 
-    --raw;
-
-    free(token);
+    /* refill() guarantees this much in the window, no more */
+    if (bStream && len >= STREAM_TOKEN_MAX)
+        compileError("identifier longer than %d characters", STREAM_TOKEN_MAX - 1);
 
-    if ((token = malloc(len + 1)) == nullptr)
-        LOG_FATAL("malloc failed");
+    --raw;
 
-    for (i = 0; i < len; i++)
-        token[i] = *p++;
-    token[i] = '\0';
+    tokenSet(p, len, false);
 
     TokenMapReturnNode f = TokenMapSearchValue(&hmTokens, token);
     if (f.pData)
@@ -282,7 +979,7 @@ number(void)
 {
     const char* errstr;
     char* p;
-    size_t i, j = 0, len;
+    size_t len;
 
     p = raw;
     while (isdigit(*raw) || *raw == '_')
@@ -290,30 +987,58 @@ number(void)
 
     len = raw - p;
 
-    --raw;
-
-    free(token);
+    /* refill() guarantees this much in the window, no more */
+    if (bStream && len >= STREAM_TOKEN_MAX)
+        compileError("number longer than %d characters", STREAM_TOKEN_MAX - 1);
 
-    if ((token = malloc(len + 1)) == nullptr)
-        LOG_FATAL("malloc\n");
+    --raw;
 
-    for (i = 0; i < len; i++)
-    {
-        if (isdigit(*p))
-            token[j++] = *p;
-        ++p;
-    }
-    token[j] = '\0';
+    tokenSet(p, len, true);
 
     strtonum(token, 0, LONG_MAX, &errstr);
     if (errstr)
-        LOG_FATAL("invalid number: %s\n", token);
+        compileError("invalid number: %s", token);
 
     return TOK_NUMBER;
 }
 
+/* a string on one line, the token keeps its quotes: C takes it as is */
 static int
-lex(void)
+string(void)
+{
+    char* p;
+    size_t len;
+
+    p = raw;
+    while (*++raw != '"')
+    {
+        if (*raw == '\\')
+        {
+            ++raw;
+            if (*raw == '\n' || *raw == '\0')
+                compileError("unterminated string");
+            if (*raw != '"' && *raw != '\\' && *raw != 'n' && *raw != 't')
+                compileError("unknown escape in string: '\\%c'", *raw);
+        }
+        else if (*raw == '\n' || *raw == '\0')
+        {
+            compileError("unterminated string");
+        }
+    }
+
+    len = raw - p + 1;
+
+    /* refill() guarantees this much in the window, no more */
+    if (bStream && len >= STREAM_TOKEN_MAX)
+        compileError("string longer than %d characters", STREAM_TOKEN_MAX - 1);
+
+    tokenSet(p, len, false);
+
+    return TOK_STRING;
+}
+
+static int
+lex(void)
 {
 again:
     /* skip whitespace */
@@ -321,6 +1046,12 @@ again:
         if (*raw++ == '\n')
             ++line;
 
+    /* a whole token must fit into what is left of the window */
+    if (rawEnd - raw < STREAM_TOKEN_MAX && refill())
+        goto again;
+
+    rawTok = raw;
+
     if (isalpha(*raw) || *raw == '_')
         return ident();
 
@@ -332,6 +1063,8 @@ again:
         case '{':
             comment();
             goto again;
+        case '"':
+            return string();
         case '.':
         case '=':
         case ',':
@@ -345,316 +1078,2650 @@ again:
         case '/':
         case '(':
         case ')':
+        case '[':
+        case ']':
             return (*raw);
         case ':':
             if (*++raw != '=')
-                LOG_BAD("unknown token: ':%c'\n", *raw);
+                compileError("unknown token: ':%c'", *raw);
 
             return TOK_ASSIGN;
         case '\0':
             return 0;
         default:
-            LOG_BAD("unknown token: '%c'\n", *raw);
+            compileError("unknown token: '%c'", *raw);
+    }
+
+    return 0;
+}
+
+/* Tokenizing ahead of the parser */
+
+static size_t
+countLines(const char* p, const char* end)
+{
+    size_t n = 0;
+
+    while ((p = memchr(p, '\n', end - p)) != nullptr)
+    {
+        ++n;
+        ++p;
     }
 
+    return n;
+}
+
+/* lexes from `p` to the first token at or after the chunk's end, false on an error */
+static bool
+lexRun(LexChunk* pc, char* p, size_t firstLine)
+{
+    const char* src = pc->pJob->src;
+    const char* end = src + pc->end;
+    jmp_buf jmp;
+    int t;
+
+    raw = p;
+    line = firstLine;
+    pc->tokens.size = 0;
+
+    if (setjmp(jmp))
+        return false;
+    pErrJmp = &jmp;
+
+    do
+    {
+        pc->next = raw - src;
+        t = lex();
+        if (rawTok >= end)
+        {
+            pc->next = rawTok - src;
+            break;
+        }
+
+        if (raw - rawTok >= UINT32_MAX)
+            compileError("token longer than %u characters", UINT32_MAX);
+
+        tokenBufPush(&pc->tokens, t, rawTok - src - pc->begin, raw - rawTok + 1, line);
+        ++raw;
+    } while (t != 0);
+
+    return true;
+}
+
+/* lexes one chunk on a pool thread, errors are only recorded */
+static int
+lexChunk(void* pArg)
+{
+    LexChunk* pc = pArg;
+    LexJob* pj = pc->pJob;
+    char* begin = (char*)pj->src + pc->begin;
+    char* p;
+
+    pc->nLines = countLines(begin, pj->src + (pc->end < pj->size ? pc->end : pj->size));
+
+    rawEnd = (char*)pj->src + pj->size;
+    bEof = true;
+    fpErr = nullptr;
+
+    pc->bFailed = !lexRun(pc, begin, 0);
+
+    /* started inside a comment after all?  Then it failed at the '}' at the latest, guess again behind it */
+    if (pc->bFailed && pc->begin > 0 && (p = memchr(begin, '}', rawEnd - begin)) != nullptr)
+        pc->bFailed = !lexRun(pc, p + 1, countLines(begin, p + 1));
+
+    free(token);
+    token = nullptr;
+    tokenCap = 0;
+    pErrJmp = nullptr;
+
+    latchCountDown(&pj->done);
+
     return 0;
 }
 
+/* index of the chunk's token starting at `pos`, or -1 */
+static long
+tokenFind(const LexChunk* pc, size_t pos)
+{
+    const TokenBuf* pb = &pc->tokens;
+    size_t start = pos - pc->begin;
+    long lo = 0, hi = (long)pb->size - 1;
+
+    while (lo <= hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+
+        if (pb->aStart[mid] == start)
+            return mid;
+        if (pb->aStart[mid] < start)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return -1;
+}
+
+/* lex() into *pt, or false if it fails, without reporting the error */
+static bool
+lexQuiet(int* pt)
+{
+    jmp_buf* pJmp = pErrJmp;
+    FILE* err = fpErr;
+    jmp_buf jmp;
+
+    pErrJmp = &jmp;
+    fpErr = nullptr;
+    if (setjmp(jmp))
+    {
+        pErrJmp = pJmp;
+        fpErr = err;
+        return false;
+    }
+
+    *pt = lex();
+    pErrJmp = pJmp;
+    fpErr = err;
+
+    return true;
+}
+
+/*
+ * Strings the chunks' tokens together into aRuns.  The first chunk is the
+ * real lexing, after it `pos` is always the start of a real token.  A chunk's
+ * tokens are taken from the one that starts at `pos`, and where there is none
+ * (a wrong guess about comments) or the chunk failed, the calling thread lexes
+ * on from `pos` into `resync` until it meets one of the chunk's tokens or
+ * reaches the next chunk.  Errors on that path are real ones, but they wait
+ * in a TOK_LEXERROR token until the parser gets there, see tokenNext(), so
+ * that an earlier syntax error is still the one reported.
+ */
+static void
+lexMerge(LexJob* pj)
+{
+    size_t pos = 0, base = 1;
+    int t;
+
+    for (size_t c = 0; c < pj->nChunks;)
+    {
+        LexChunk* pc = &pj->aChunks[c];
+        long k = pos == 0 ? 0 : tokenFind(pc, pos);
+
+        if (k >= 0)
+        {
+            size_t n = pc->tokens.size - k;
+
+            if (n > 0)
+            {
+                ArrTokenRunPush(&aRuns, (TokenRun){.pBuf = &pc->tokens, .first = k, .n = n, .origin = pc->begin, .base = base});
+                if (pc->tokens.aKind[pc->tokens.size - 1] == 0)
+                    return;
+            }
+
+            pos = pc->next;
+            if (!pc->bFailed)
+            {
+                base += pc->nLines;
+                c++;
+                continue;
+            }
+        }
+
+        raw = (char*)pj->src + pos;
+        line = base + countLines(pj->src + pc->begin, raw); /* real lines, compileError() may report them */
+        ArrTokenRunPush(&aRuns, (TokenRun){.pBuf = &resync, .first = resync.size, .origin = pc->begin, .base = base});
+
+        while (true)
+        {
+            size_t at = raw - pj->src, atLine = line;
+
+            if (!lexQuiet(&t))
+            {
+                tokenBufPush(&resync, TOK_LEXERROR, at - pc->begin, 1, atLine - base);
+                tokenBufPush(&resync, 0, at - pc->begin, 1, atLine - base);
+                aRuns.pData[aRuns.size - 1].n += 2;
+                return;
+            }
+            pos = rawTok - pj->src;
+
+            if (pos >= pc->end)
+            {
+                base += pc->nLines;
+                c++;
+                break;
+            }
+
+            if (tokenFind(pc, pos) >= 0)
+                break;
+
+            tokenBufPush(&resync, t, pos - pc->begin, raw - rawTok + 1, line - base);
+            aRuns.pData[aRuns.size - 1].n++;
+            if (t == 0)
+                return;
+            ++raw;
+        }
+
+        if (aRuns.pData[aRuns.size - 1].n == 0)
+            --aRuns.size;
+    }
+}
+
+static void
+lexFree(void)
+{
+    for (size_t i = 0; i < nLexChunks; i++)
+        tokenBufClean(&aLexChunks[i].tokens);
+    free(aLexChunks);
+
+    aLexChunks = nullptr;
+    nLexChunks = 0;
+}
+
+/*
+ * Lexes all of raw into aRuns before parsing starts.  Large inputs are split
+ * into chunks for the lexer pool, the calling thread lexes the first one and
+ * any the pool can't take.
+ */
+static void
+lexAll(void)
+{
+    LexJob job = {.src = raw, .size = rawEnd - raw};
+    size_t nChunks = 1, chunk;
+    jmp_buf* pJmp = pErrJmp;
+    FILE* err = fpErr;
+    int prev = statsEnter(PHASE_LEX);
+
+    if (job.size >= LEX_PARALLEL_MIN)
+    {
+        call_once(&workPoolOnce, workPoolInit);
+        if (nWorkThreads > 1)
+            nChunks = nWorkThreads * LEX_CHUNKS_PER_THREAD;
+        if (nChunks > job.size / LEX_CHUNK_MIN)
+            nChunks = job.size / LEX_CHUNK_MIN;
+    }
+    if (nChunks < job.size / LEX_CHUNK_MAX + 1)
+        nChunks = job.size / LEX_CHUNK_MAX + 1;
+    chunk = job.size / nChunks;
+
+    if ((job.aChunks = calloc(nChunks, sizeof(LexChunk))) == nullptr)
+        LOG_FATAL("calloc failed");
+    statsAlloc(nChunks * sizeof(LexChunk));
+
+    /* split at newlines, so no token is cut in two */
+    for (size_t i = 0; i < nChunks; i++)
+    {
+        size_t begin = 0;
+        const char* nl;
+
+        if (i > 0)
+        {
+            begin = i * chunk;
+            if (begin <= job.aChunks[job.nChunks - 1].begin)
+                continue;
+            if ((nl = memchr(job.src + begin, '\n', job.size - begin)) == nullptr)
+                break;
+            begin = nl - job.src;
+            job.aChunks[job.nChunks - 1].end = begin;
+        }
+
+        /* about one token per 6 bytes of source */
+        job.aChunks[job.nChunks++] = (LexChunk){.pJob = &job, .begin = begin, .tokens = tokenBufCreate(chunk / 6 + 1)};
+    }
+    job.aChunks[job.nChunks - 1].end = job.size + 1; /* the last chunk takes the end of input too */
+
+    /* compileCleanup() frees the chunks if anything below fails */
+    aLexChunks = job.aChunks;
+    nLexChunks = job.nChunks;
+
+    latchInit(&job.done, job.nChunks);
+
+    if (nWorkThreads > 1)
+        for (size_t i = 1; i < job.nChunks; i++)
+            ThreadPoolSubmit(&workPool, (TaskNode){.pFn = lexChunk, .pArg = &job.aChunks[i]});
+    else
+        for (size_t i = 1; i < job.nChunks; i++)
+            lexChunk(&job.aChunks[i]);
+
+    /* the first chunk can't guess wrong */
+    lexChunk(&job.aChunks[0]);
+    fpErr = err;
+    pErrJmp = pJmp;
+
+    latchWait(&job.done);
+
+    lexMerge(&job);
+
+    bTokens = true;
+    cur = (TokenCursor){};
+    nRead = 0;
+
+    statsLeave(prev);
+}
+
+/* the kind of the token at *pc, its text in *ppText and *pLen, and moves *pc past it */
+int
+cursorNext(TokenCursor* pc, const char** ppText, size_t* pLen)
+{
+    const TokenRun* pr = &aRuns.pData[pc->iRun];
+    const TokenBuf* pb = pr->pBuf;
+    size_t t = pr->first + pc->iToken;
+
+    *ppText = rawStart + pr->origin + pb->aStart[t];
+    *pLen = pb->aLen[t];
+
+    /* the last one is the end of input, nothing reads past it */
+    if (++pc->iToken == pr->n)
+    {
+        if (pc->iRun + 1 < aRuns.size)
+        {
+            ++pc->iRun;
+            pc->iToken = 0;
+        }
+        else
+        {
+            --pc->iToken;
+        }
+    }
+
+    return pb->aKind[t];
+}
+
+/* makes the next token of aRuns current */
+static int
+tokenNext(void)
+{
+    const TokenRun* pr = &aRuns.pData[cur.iRun];
+    size_t lineRel = pr->pBuf->aLine[pr->first + cur.iToken];
+    const char* p;
+    size_t len;
+    int kind = cursorNext(&cur, &p, &len);
+
+    line = pr->base + lineRel;
+    ++nRead;
+
+    /* lexing failed here, see lexMerge(): again, for the error */
+    if (kind == TOK_LEXERROR)
+    {
+        raw = (char*)p;
+        lex();
+        LOG_FATAL("no lexing error at line %zu", line);
+    }
+
+    if (kind == TOK_IDENT || kind == TOK_NUMBER || kind == TOK_STRING)
+        tokenSet(p, len, kind == TOK_NUMBER);
+
+    return kind;
+}
+
 /* Code generator */
 
+/* appends like vprintf(), with a NUL after the end that isn't counted */
 static void
-cgEnd(void)
+bytesVprintf(Bytes* self, const char* fmt, va_list ap)
 {
-    COUT("\n/* PL/0 compiler %g */\n", PL0C_VERSION);
+    va_list aq;
+    int n;
+
+    va_copy(aq, ap);
+    n = vsnprintf(nullptr, 0, fmt, aq);
+    va_end(aq);
+
+    if (self->size + n + 1 > self->capacity)
+    {
+        self->capacity = (self->size + n + 1) * 2;
+        if ((self->pData = realloc(self->pData, self->capacity)) == nullptr)
+            LOG_FATAL("realloc failed");
+    }
+
+    vsnprintf(self->pData + self->size, n + 1, fmt, ap);
+    self->size += n;
 }
 
 static void
-cgConst(void)
+bytesPrintf(Bytes* self, const char* fmt, ...)
 {
-    COUT("const long %s = ", token);
+    va_list ap;
+
+    va_start(ap, fmt);
+    bytesVprintf(self, fmt, ap);
+    va_end(ap);
 }
 
+/* appends the decimal digits of `n`, negative if `bNeg` */
 static void
-cgSemicolon(void)
+bytesPutNum(Bytes* self, unsigned long n, bool bNeg)
 {
-    COUT(";\n");
+    char buf[24];
+    char* p = buf + sizeof(buf);
+
+    do
+        *--p = '0' + n % 10;
+    while ((n /= 10) != 0);
+
+    if (bNeg)
+        *--p = '-';
+
+    bytesPut(self, p, buf + sizeof(buf) - p);
 }
 
+/*
+ * Stores `fmt` and its arguments for emitFormat().  Only the conversions
+ * aout() is called with are understood: %s, %zu, %ld, %g and %%, anything
+ * else would read the arguments out of step and is fatal.
+ */
 static void
-cgSymbol(void)
+emitRecord(const char* fmt, va_list ap)
 {
-    switch (type)
+    Bytes* pRec = &emitRec;
+    const char* p = fmt;
+
+    bytesPut(pRec, &fmt, sizeof(fmt));
+
+    while ((p = strchr(p, '%')) != nullptr)
     {
-        case TOK_IDENT:
-        case TOK_NUMBER:
-            COUT("%s", token);
-            break;
+        switch (*++p)
+        {
+            case 's': {
+                const char* s = va_arg(ap, const char*);
+                bytesPut(pRec, s, strlen(s) + 1);
+                break;
+            }
 
-        case TOK_BEGIN:
-            COUT("{\n");
-            break;
+            case 'z': {
+                if (p[1] != 'u')
+                    LOG_FATAL("aout() can't defer %%z%c in \"%s\"", p[1], fmt);
+                size_t z = va_arg(ap, size_t);
+                bytesPut(pRec, &z, sizeof(z));
+                ++p;
+                break;
+            }
 
-        case TOK_END:
-            COUT(";\n}\n");
-            break;
+            case 'l': {
+                if (p[1] != 'd')
+                    LOG_FATAL("aout() can't defer %%l%c in \"%s\"", p[1], fmt);
+                long l = va_arg(ap, long);
+                bytesPut(pRec, &l, sizeof(l));
+                ++p;
+                break;
+            }
 
-        case TOK_IF:
-            COUT("if(");
-            break;
+            case 'g': {
+                double g = va_arg(ap, double);
+                bytesPut(pRec, &g, sizeof(g));
+                break;
+            }
 
-        case TOK_THEN:
-        case TOK_DO:
-            COUT(")");
-            break;
+            case '%':
+                break;
 
-        case TOK_ODD:
-            COUT("(");
-            break;
+            default:
+                LOG_FATAL("aout() can't defer %%%c in \"%s\"", *p, fmt);
+        }
+        ++p;
+    }
+}
 
-        case TOK_WHILE:
-            COUT("while (");
-            break;
+/* replays records into the segment's output, exactly as vfprintf() would have */
+static void
+emitFormat(EmitSeg* pSeg, const char* pRec, const char* pRecEnd)
+{
+    Bytes* pOut = &pSeg->out;
 
-        case TOK_EQUAL:
-            COUT("==");
-            break;
+    while (pRec < pRecEnd)
+    {
+        const char* fmt;
+        const char* p;
 
-        case TOK_COMMA:
-            COUT(",");
-            break;
+        memcpy(&fmt, pRec, sizeof(fmt));
+        pRec += sizeof(fmt);
 
-        case TOK_ASSIGN:
-            COUT("=");
-            break;
+        while ((p = strchr(fmt, '%')) != nullptr)
+        {
+            bytesPut(pOut, fmt, p - fmt);
 
-        case TOK_HASH:
-            COUT("!=");
-            break;
+            switch (*++p)
+            {
+                case 's': {
+                    size_t len = strlen(pRec);
+                    bytesPut(pOut, pRec, len);
+                    pRec += len + 1;
+                    break;
+                }
+
+                case 'z': {
+                    size_t z;
+                    memcpy(&z, pRec, sizeof(z));
+                    pRec += sizeof(z);
+                    bytesPutNum(pOut, z, false);
+                    ++p;
+                    break;
+                }
+
+                case 'l': {
+                    long l;
+                    memcpy(&l, pRec, sizeof(l));
+                    pRec += sizeof(l);
+                    bytesPutNum(pOut, l < 0 ? -(unsigned long)l : (unsigned long)l, l < 0);
+                    ++p;
+                    break;
+                }
+
+                case 'g': {
+                    double g;
+                    char buf[32];
+                    memcpy(&g, pRec, sizeof(g));
+                    pRec += sizeof(g);
+                    bytesPut(pOut, buf, snprintf(buf, sizeof(buf), "%g", g));
+                    break;
+                }
+
+                default:
+                    bytesPut(pOut, p, 1);
+                    break;
+            }
+            fmt = p + 1;
+        }
 
-        case TOK_LESSTHAN:
-            COUT("<");
-            break;
+        bytesPut(pOut, fmt, strlen(fmt));
+    }
+}
 
-        case TOK_GREATERTHAN:
-            COUT(">");
-            break;
+/* formats segments until none are left, on a pool thread or the compiling one */
+static int
+emitWork(void* pArg)
+{
+    EmitJob* pj = pArg;
+    size_t i;
 
-        case TOK_PLUS:
-            COUT("+");
-            break;
+    while ((i = atomic_fetch_add(&pj->next, 1)) < pj->nSegs)
+    {
+        size_t end = i + 1 < pj->nSegs ? pj->aSegs[i + 1].recBegin : pj->pRec->size;
+        emitFormat(&pj->aSegs[i], pj->pRec->pData + pj->aSegs[i].recBegin, pj->pRec->pData + end);
+    }
 
-        case TOK_MINUS:
-            COUT("-");
-            break;
+    latchCountDown(&pj->done);
+
+    return 0;
+}
+
+/* starts a new segment at the beginning of a procedure */
+static void
+emitSplit(void)
+{
+    if (bDefer)
+        ArrEmitSegPush(&aSegs, (EmitSeg){.recBegin = emitRec.size});
+}
+
+/* formats what aout() recorded, procedures in parallel */
+static void
+emitFormatAll(void)
+{
+    EmitJob job = {.pRec = &emitRec, .aSegs = aSegs.pData, .nSegs = aSegs.size};
+    size_t nHelpers = 0;
+
+    if (rawSize >= EMIT_PARALLEL_MIN)
+    {
+        call_once(&workPoolOnce, workPoolInit);
+        nHelpers = nWorkThreads - 1;
+    }
+    if (nHelpers > job.nSegs - 1)
+        nHelpers = job.nSegs - 1;
+
+    atomic_init(&job.next, 0);
+    latchInit(&job.done, nHelpers + 1);
+
+    for (size_t i = 0; i < nHelpers; i++)
+        ThreadPoolSubmit(&workPool, (TaskNode){.pFn = emitWork, .pArg = &job});
+    emitWork(&job);
+
+    latchWait(&job.done);
+}
+
+/* formats what aout() recorded and writes it out in order */
+static void
+emitFlush(void)
+{
+    int prev;
+
+    if (aSegs.size == 0)
+        return;
+
+    prev = statsEnter(PHASE_EMIT);
+    emitFormatAll();
+
+    for (size_t i = 0; i < aSegs.size; i++)
+    {
+        EmitSeg* pSeg = &aSegs.pData[i];
+
+        fwrite(pSeg->out.pData, 1, pSeg->out.size, fpOut);
+        stats.nBytesOut += pSeg->out.size;
+    }
+
+    statsLeave(prev);
+}
+
+/* Split translation units (--split) */
+
+static FILE*
+splitOpen(char* path, size_t size, const char* base, const char* suffix)
+{
+    FILE* fp;
+
+    snprintf(path, size, "%s/%s%s", splitDir, base, suffix);
+    if ((fp = fopen(path, "w")) == nullptr)
+        compileError("couldn't create %s: %s", path, strerror(errno));
+
+    return fp;
+}
+
+static void
+splitClose(FILE* fp, const char* path)
+{
+    if (ferror(fp) | fclose(fp))
+        compileError("couldn't write %s", path);
+}
+
+/* biggest procedures first, so that greedy placement balances the units */
+static int
+segSizeCmp(const void* p0, const void* p1)
+{
+    const EmitSeg* a = *(const EmitSeg* const*)p0;
+    const EmitSeg* b = *(const EmitSeg* const*)p1;
+
+    if (a->out.size != b->out.size)
+        return a->out.size > b->out.size ? -1 : 1;
+
+    return a < b ? -1 : a > b;
+}
+
+/* the C name of procedure `pn` */
+static const char*
+procCName(const SymNode* pn)
+{
+    return pn->cname != nullptr ? pn->cname : pn->name;
+}
+
+/* its return type */
+static const char*
+procType(const SymNode* pn)
+{
+    return pn->bResult ? "long" : "void";
+}
+
+/* and its parameter list */
+static const char*
+procParams(const SymNode* pn)
+{
+    return pn->params != nullptr ? pn->params : "void";
+}
+
+/*
+ * Writes the header (everything before the first procedure, globals
+ * declared extern, and all prototypes), the procedures spread over up to
+ * nUnits files by size, main with the global definitions in the first
+ * one, and a Makefile that compiles them in parallel and links them.
+ */
+static void
+emitUnits(void)
+{
+    size_t nSegs = aSegs.size; /* what comes before the procedures, the procedures, main */
+    size_t nUnitsUsed = nUnits < nSegs - 1 ? nUnits : nSegs - 1;
+    const char* p = strrchr(srcPath, '/');
+    char base[NAME_MAX + 1], path[PATH_MAX], cwd[PATH_MAX];
+    char* dot;
+    EmitSeg** aOrder;
+    size_t* aUnitOf;
+    size_t* aLoad;
+    FILE* fp;
+    int prev = statsEnter(PHASE_EMIT);
+
+    snprintf(base, sizeof(base), "%s", !strcmp(srcPath, "-") ? "pl0" : p ? p + 1 : srcPath);
+    if ((dot = strrchr(base, '.')) != nullptr && dot != base)
+        *dot = '\0';
+
+    if (mkdir(splitDir, 0777) == -1 && errno != EEXIST)
+        compileError("couldn't create %s: %s", splitDir, strerror(errno));
+
+    emitFormatAll();
+
+    aOrder = malloc(nSegs * sizeof(*aOrder));
+    aUnitOf = calloc(nSegs, sizeof(*aUnitOf));
+    aLoad = calloc(nUnitsUsed, sizeof(*aLoad));
+    if (!aOrder || !aUnitOf || !aLoad)
+        LOG_FATAL("malloc failed");
+
+    for (size_t i = 1; i + 1 < nSegs; i++)
+        aOrder[i - 1] = &aSegs.pData[i];
+    qsort(aOrder, nSegs - 2, sizeof(*aOrder), segSizeCmp);
+
+    aLoad[0] = aSegs.pData[nSegs - 1].out.size;
+    for (size_t i = 0; i + 2 < nSegs; i++)
+    {
+        size_t u = 0;
+        for (size_t j = 1; j < nUnitsUsed; j++)
+            if (aLoad[j] < aLoad[u])
+                u = j;
+
+        aUnitOf[aOrder[i] - aSegs.pData] = u;
+        aLoad[u] += aOrder[i]->out.size;
+    }
+
+    fp = splitOpen(path, sizeof(path), base, ".h");
+    fprintf(fp, "#pragma once\n");
+    fwrite(aSegs.pData[0].out.pData, 1, aSegs.pData[0].out.size, fp);
+    fwrite(splitDecls.pData, 1, splitDecls.size, fp);
+    splitClose(fp, path);
+
+    for (size_t u = 0; u < nUnitsUsed; u++)
+    {
+        char suffix[32];
+
+        snprintf(suffix, sizeof(suffix), "_%zu.c", u);
+        fp = splitOpen(path, sizeof(path), base, suffix);
+        fprintf(fp, "%s#include \"%s.h\"\n\n", u == 0 ? "#define PL0RT_MAIN\n" : "", base);
+        for (size_t i = 1; i < nSegs; i++)
+        {
+            if (aUnitOf[i] == u)
+            {
+                fwrite(aSegs.pData[i].out.pData, 1, aSegs.pData[i].out.size, fp);
+                stats.nBytesOut += aSegs.pData[i].out.size;
+            }
+        }
+        splitClose(fp, path);
+    }
+
+    /* the generated C includes "include/pl0rt.h" from where pl0c ran */
+    fp = splitOpen(path, sizeof(path), "Makefile", "");
+    fprintf(fp, "# generated by pl0c %g from %s\n", PL0C_VERSION, srcPath);
+    fprintf(fp, "CFLAGS ?= -O2\n");
+    fprintf(fp, "CPPFLAGS ?= -I%s\n", getcwd(cwd, sizeof(cwd)) ? cwd : ".");
+    if (nForalls > 0 && !bInstrument)
+        fprintf(fp, "LDFLAGS ?= -pthread\n");
+    fprintf(fp, "OBJS =");
+    for (size_t u = 0; u < nUnitsUsed; u++)
+        fprintf(fp, " %s_%zu.o", base, u);
+    fprintf(fp, "\n\n");
+    fprintf(fp, "%s: $(OBJS)\n\t$(CC) $(LDFLAGS) -o $@ $(OBJS)\n\n", base);
+    fprintf(fp, "$(OBJS): %s.h\n\n", base);
+    fprintf(fp, ".c.o:\n\t$(CC) $(CFLAGS) $(CPPFLAGS) -c -o $@ $<\n\n");
+    fprintf(fp, "clean:\n\trm -f %s $(OBJS)\n", base);
+    splitClose(fp, path);
+
+    free(aOrder);
+    free(aUnitOf);
+    free(aLoad);
+
+    statsLeave(prev);
+}
+
+static void
+emitFree(void)
+{
+    for (size_t i = 0; i < aSegs.size; i++)
+        free(aSegs.pData[i].out.pData);
+    aSegs.size = 0;
+    emitRec.size = 0;
+}
+
+static void
+aout(const char* fmt, ...)
+{
+    va_list ap;
+
+    if (bBytecode)
+        return;
+
+    int prev = statsEnter(PHASE_EMIT);
+
+    va_start(ap, fmt);
+    if (pForallVar != nullptr)
+        bytesVprintf(&forallBody, fmt, ap);
+    else if (bDefer)
+        emitRecord(fmt, ap);
+    else
+        stats.nBytesOut += vfprintf(fpOut, fmt, ap);
+    va_end(ap);
+
+    statsLeave(prev);
+}
+
+static void
+loadProfile(const char* path)
+{
+    FILE* fp;
+    char kind[16], name[256];
+    long pline;
+    unsigned long long count, ticks;
+    int n;
+
+    if ((fp = fopen(path, "r")) == nullptr)
+        compileError("couldn't open profile %s", path);
+
+    profMap = ProfMapCreate(ADT_DEFAULT_SIZE);
+
+    fscanf(fp, "#%*[^\n]\n");
+    while ((n = fscanf(fp, "%15s %ld %255s %llu %llu\n", kind, &pline, name, &count, &ticks)) == 5)
+    {
+        if (strcmp(kind, "proc") != 0)
+            continue;
+
+        if (!strcmp(name, "main"))
+            profTotalTicks = ticks;
+
+        ProfEntry e = {.name = name};
+        ProfMapReturnNode f = ProfMapSearch(&profMap, e);
+        if (f.pData)
+        {
+            /* the same name twice means an edited program, keep the larger */
+            if (ticks > f.pData->ticks)
+                f.pData->ticks = ticks, f.pData->count = count;
+            continue;
+        }
+
+        ProfMapInsert(&profMap, (ProfEntry){.name = strdup(name), .count = count, .ticks = ticks});
+    }
+
+    if (n != EOF)
+        compileError("malformed profile %s", path);
+
+    fclose(fp);
+}
+
+static bool
+procHot(const ProcBuf* pb)
+{
+    return pb->pProf && profTotalTicks > 0 && pb->pProf->ticks * 100 >= profTotalTicks * PGO_HOT_PERCENT;
+}
+
+static bool
+procCold(const ProcBuf* pb)
+{
+    return pb->pProf && pb->pProf->count == 0;
+}
+
+/* hot procedures first, hottest first, then the ones without a verdict, then cold ones */
+static int
+procBufCmp(const void* p0, const void* p1)
+{
+    const ProcBuf* a = p0;
+    const ProcBuf* b = p1;
+    int ra = procHot(a) ? 0 : procCold(a) ? 2 : 1;
+    int rb = procHot(b) ? 0 : procCold(b) ? 2 : 1;
+
+    if (ra != rb)
+        return ra - rb;
+
+    if (ra == 0 && a->pProf->ticks != b->pProf->ticks)
+        return a->pProf->ticks > b->pProf->ticks ? -1 : 1;
+
+    return a->idx < b->idx ? -1 : a->idx > b->idx;
+}
+
+/* what goes before the return type */
+static const char*
+procDecl(const ProcBuf* pb)
+{
+    if (procHot(pb))
+    {
+        /* leaves can't recurse, so forcing them inline is always possible */
+        if (pb->bLeaf && pb->size <= PGO_INLINE_MAX_BYTES)
+            return "static inline __attribute__((hot, always_inline)) ";
+        return "__attribute__((hot)) ";
+    }
+
+    if (procCold(pb))
+        return "__attribute__((cold, noinline)) ";
+
+    return "";
+}
+
+/* prototypes and bodies of all procedures, laid out by their profile */
+static void
+cgProcedures(void)
+{
+    for (size_t i = 0; i < aProcBufs.size; i++)
+    {
+        ProcBuf* pb = &aProcBufs.pData[i];
+        ProfMapReturnNode f = ProfMapSearch(&profMap, (ProfEntry){.name = pb->name});
+        pb->pProf = f.pData;
+    }
+
+    for (size_t i = 0; i < aProcBufs.size; i++)
+    {
+        ProcBuf* pb = &aProcBufs.pData[i];
+        aout("%s%s %s(%s);\n", procDecl(pb), pb->type, pb->name, pb->params);
+    }
+    aout("\n");
+
+    qsort(aProcBufs.pData, aProcBufs.size, sizeof(ProcBuf), procBufCmp);
+
+    for (size_t i = 0; i < aProcBufs.size; i++)
+    {
+        ProcBuf* pb = &aProcBufs.pData[i];
+
+        aout("%s%s\n", procDecl(pb), pb->type);
+        aout("%s(%s)\n", pb->name, pb->params);
+        fwrite(pb->pBuf, 1, pb->size, fpOut);
+        stats.nBytesOut += pb->size;
+    }
+}
+
+static void cgProfile(void);
+
+static void
+cgEnd(void)
+{
+    if (bInstrument)
+        cgProfile();
+
+    /* --instrument runs foralls in order, its counters aren't atomic */
+    if (nForalls > 0 && !bInstrument)
+        aout("\n#include \"include/pl0par.h\"\n");
+
+    aout("\n/* PL/0 compiler %g */\n", PL0C_VERSION);
+}
+
+static void
+cgSemicolon(void)
+{
+    aout(";\n");
+}
+
+static void
+cgSymbol(void)
+{
+    switch (type)
+    {
+        case TOK_NUMBER:
+            aout("%s", token);
+            break;
+
+        case TOK_BEGIN:
+            aout("{\n");
+            break;
+
+        case TOK_END:
+            aout(";\n}\n");
+            break;
+
+        case TOK_IF:
+            aout("if(");
+            break;
+
+        case TOK_THEN:
+        case TOK_DO:
+            aout(")");
+            break;
+
+        case TOK_ODD:
+            aout("(");
+            break;
+
+        case TOK_WHILE:
+            aout("while (");
+            break;
+
+        case TOK_EQUAL:
+            aout("==");
+            break;
+
+        case TOK_COMMA:
+            aout(",");
+            break;
+
+        case TOK_ASSIGN:
+            aout("=");
+            break;
+
+        case TOK_HASH:
+            aout("!=");
+            break;
+
+        case TOK_LESSTHAN:
+            aout("<");
+            break;
+
+        case TOK_GREATERTHAN:
+            aout(">");
+            break;
+
+        case TOK_PLUS:
+            aout("+");
+            break;
+
+        case TOK_MINUS:
+            aout("-");
+            break;
+
+        case TOK_MULTIPLY:
+            aout("*");
+            break;
+
+        case TOK_DIVIDE:
+            aout("/");
+            break;
+
+        case TOK_LPAREN:
+            aout("(");
+            break;
+
+        case TOK_RPAREN:
+            aout(")");
+            break;
+
+        case TOK_LBRACK:
+            aout("[");
+            break;
+
+        case TOK_RBRACK:
+            aout("]");
+            break;
+    }
+}
+
+/* the level of the scope being compiled: 0 for main, 1 for the procedures it declares, and so on */
+int
+scopeLevel(void)
+{
+    return depth - 1;
+}
+
+/*
+ * Variable `pSym` in C: a procedure that declares procedures keeps its
+ * variables in the struct __fr, and the procedures inside reach them
+ * through the display, one pointer per enclosing procedure that the
+ * callers pass along.  An enclosing procedure's constant is its value.
+ */
+static const char*
+cgRef(const SymListNode* pSym)
+{
+    const SymNode* pn = &pSym->data;
+
+    refBuf.size = 0;
+
+    /* a forall body has the variables it uses under their names, see cgForallEnd() */
+    if (pForallVar != nullptr)
+    {
+        if (pn->type == TOK_CONST && pn->depth != 0)
+            bytesPrintf(&refBuf, "%ld", pn->value);
+        else
+            bytesPrintf(&refBuf, "%s", pn->name);
+    }
+    else if (pn->depth == 0 || (pn->depth == scopeLevel() && !pProcSym->data.bFrame))
+        bytesPrintf(&refBuf, "%s", pn->name);
+    else if (pn->type == TOK_CONST)
+        bytesPrintf(&refBuf, "%ld", pn->value);
+    else if (pn->depth == scopeLevel())
+        bytesPrintf(&refBuf, "__fr.%s", pn->name);
+    else
+        bytesPrintf(&refBuf, "__d%d->%s", pn->depth, pn->name);
+
+    return refBuf.pData;
+}
+
+/* an identifier in an expression or on the left of an assignment */
+static void
+cgIdent(const SymListNode* pSym)
+{
+    for (size_t i = 0; i < aLoops.size; i++)
+    {
+        if (aLoops.pData[i].pVar == pSym)
+        {
+            aout("__iv_%s", pSym->data.name);
+            return;
+        }
+    }
+
+    aout("%s", cgRef(pSym));
+}
+
+/*
+ * The constants and variables of the scope being compiled, before its
+ * first statement.  --split puts global constants in the header, every
+ * unit gets its own, and declares global variables there, see
+ * cgProcedure().  A procedure with a frame copies its parameters in.
+ * A procedure's tail calls of itself start over before its declarations,
+ * see cgTail().
+ */
+static void
+cgDecls(void)
+{
+    const SymListNode* it = proc == 0 ? symtab.pFirst->pNext : pProcSym->pNext;
+    bool bFrame = proc != 0 && pProcSym->data.bFrame;
+    bool bMain = proc == 0 && splitDir;
+    bool bVars = bFrame;
+    int nParams = proc == 0 ? 0 : pProcSym->data.nParams;
+
+    if (proc != 0)
+        aout("__tail: __attribute__((unused));\n");
+    if (bFrame)
+        aout("struct __frame_%s __fr;\n", procCName(&pProcSym->data));
+
+    for (; it != nullptr && it->data.type != TOK_PROCEDURE; it = it->pNext)
+    {
+        const SymNode* pn = &it->data;
+
+        if (pn->type == TOK_CONST)
+        {
+            aout("%sconst long %s = %ld;\n", bMain ? "static " : "", pn->name, pn->value);
+        }
+        else if (nParams > 0)
+        {
+            --nParams;
+            if (bFrame)
+                aout("__fr.%s=%s;\n", pn->name, pn->name);
+        }
+        else if (!bFrame)
+        {
+            aout("%slong %s", bMain ? "extern " : "", pn->name);
+            if (pn->size > 0)
+                aout("[%ld]", pn->size);
+            aout(";\n");
+            bVars = true;
+        }
+    }
+
+    if (bVars)
+        aout("\n");
+}
+
+/* procedure `pProc`'s frame, before the first procedure declared in it */
+static void
+cgFrame(const SymListNode* pProc)
+{
+    Bytes b = {};
+
+    bytesPrintf(&b, "struct __frame_%s\n{\n", procCName(&pProc->data));
+    for (const SymListNode* it = pProc->pNext; it != nullptr; it = it->pNext)
+    {
+        if (it->data.type != TOK_VAR)
+            continue;
+        if (it->data.size > 0)
+            bytesPrintf(&b, "long %s[%ld];\n", it->data.name, it->data.size);
+        else
+            bytesPrintf(&b, "long %s;\n", it->data.name);
+    }
+    bytesPrintf(&b, "};\n\n");
+
+    if (splitDir)
+    {
+        bytesPut(&splitDecls, b.pData, b.size);
+    }
+    else
+    {
+        aout("%s", b.pData);
+
+        /* emitted after the procedures inside, which may call it */
+        if (!bPgo)
+            aout("%s %s(%s);\n\n", procType(&pProc->data), procCName(&pProc->data), procParams(&pProc->data));
+    }
+
+    free(b.pData);
+}
+
+static size_t
+profSite(int kind, const char* name)
+{
+    ArrProfPush(&aProfSites, (ProfSite){.kind = kind, .line = line, .name = strdup(name)});
+    return aProfSites.size - 1;
+}
+
+static const char*
+profProcName(void)
+{
+    return aProfSites.pData[aProfProcs.pData[aProfProcs.size - 1]].name;
+}
+
+static void cgProcedures(void);
+
+static void
+cgProcedure(void)
+{
+    emitSplit();
+
+    if (proc == 0)
+    {
+        if (bPgo)
+            cgProcedures();
+
+        if (splitDir)
+        {
+            LIST_FOREACH(&symtab, it)
+            {
+                if (it->data.depth != 0 || it->data.type != TOK_VAR)
+                    continue;
+                if (it->data.size > 0)
+                    aout("long %s[%ld];\n", it->data.name, it->data.size);
+                else
+                    aout("long %s;\n", it->data.name);
+            }
+            aout("\n");
+        }
+
+        aout("int\n");
+        aout("main(int argc, char* argv[])\n");
+    }
+    else if (bPgo)
+    {
+        const SymNode* pn = &pProcSym->data;
+        ProcBuf pb = {.name = strdup(procCName(pn)), .idx = aProcBufs.size, .bLeaf = true, .type = procType(pn),
+                      .params = strdup(procParams(pn))};
+        ArrProcBufPush(&aProcBufs, pb);
+
+        if ((fpOut = open_memstream(&aProcBufs.pData[pb.idx].pBuf, &aProcBufs.pData[pb.idx].size)) == nullptr)
+            LOG_FATAL("open_memstream failed");
+    }
+    else
+    {
+        aout("%s\n", procType(&pProcSym->data));
+        aout("%s(%s)\n", procCName(&pProcSym->data), procParams(&pProcSym->data));
+    }
+
+    if (splitDir && proc != 0)
+        bytesPrintf(&splitDecls, "%s %s(%s);\n", procType(&pProcSym->data), procCName(&pProcSym->data),
+                    procParams(&pProcSym->data));
+
+    aout("{\n");
+    if (proc == 0)
+        aout("atexit(__pl0_flush);\n");
+
+    if (bInstrument)
+    {
+        size_t site = profSite(PROF_PROC, proc == 0 ? "main" : procCName(&pProcSym->data));
+        ArrSizePush(&aProfProcs, site);
+
+        if (proc == 0)
+            aout("atexit(__profdump);\n");
+        aout("unsigned long long __t=__prof[%zu].depth++?0:__tsc();__prof[%zu].count++;\n", site, site);
+    }
+
+    if (proc != 0)
+        cgDecls();
+}
+
+/*
+ * After a procedure with a cache, see effEnd(): the function its callers
+ * call instead.  It looks the parameters and the globals the procedure
+ * depends on up in a table of PL0RT_MEMO_SLOTS results, and only calls it
+ * when they aren't there.  A result is the return value and the globals
+ * the procedure assigns.
+ */
+static void
+cgMemo(void)
+{
+    const SymNode* pn = &pProcSym->data;
+    const Effects* pe = pn->pEff;
+    const SymListNode* it = pProcSym->pNext;
+    size_t nIn = pn->nParams + pe->aInputs.size;
+    size_t nOut = pn->bResult + pe->aWrites.size;
+    const char* sep = "";
+    Bytes b = {};
+    char* name;
+
+    bytesPrintf(&b, "{\nstatic struct __memo{bool b;");
+    if (nIn > 0)
+        bytesPrintf(&b, "long k[%zu];", nIn);
+    if (nOut > 0)
+        bytesPrintf(&b, "long o[%zu];", nOut);
+    bytesPrintf(&b, "}__m[PL0RT_MEMO_SLOTS];\n");
+
+    if (nIn > 0)
+    {
+        bytesPrintf(&b, "const long __k[]={");
+        for (int i = 0; i < pn->nParams; i++, it = it->pNext, sep = ",")
+            bytesPrintf(&b, "%s%s", sep, it->data.name);
+        for (size_t i = 0; i < pe->aInputs.size; i++, sep = ",")
+            bytesPrintf(&b, "%s%s", sep, pe->aInputs.pData[i]->data.name);
+        bytesPrintf(&b, "};\nstruct __memo* __e=&__m[__pl0_memohash(__k,%zu)];\n", nIn);
+        bytesPrintf(&b, "if(__e->b&&!memcmp(__e->k,__k,sizeof(__k))){");
+    }
+    else
+    {
+        bytesPrintf(&b, "struct __memo* __e=&__m[0];\nif(__e->b){");
+    }
+    for (size_t i = 0; i < pe->aWrites.size; i++)
+        bytesPrintf(&b, "%s=__e->o[%zu];", pe->aWrites.pData[i]->data.name, pn->bResult + i);
+    bytesPrintf(&b, pn->bResult ? "return __e->o[0];}\n" : "return;}\n");
+
+    bytesPrintf(&b, pn->bResult ? "long __r=%s(" : "%s(", pn->name);
+    it = pProcSym->pNext;
+    sep = "";
+    for (int i = 0; i < pn->nParams; i++, it = it->pNext, sep = ",")
+        bytesPrintf(&b, "%s%s", sep, it->data.name);
+    bytesPrintf(&b, ");\n__e->b=true;");
+    if (nIn > 0)
+        bytesPrintf(&b, "memcpy(__e->k,__k,sizeof(__k));");
+    if (pn->bResult)
+        bytesPrintf(&b, "__e->o[0]=__r;");
+    for (size_t i = 0; i < pe->aWrites.size; i++)
+        bytesPrintf(&b, "__e->o[%zu]=%s;", pn->bResult + i, pe->aWrites.pData[i]->data.name);
+    bytesPrintf(&b, pn->bResult ? "\nreturn __r;\n}\n\n" : "\n}\n\n");
+
+    if (splitDir)
+        bytesPrintf(&splitDecls, "%s __memo_%s(%s);\n", procType(pn), pn->name, procParams(pn));
+
+    if (bPgo)
+    {
+        /* a procedure of its own, which needs a prototype like the others */
+        size_t size = strlen(pn->name) + sizeof("__memo_");
+
+        if ((name = malloc(size)) == nullptr)
+            LOG_FATAL("malloc failed");
+        snprintf(name, size, "__memo_%s", pn->name);
+        ArrProcBufPush(&aProcBufs, (ProcBuf){.name = name, .pBuf = b.pData, .size = b.size, .idx = aProcBufs.size,
+                                             .type = procType(pn), .params = strdup(procParams(pn))});
+        return;
+    }
+
+    aout("%s\n", procType(pn));
+    aout("__memo_%s(%s)\n", pn->name, procParams(pn));
+    aout("%s", b.pData);
+    free(b.pData);
+}
+
+/* on the way out of a procedure: the outermost activation adds its ticks */
+static void
+cgProcTicks(size_t site)
+{
+    aout("if(--__prof[%zu].depth==0)__prof[%zu].ticks+=__tsc()-__t;", site, site);
+}
+
+static void
+cgEpilogue(void)
+{
+    aout(";");
+    if (bInstrument)
+        cgProcTicks(*ArrSizePop(&aProfProcs));
+    if (proc == 0 || pProcSym->data.bResult)
+        aout("return 0;");
+    aout("\n}\n\n");
+
+    if (forallFns.size > 0)
+    {
+        aout("%s", forallFns.pData);
+        forallFns.size = 0;
+    }
+
+    if (bPgo && proc != 0)
+    {
+        fclose(fpOut);
+        fpOut = fpUnit;
+    }
+
+    if (proc != 0 && pProcSym->data.bMemo)
+        cgMemo();
+}
+
+/* a call of `pSym` up to its arguments */
+static void
+cgCall(const SymListNode* pSym)
+{
+    if (bPgo && fpOut != fpUnit)
+        aProcBufs.pData[aProcBufs.size - 1].bLeaf = false;
+
+    if (bInstrument)
+        aout("(__prof[%zu].count++,", profSite(PROF_CALL, procCName(&pSym->data)));
+    aout(pSym->data.bMemo ? "__memo_%s(" : "%s(", procCName(&pSym->data));
+}
+
+/* after `nArgs` arguments of `pSym`: the display, the caller's own frame or the one it was given */
+static void
+cgCallEnd(const SymListNode* pSym, bool bValue, int nArgs)
+{
+    for (long d = 1; d <= pSym->data.depth; d++)
+    {
+        aout(nArgs > 0 || d > 1 ? "," : "");
+        if (d == scopeLevel())
+            aout("&__fr");
+        else
+            aout("__d%ld", d);
+    }
+
+    /* one expression, also where a statement after "if" or "do" must be one */
+    aout(bInstrument ? "))" : ")");
+    if (!bValue)
+        aout(";\n");
+}
+
+/* a call of `pSym`, the procedure being compiled, that ends it, up to its arguments */
+static void
+cgTail(const SymListNode* pSym)
+{
+    aout("{");
+    if (bInstrument)
+        aout("__prof[%zu].count++;__prof[%zu].count++;", profSite(PROF_CALL, procCName(&pSym->data)),
+             aProfProcs.pData[aProfProcs.size - 1]);
+    if (pSym->data.nParams > 0)
+        aout("const long __a[]={");
+}
+
+/* after them: they become its parameters, and it starts over rather than taking another C frame */
+static void
+cgTailEnd(const SymListNode* pSym)
+{
+    const SymListNode* it = pSym->pNext;
+
+    if (pSym->data.nParams > 0)
+        aout("};");
+    for (size_t i = 0; i < (size_t)pSym->data.nParams; i++, it = it->pNext)
+        aout("%s=__a[%zu];", it->data.name, i);
+    aout("goto __tail;}\n");
+}
+
+/* "return" up to the expression, which --instrument has to time before */
+static void
+cgReturn(void)
+{
+    if (bInstrument)
+        aout("{long __r=");
+    else
+        aout("return ");
+}
+
+static void
+cgReturnEnd(void)
+{
+    if (bInstrument)
+    {
+        aout(";");
+        cgProcTicks(aProfProcs.pData[aProfProcs.size - 1]);
+        aout("return __r;}");
+    }
+}
+
+/* before "while", returns the loop's site for cgDo() and cgWhileEnd() */
+static size_t
+cgWhile(void)
+{
+    if (!bInstrument)
+        return 0;
+
+    size_t site = profSite(PROF_LOOP, profProcName());
+    aout("{unsigned long long __t%zu=__tsc();\n", site);
+
+    return site;
+}
+
+/* before the loop of aLoops' top, which runs on the local copy */
+static void
+cgFor(void)
+{
+    const SymListNode* pVar = aLoops.pData[aLoops.size - 1].pVar;
+
+    aout("{long __iv_%s=%s;\n", pVar->data.name, cgRef(pVar));
+}
+
+/* in place of "while (", after the hint that has C compilers unroll the loop with --unroll */
+static void
+cgForHead(void)
+{
+    if (unroll > 1)
+        aout("#pragma GCC unroll %zu\n", unroll);
+    aout("for (;");
+}
+
+/* in place of the ")" before the body */
+static void
+cgForStep(void)
+{
+    const CountedLoop* pl = &aLoops.pData[aLoops.size - 1];
+
+    aout(";__iv_%s+=%ld)", pl->pVar->data.name, pl->step);
+}
+
+static void
+cgForEnd(void)
+{
+    const SymListNode* pVar = ArrCountedLoopPop(&aLoops)->pVar;
+
+    aout("%s=__iv_%s;}\n", cgRef(pVar), pVar->data.name);
+}
+
+static void
+cgDo(size_t site)
+{
+    if (bInstrument)
+        aout("{__prof[%zu].count++;\n", site);
+}
+
+static void
+cgWhileEnd(size_t site)
+{
+    if (bInstrument)
+        aout(";}__prof[%zu].ticks+=__tsc()-__t%zu;}\n", site, site);
+}
+
+/* before the bounds of forall `idx` */
+static void
+cgForall(size_t idx)
+{
+    aout("{long __lo%zu=", idx);
+}
+
+static void
+cgForallTo(size_t idx)
+{
+    aout(",__hi%zu=", idx);
+}
+
+/* from here the C goes to forallBody, for the loop over `pVar` that becomes a function, see forallBegin() */
+static void
+cgForallDivert(const SymListNode* pVar, bool bAuto)
+{
+    forallBegin(pVar, bAuto);
+    forallLoops = aLoops.size;
+    forallBody.size = 0;
+    bytesPrintf(&forallBody, "%s", "");
+}
+
+/*
+ * Before the body.  The body of the outermost forall becomes a function
+ * that runs a chunk of its iterations, an inner forall is a loop in it.
+ */
+static void
+cgForallDo(const SymListNode* pVar, size_t idx)
+{
+    aout(";\n");
+
+    if (pForallVar != nullptr)
+        aout("for(%s=__lo%zu;%s<=__hi%zu;%s++)\n", pVar->data.name, idx, pVar->data.name, idx, pVar->data.name);
+    else
+        cgForallDivert(pVar, false);
+}
+
+/* whether `pSym` is the variable of a counted loop around the forall, which reads the loop's copy */
+static bool
+forallLoopVar(const SymListNode* pSym)
+{
+    for (size_t i = 0; i < forallLoops; i++)
+    {
+        if (aLoops.pData[i].pVar == pSym)
+            return true;
+    }
+
+    return false;
+}
+
+/* whether `pv` is passed to the function of the body, rather than a global it uses directly */
+static bool
+forallCaptured(const ForallVar* pv)
+{
+    return pv->pSym->data.depth != 0 || (pv->use != FORALL_READ && pv->use != FORALL_ARRAY) ||
+           forallLoopVar(pv->pSym);
+}
+
+/*
+ * Function __pl0_forall_`idx` runs `body` for `var` from __lo to __hi.  It
+ * gets scalars it reads as values and arrays as pointers, in __c`idx`, and
+ * has its own copy of the scalars it assigns, which the chunk with the last
+ * iterations writes back.  A reduction starts from nothing in each chunk,
+ * which then adds its part.
+ */
+static void
+cgForallFn(size_t idx, const char* var, const char* body)
+{
+    static const char* aReduceInit[] = {[FORALL_SUM] = "0", [FORALL_MIN] = "LONG_MAX", [FORALL_MAX] = "LONG_MIN"};
+    static const char* aReduceOp[] = {[FORALL_SUM] = "'+'", [FORALL_MIN] = "'<'", [FORALL_MAX] = "'>'"};
+    size_t n = 0;
+
+    bytesPrintf(&forallFns, "void\n__pl0_forall_%zu(long __lo, long __hi, bool __last, void** __c)\n{\n", idx);
+    for (size_t i = 0; i < aForallVars.size; i++)
+    {
+        const ForallVar* pv = &aForallVars.pData[i];
+        const char* name = pv->pSym->data.name;
+
+        if (!forallCaptured(pv))
+            continue;
+
+        if (pv->use == FORALL_READ)
+            bytesPrintf(&forallFns, "const long %s%s=*(long*)__c[%zu];\n", forallLoopVar(pv->pSym) ? "__iv_" : "",
+                        name, n);
+        else if (pv->use == FORALL_ARRAY)
+            bytesPrintf(&forallFns, "long* const %s=__c[%zu];\n", name, n);
+        else if (pv->use == FORALL_PRIVATE)
+            bytesPrintf(&forallFns, "long %s;\n", name);
+        else
+            bytesPrintf(&forallFns, "long %s=%s;\n", name, aReduceInit[pv->use]);
+        ++n;
+    }
+    bytesPrintf(&forallFns, "for (long %s=__lo;%s<=__hi;%s++)\n{\n%s;\n}\n", var, var, var, body);
+
+    n = 0;
+    for (size_t i = 0; i < aForallVars.size; i++)
+    {
+        const ForallVar* pv = &aForallVars.pData[i];
+        const char* name = pv->pSym->data.name;
+
+        if (!forallCaptured(pv))
+            continue;
+
+        /* --instrument runs the function alone, without pl0par.h */
+        if (pv->use == FORALL_PRIVATE)
+            bytesPrintf(&forallFns, "if(__last)*(long*)__c[%zu]=%s;\n", n, name);
+        else if (pv->use == FORALL_SUM && bInstrument)
+            bytesPrintf(&forallFns, "*(long*)__c[%zu]+=%s;\n", n, name);
+        else if (pv->use != FORALL_READ && pv->use != FORALL_ARRAY && bInstrument)
+            bytesPrintf(&forallFns, "if(%s%s*(long*)__c[%zu])*(long*)__c[%zu]=%s;\n", name,
+                        pv->use == FORALL_MIN ? "<" : ">", n, n, name);
+        else if (pv->use != FORALL_READ && pv->use != FORALL_ARRAY)
+            bytesPrintf(&forallFns, "__pl0_reduce(__c[%zu],%s,%s);\n", n, name, aReduceOp[pv->use]);
+        ++n;
+    }
+    bytesPrintf(&forallFns, "}\n\n");
+
+    aout("void __pl0_forall_%zu(long,long,bool,void**);\n", idx);
+    aout("void* __c%zu[]={", idx);
+    for (size_t i = 0; i < aForallVars.size; i++)
+    {
+        const ForallVar* pv = &aForallVars.pData[i];
+
+        if (forallLoopVar(pv->pSym))
+            aout("&__iv_%s,", pv->pSym->data.name);
+        else if (forallCaptured(pv))
+            aout("%s%s,", pv->use == FORALL_ARRAY ? "" : "&", cgRef(pv->pSym));
+    }
+    aout("0};\n");
+}
+
+/* after the body; the loop leaves its variable where the same loop in order would */
+static void
+cgForallEnd(const SymListNode* pVar, size_t idx)
+{
+    if (pForallVar != pVar)
+    {
+        aout(";}\n");
+        return;
+    }
+
+    forallFinish();
+    cgForallFn(idx, pVar->data.name, forallBody.pData);
+
+    if (bInstrument)
+        aout("if(__lo%zu<=__hi%zu)__pl0_forall_%zu(__lo%zu,__hi%zu,1,__c%zu);\n", idx, idx, idx, idx, idx, idx);
+    else
+        aout("__pl0_forall(__lo%zu,__hi%zu,__pl0_forall_%zu,__c%zu);\n", idx, idx, idx, idx);
+    aout("%s=__lo%zu<=__hi%zu?__hi%zu+1:__lo%zu;}\n", cgRef(pVar), idx, idx, idx, idx);
+}
+
+/*
+ * With --parallel, a counted loop whose iterations don't depend on each
+ * other, which the parser finds out as it goes, see loopParallel().  Its
+ * C, from the for on, goes to forallBody until then.
+ */
+static void
+cgParallel(void)
+{
+    cgForallDivert(aLoops.pData[aLoops.size - 1].pVar, true);
+    forallLoops = aLoops.size - 1;
+}
+
+/* before its body */
+static void
+cgParallelDo(void)
+{
+    forallHead = forallBody.size;
+}
+
+/* after it: the for as it was, or a function the iterations are spread over */
+static void
+cgParallelEnd(void)
+{
+    const CountedLoop* pl = &aLoops.pData[aLoops.size - 1];
+    const char* name = pl->pVar->data.name;
+    char var[STREAM_TOKEN_MAX + 8], bound[STREAM_TOKEN_MAX + 32];
+    size_t idx;
+
+    if (!forallFinish())
+    {
+        aout("%s", forallBody.pData);
+        return;
+    }
+
+    idx = nForalls++;
+    snprintf(var, sizeof(var), "__iv_%s", name);
+    if (pl->pBound != nullptr)
+        snprintf(bound, sizeof(bound), "%s", cgRef(pl->pBound));
+    else
+        snprintf(bound, sizeof(bound), "%ld", pl->bound);
+
+    cgForallFn(idx, var, forallBody.pData + forallHead);
+    aout("if(%s<%s){__pl0_forall(%s,%s-1,__pl0_forall_%zu,__c%zu);%s=%s;}\n", var, bound, var, bound, idx, idx,
+         var, bound);
+}
+
+static void
+cgOdd(void)
+{
+    aout(")&1");
+}
+
+/* of `pSym`, nullptr for the number in token */
+static void
+cgWriteChar(const SymListNode* pSym)
+{
+    aout("__pl0_writechar(");
+    if (pSym != nullptr)
+        cgIdent(pSym);
+    else
+        aout("%s", token);
+    aout(");");
+}
+
+static void
+cgWriteInt(const SymListNode* pSym)
+{
+    aout("__pl0_writeint(");
+    if (pSym != nullptr)
+        cgIdent(pSym);
+    else
+        aout("%s", token);
+    aout(");");
+}
+
+static void
+cgInit(void)
+{
+    /* with --split, the unit holding main defines PL0RT_MAIN, see emitUnits() */
+    if (!splitDir)
+        aout("#define PL0RT_MAIN\n");
+    aout("#include <stdio.h>\n");
+    aout("#include \"include/pl0rt.h\"\n\n");
+    aout("static long __writestridx;\n\n");
+
+    if (bInstrument)
+    {
+        aout("#if defined(__x86_64__) || defined(__i386__)\n");
+        aout("#include <x86intrin.h>\n");
+        aout("#define __tsc() __rdtsc()\n");
+        aout("#else\n");
+        aout("#include <time.h>\n");
+        aout("static unsigned long long __tsc(void)");
+        aout("{struct timespec ts;clock_gettime(CLOCK_MONOTONIC,&ts);");
+        aout("return ts.tv_sec*1000000000ull+ts.tv_nsec;}\n");
+        aout("#endif\n");
+        aout("struct __prof{const char*kind;long line;const char*name;");
+        aout("unsigned long long count,ticks;unsigned long depth;};\n");
+        aout("extern struct __prof __prof[];\n");
+        aout("static void __profdump(void);\n\n");
+    }
+}
+
+/* the profile table, and its dump to $PL0PROF (pl0prof.out) at exit */
+static void
+cgProfile(void)
+{
+    aout("\nstruct __prof __prof[%zu]={\n", aProfSites.size);
+    for (size_t i = 0; i < aProfSites.size; i++)
+    {
+        ProfSite* ps = &aProfSites.pData[i];
+        aout("{\"%s\",%zu,\"%s\"},\n", profStrings[ps->kind], ps->line, ps->name);
+    }
+    aout("};\n\n");
+
+    aout("static void\n");
+    aout("__profdump(void)\n");
+    aout("{\n");
+    aout("const char*path=getenv(\"PL0PROF\");\n");
+    aout("FILE*fp=fopen(path?path:\"pl0prof.out\",\"w\");\n");
+    aout("if(fp==NULL)return;\n");
+    aout("(void)fprintf(fp,\"# pl0 profile: kind line name count ticks\\n\");\n");
+    aout("for(unsigned long i=0;i<sizeof(__prof)/sizeof(__prof[0]);i++)\n");
+    aout("(void)fprintf(fp,\"%%s %%ld %%s %%llu %%llu\\n\",__prof[i].kind,__prof[i].line,");
+    aout("__prof[i].name,__prof[i].count,__prof[i].ticks);\n");
+    aout("(void)fclose(fp);\n");
+    aout("}\n");
+}
+
+static void
+cgReadChar(const SymListNode* pSym)
+{
+    aout("%s=__pl0_readchar();", cgRef(pSym));
+}
+
+static void
+cgReadInt(const SymListNode* pSym)
+{
+    aout("%s=__pl0_readint();", cgRef(pSym));
+}
+
+static void
+cgBoundsCheck(void)
+{
+    aout("__pl0_index(");
+}
+
+static void
+cgBoundsEnd(long size, size_t checkLine)
+{
+    aout(",%ld,%zu)", size, checkLine);
+}
+
+static void
+cgWriteStr(void)
+{
+    SymListNode* ret;
+
+    if (type == TOK_IDENT)
+    {
+        int prev = statsEnter(PHASE_SYM);
+        ret = symLookup(token);
+        statsLeave(prev);
+
+        if (!ret)
+            compileError("undefined symbol: '%s'", token);
+
+        if (ret->data.size == 0)
+            compileError("writeStr requires an array");
+
+        aout("__writestridx = 0;\n");
+        aout("while(%s[__writestridx]!='\\0'&&__writestridx<%ld)\n", cgRef(ret), ret->data.size);
+        aout("__pl0_writechar(%s[__writestridx++]);\n", cgRef(ret));
+    }
+    else
+    {
+        aout("__pl0_writestr(%s);\n", token);
+    }
+}
+
+/* with --bytecode, the module bcgen.c built, or an executable of it */
+static void
+moduleWrite(void)
+{
+    Pl0bHeader header;
+    Pl0bModule mod;
+
+    if (!bBytecode)
+        return;
+
+    mod = bcModule(&header);
+
+    int prev = statsEnter(PHASE_EMIT);
+    if (bExecutable)
+    {
+        size_t size = exeWrite(fpUnit, &mod);
+
+        if (size == 0)
+            compileError("an executable needs an x86-64 host, and frames and globals that fit 32-bit addresses");
+        stats.nBytesOut += size;
+    }
+    else
+    {
+        stats.nBytesOut += pl0bWrite(fpUnit, &mod, header.nGlobals, header.mainProc);
+    }
+    statsLeave(prev);
+}
+
+/* Compile-time evaluation */
+
+/* one of main's statements starts here */
+static void
+evalMark(void)
+{
+    if (evalSteps)
+        ArrEvalMarkPush(&aMarks, (EvalMark){.pc = bcLabel(), .rec = emitRec.size});
+}
+
+/* writes `n` bytes of output, as one string literal over several lines */
+static void
+evalOutput(const char* p, size_t n)
+{
+    char buf[4 * 64 + 1];
+
+    if (n == 0)
+        return;
+
+    aout("__pl0_writebytes(");
+    for (size_t i = 0; i < n;)
+    {
+        char* q = buf;
+
+        for (size_t end = i + 64 < n ? i + 64 : n; i < end; i++)
+        {
+            unsigned char c = p[i];
+
+            if (c == '\n')
+                q += sprintf(q, "\\n");
+            else if (c == '"' || c == '\\')
+                q += sprintf(q, "\\%c", c);
+            else if (c >= ' ' && c <= '~')
+                *q++ = c;
+            else
+                q += sprintf(q, "\\%03o", c);
+        }
+        *q = '\0';
+
+        aout("\n\"%s\"", buf);
+    }
+    aout(", %zu);\n", n);
+}
+
+static void
+evalValue(long v)
+{
+    if (v == LONG_MIN)
+        aout("(-%ld-1)", LONG_MAX);
+    else
+        aout("%ld", v);
+}
+
+/* assigns the globals of `pMod` that `aGlobals` doesn't have at 0, false if there are too many of them */
+static bool
+evalState(const Pl0bModule* pMod, const long* aGlobals)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < pMod->pHeader->nGlobals; i++)
+        n += aGlobals[i] != 0;
+    if (n > EVAL_MAX_SLOTS)
+        return false;
+
+    for (size_t i = 0; i < pMod->nSymbols; i++)
+    {
+        const Pl0bSymbol* ps = &pMod->aSymbols[i];
+        const char* name = pMod->pStrings + ps->name;
+
+        if (ps->depth != 0 || (ps->kind != PL0B_SYM_VAR && ps->kind != PL0B_SYM_ARRAY))
+            continue;
+
+        if (ps->kind == PL0B_SYM_VAR && aGlobals[ps->slot] != 0)
+        {
+            aout("%s=", name);
+            evalValue(aGlobals[ps->slot]);
+            aout(";\n");
+        }
+
+        for (long j = 0; ps->kind == PL0B_SYM_ARRAY && j < ps->value; j++)
+        {
+            if (aGlobals[ps->slot + j] != 0)
+            {
+                aout("%s[%ld]=", name, j);
+                evalValue(aGlobals[ps->slot + j]);
+                aout(";\n");
+            }
+        }
+    }
+
+    return true;
+}
+
+/* puts what was recorded from `at` on in place of the records from `begin` to `end` */
+static void
+evalSplice(size_t begin, size_t end, size_t at)
+{
+    size_t n = emitRec.size - at;
+    char* p = malloc(n);
+
+    if (p == nullptr)
+        LOG_FATAL("malloc failed");
+
+    memcpy(p, emitRec.pData + at, n);
+    memmove(emitRec.pData + begin + n, emitRec.pData + end, at - end);
+    memcpy(emitRec.pData + begin, p, n);
+    emitRec.size = begin + n + (at - end);
+
+    free(p);
+}
+
+/*
+ * Runs the program as far as it goes without input, within the budget, and
+ * replaces what it got through with what that did: an ended program by one
+ * that writes its output, otherwise the statements of main that ran by
+ * assignments of the globals they left and their output.  Needs bDefer,
+ * main's statements are taken out of what aout() recorded.
+ */
+static void
+evaluate(void)
+{
+    Pl0bHeader header;
+    Pl0bModule mod;
+    VmEval ev = {.maxSteps = evalSteps, .maxOutput = EVAL_MAX_OUTPUT, .nMarks = aMarks.size};
+    VmOptions opts = {.pEval = &ev};
+    uint32_t* aPcs;
+
+    if (!evalSteps)
+        return;
+
+    int prev = statsEnter(PHASE_EVAL);
+
+    mod = bcModule(&header);
+    if ((aPcs = malloc((aMarks.size + 1) * sizeof(uint32_t))) == nullptr)
+        LOG_FATAL("malloc failed");
+    for (size_t i = 0; i < aMarks.size; i++)
+        aPcs[i] = aMarks.pData[i].pc;
+    ev.aMarks = aPcs;
+
+    vmRun(&mod, &opts);
+
+    stats.evalStatus = ev.status;
+    stats.nEvalDone = ev.mark;
+    stats.nEvalStmts = aMarks.size;
+
+    if (ev.status == VM_DONE)
+    {
+        emitFree();
+        emitSplit();
+        nForalls = 0;
+        cgInit();
+        aout("int\n");
+        aout("main(int argc, char* argv[])\n");
+        aout("{\n");
+        aout("atexit(__pl0_flush);\n");
+        evalOutput(ev.pOut, ev.outSize);
+        aout("return 0;\n}\n");
+        cgEnd();
+    }
+    else if (ev.mark > 0)
+    {
+        size_t at = emitRec.size;
+
+        if (evalState(&mod, ev.aGlobals))
+        {
+            evalOutput(ev.pOut, ev.outMark);
+            evalSplice(aMarks.pData[0].rec, aMarks.pData[ev.mark].rec, at);
+        }
+        else
+        {
+            stats.nEvalDone = 0;
+        }
+    }
+
+    free(aPcs);
+    free(ev.aGlobals);
+    free(ev.pOut);
+
+    statsLeave(prev);
+}
+
+/* Semantics */
+
+static const SymListNode*
+symCheck(int check)
+{
+    SymListNode* ret;
+    int prev = statsEnter(PHASE_SYM);
+
+    ret = symLookup(token);
+
+    if (ret == nullptr)
+        compileError("undefined symbol :%s", token);
 
-        case TOK_MULTIPLY:
-            COUT("*");
+    switch (check)
+    {
+        case CHECK_LHS:
+            if (ret->data.type != TOK_VAR)
+                compileError("must be a variable: %s", token);
             break;
 
-        case TOK_DIVIDE:
-            COUT("/");
+        case CHECK_RHS:
+            if (ret->data.type == TOK_PROCEDURE)
+                compileError("must not be a procedure: %s", token);
             break;
 
-        case TOK_LPAREN:
-            COUT("(");
+        case CHECK_CALL:
+            if (ret->data.type != TOK_PROCEDURE)
+                compileError("must be a procedure: %s", token);
             break;
 
-        case TOK_RPAREN:
-            COUT(")");
+        case CHECK_FACTOR:
+            if (ret->data.type == TOK_PROCEDURE && !ret->data.bResult)
+                compileError("must not be a procedure: %s", token);
             break;
     }
+
+    statsLeave(prev);
+
+    return ret;
 }
 
 static void
-cgCrlf(void)
+arraySize(void)
 {
-    COUT("\n");
+    const char* errstr;
+
+    if (symtab.pLast->data.type != TOK_VAR)
+        compileError("arrays must be declared with \"var\"");
+
+    symtab.pLast->data.size = strtonum(token, 1, LONG_MAX, &errstr);
+    if (errstr)
+        compileError("invalid array size");
 }
 
-static void
-cgVar(void)
+static const SymListNode*
+arrayCheck(void)
 {
-    COUT("long %s;\n", token);
+    SymListNode* ret;
+    int prev = statsEnter(PHASE_SYM);
+
+    if (!(ret = symLookup(token)))
+        compileError("undefined symbol: '%s'", token);
+
+    statsLeave(prev);
+
+    return ret;
 }
 
-static void
-cgProcedure(void)
+/* the value of a number's text, -1 if it doesn't fit a long */
+static long
+numberValue(const char* p, size_t len)
 {
-    if (proc == 0)
-    {
-        COUT("int\n");
-        COUT("main(int argc, char* argv[])\n");
-    }
-    else
+    unsigned long n = 0;
+
+    for (; len > 0; p++, len--)
     {
-        COUT("void\n");
-        COUT("%s(void)\n", token);
+        if (*p == '_')
+            continue;
+        if (n > (unsigned long)(LONG_MAX - (*p - '0')) / 10)
+            return -1;
+        n = n * 10 + (*p - '0');
     }
 
-    COUT("{\n");
+    return n;
 }
 
 static void
-cgEpilogue(void)
+constValue(void)
 {
-    COUT(";");
-    if (proc == 0)
-        COUT("return 0;");
-    COUT("\n}\n\n");
+    symtab.pLast->data.value = numberValue(token, strlen(token));
 }
 
-static void
-cgCall(void)
+/* the symbol an identifier's text refers to, or nullptr */
+const SymListNode*
+symFind(const char* p, size_t len)
 {
-    COUT("%s();\n", token);
+    char name[STREAM_TOKEN_MAX];
+
+    if (len >= sizeof(name))
+        return nullptr;
+
+    memcpy(name, p, len);
+    name[len] = '\0';
+
+    return symLookup(name);
 }
 
-static void
-cgOdd(void)
+/* the value of a number or a constant, -1 if there is none */
+long
+rangeValue(int kind, const char* p, size_t len)
 {
-    COUT(")&1");
+    const SymListNode* pSym;
+
+    if (kind == TOK_NUMBER)
+        return numberValue(p, len);
+
+    if (kind == TOK_IDENT && (pSym = symFind(p, len)) != nullptr && pSym->data.type == TOK_CONST)
+        return pSym->data.value;
+
+    return -1;
 }
 
-static void
-cgWriteChar(void)
+bool
+isStatementEnd(int kind)
 {
-    COUT("(void)fprintf(stdout, \"%%c\", (unsigned char) %s);", token);
+    return kind == TOK_SEMICOLON || kind == TOK_END || kind == TOK_DOT || kind == 0;
 }
 
-static void
-cgWriteInt(void)
+/* whether a call can change variable `pSym`: a global, an enclosing procedure's or one in a frame */
+static bool
+symShared(const SymListNode* pSym)
 {
-    COUT("(void)fprintf(stdout, \"%%ld\", (long) %s);", token);
+    return pSym->data.depth == 0 || pSym->data.depth != scopeLevel() || pProcSym->data.bFrame;
 }
 
-static void
-cgInit(void)
+/* whether the token `kind`, which `c` has moved past, starts a call: a statement's or a function's in a factor */
+static bool
+isCall(int kind, TokenCursor c)
 {
-    COUT("#include <stdio.h>\n");
-    COUT("#include \"include/strtonum.h\"\n\n");
-    COUT("static char __stdin[24];\n");
-    COUT("static const char *__errstr;\n");
-    COUT("static long __writestridx;\n\n");
+    const char* p;
+    size_t len;
+
+    return kind == TOK_CALL || (kind == TOK_IDENT && cursorNext(&c, &p, &len) == TOK_LPAREN);
 }
 
-static void
-cgReadChar(void)
+/*
+ * At the name of `pSym` in a call, with `c` after it: whether the call is
+ * of the procedure being compiled and the last thing it does, so that it
+ * can start over instead, see cgTail() and bcTail().  That is when `nEnds`
+ * ends and then the end of a statement follow its arguments, the ends of
+ * the blocks it is last in, see tailEnds.  Needs the tokens ahead, so
+ * under --stream every call stays a call and deep recursion can overflow.
+ */
+static bool
+tailCall(const SymListNode* pSym, TokenCursor c, int nEnds)
 {
-    COUT("%s=(unsigned char)fgetc(stdin);", token);
+    const char* p;
+    size_t len, parens = 0;
+    int kind;
+
+    if (!bTokens || pSym == nullptr || pSym != pProcSym || nEnds < 0)
+        return false;
+
+    do
+    {
+        if ((kind = cursorNext(&c, &p, &len)) == 0 || kind == TOK_DOT)
+            return false;
+        if (kind == TOK_LPAREN)
+            ++parens;
+        else if (kind == TOK_RPAREN)
+            --parens;
+    } while (parens > 0);
+
+    if (kind == TOK_RPAREN)
+        kind = cursorNext(&c, &p, &len);
+    for (; nEnds > 0 && kind == TOK_END; nEnds--)
+        kind = cursorNext(&c, &p, &len);
+
+    return nEnds == 0 && isStatementEnd(kind);
 }
 
-static void
-cgReadInt(void)
+/* at "return", whether what it returns is a tail call */
+static bool
+tailReturn(void)
 {
-    COUT("(void)fgets(__stdin, ssizeof(__stdin), stdin);\n");
-    COUT("if(__stdin[strlen(__stdin) - 1] == '\\n')");
-    COUT("__stdin[stdlen(__stdin) - 1] = '\\0';");
-    COUT("%s=(long)strtonum(__stdin, LONG_MIN, LONG_MAX, &__errstr);\n", token);
-    COUT("if(__errstr!=NULL){");
-    COUT("(void)fprintf(stderr, \"invalid number: %%s\\n\", __stdin);");
-    COUT("exit(1);");
-    COUT("}");
+    TokenCursor c = cur;
+    const char* p;
+    size_t len;
+
+    if (!bTokens || cursorNext(&c, &p, &len) != TOK_IDENT)
+        return false;
+
+    return tailCall(symFind(p, len), c, 0);
 }
 
-static void
-cgArray(void)
+/* at an assignment to a scalar, whether it is `var := number` */
+static RangeInit
+rangeInit(void)
 {
-    COUT("[%s]", token);
+    TokenCursor c = cur;
+    const char* p;
+    size_t len;
+    long value;
+    const SymListNode* pVar;
+
+    if ((!bSafe && unroll < 2) || !bTokens || cursorNext(&c, &p, &len) != TOK_ASSIGN ||
+        cursorNext(&c, &p, &len) != TOK_NUMBER)
+        return (RangeInit){};
+
+    value = numberValue(p, len);
+    if (value < 0 || !isStatementEnd(cursorNext(&c, &p, &len)))
+        return (RangeInit){};
+
+    pVar = symLookup(token);
+    if (pVar->data.type != TOK_VAR || pVar->data.size != 0)
+        return (RangeInit){};
+
+    return (RangeInit){.pVar = pVar, .value = value};
 }
 
-static void
-cgWriteStr(void)
+/*
+ * At `while var < bound do body`, where `init` set var right before the
+ * loop, proves var in [0, bound) in the body up to the first statement that
+ * can change it.  That holds if every assignment to var in the body is
+ * `var := var + number`: var never goes below its initial value, and the
+ * condition is checked again before the next iteration.  A change inside a
+ * nested loop ends the proof at that loop, whose earlier statements run
+ * again after it.  Anything else that writes var, including a call when
+ * var is shared, and there is nothing to prove.
+ */
+static bool
+rangeLoop(RangeInit init)
 {
-    SymListNode* ret = nullptr;
-
-    if (type == TOK_IDENT)
+    TokenCursor c = cur;
+    const char* p;
+    const char* pName;
+    size_t len, nameLen;
+    size_t idx = nRead; /* of the token c is at */
+    size_t killAt = SIZE_MAX;
+    size_t nested = 0, blocks = 0;
+    size_t aNestedBlocks[RANGE_MAX_NESTING], aNestedStart[RANGE_MAX_NESTING];
+    const SymListNode* pVar;
+    long bound;
+    int kind;
+
+    if (!bSafe || !bTokens || init.pVar == nullptr)
+        return false;
+
+    if (cursorNext(&c, &pName, &nameLen) != TOK_IDENT || cursorNext(&c, &p, &len) != TOK_LESSTHAN)
+        return false;
+
+    kind = cursorNext(&c, &p, &len);
+    bound = rangeValue(kind, p, len);
+    if (bound < 0 || cursorNext(&c, &p, &len) != TOK_DO)
+        return false;
+    idx += 4;
+
+    if ((pVar = symFind(pName, nameLen)) != init.pVar)
+        return false;
+
+    for (;; idx++)
     {
-        LIST_FOREACH(&symtab, it)
-            if (!strcmp(it->data.name, token))
-                ret = it;
+        kind = cursorNext(&c, &p, &len);
 
-        if (!ret)
-            error("undefined symbol: '%s'", token);
+        if (kind == 0 || kind == TOK_DOT)
+            break;
 
-        if (ret->data.size == 0)
-            error("writeStr requires an array");
+        if (kind == TOK_SEMICOLON || kind == TOK_END)
+        {
+            if (blocks == 0)
+                break;
 
-        COUT("__writestridx = 0;\n");
-        COUT("while(%s[__writestridx]!='\\0'&&__writestridx<%ld)\n", token, ret->data.size);
-        COUT("(void)fputc((unsigned char)%s[__writestridx++],stdout);\n", token);
-    }
-    else
-    {
-        COUT("(void)fprintf(stdout, %s);\n", token);
+            /* nested loops whose body this ends */
+            while (nested > 0 && aNestedBlocks[nested - 1] == blocks)
+                --nested;
+
+            if (kind == TOK_END)
+                --blocks;
+        }
+        else if (kind == TOK_BEGIN)
+        {
+            ++blocks;
+        }
+        else if (kind == TOK_WHILE)
+        {
+            if (nested == RANGE_MAX_NESTING)
+                return false;
+
+            aNestedBlocks[nested] = blocks;
+            aNestedStart[nested++] = idx;
+        }
+        else if (isCall(kind, c))
+        {
+            if (symShared(pVar))
+                return false;
+        }
+        else if (kind == TOK_READINT || kind == TOK_READCHAR)
+        {
+            TokenCursor d = c;
+
+            if ((kind = cursorNext(&d, &p, &len)) == TOK_INTO)
+                kind = cursorNext(&d, &p, &len);
+            if (kind == TOK_IDENT && len == nameLen && !memcmp(p, pName, len))
+                return false;
+        }
+        else if (kind == TOK_IDENT && len == nameLen && !memcmp(p, pName, len))
+        {
+            TokenCursor d = c;
+
+            if (cursorNext(&d, &p, &len) != TOK_ASSIGN)
+                continue;
+
+            /* var := var + number */
+            if (cursorNext(&d, &p, &len) != TOK_IDENT || len != nameLen || memcmp(p, pName, len) != 0 ||
+                cursorNext(&d, &p, &len) != TOK_PLUS || cursorNext(&d, &p, &len) != TOK_NUMBER ||
+                numberValue(p, len) < 0 || !isStatementEnd(cursorNext(&d, &p, &len)))
+                return false;
+
+            if ((nested > 0 ? aNestedStart[0] : idx) < killAt)
+                killAt = nested > 0 ? aNestedStart[0] : idx;
+        }
     }
-}
 
-/* Semantics */
+    ArrRangeFactPush(&aFacts, (RangeFact){.pVar = pVar, .bound = bound, .killAt = killAt});
 
-static void
-symCheck(int check)
+    return true;
+}
+
+/* with the first token of an index into `pArr` current, whether it is known to be in range */
+static bool
+rangeProven(const SymListNode* pArr)
 {
-    SymListNode* ret = nullptr;
-    
-    LIST_FOREACH(&symtab, it)
-        if (!strcmp(token, it->data.name))
-            ret = it;
+    TokenCursor c = cur;
+    const char* p;
+    size_t len;
+    const SymListNode* pSym;
+    long value;
 
-    if (ret == nullptr)
-        error("undefined symbol :%s", token);
+    if (!bTokens || cursorNext(&c, &p, &len) != TOK_RBRACK)
+        return false;
 
-    switch (check)
+    if (type == TOK_NUMBER || type == TOK_IDENT)
     {
-        case CHECK_LHS:
-            if (ret->data.type != TOK_VAR)
-                error("must be a variable: %s", token);
-            break;
+        value = rangeValue(type, token, strlen(token));
+        if (value >= 0)
+            return value < pArr->data.size;
+    }
 
-        case CHECK_RHS:
-            if (ret->data.type == TOK_PROCEDURE)
-                error("must not be a procedure: %s", token);
-            break;
+    if (type != TOK_IDENT || (pSym = symLookup(token)) == nullptr)
+        return false;
 
-        case CHECK_CALL:
-            if (ret->data.type != TOK_PROCEDURE)
-                error("must be a procedure: %s", token);
-            break;
+    for (size_t i = aFacts.size; i-- > 0;)
+    {
+        RangeFact* pf = &aFacts.pData[i];
+        if (pf->pVar == pSym && nRead - 1 < pf->killAt && pf->bound <= pArr->data.size)
+            return true;
     }
+
+    return false;
 }
 
-static void
-arraySize(void)
+/*
+ * At "while", whether it is `while var < bound do begin ...; var := var +
+ * step end` with a number, constant or variable as bound, where nothing but
+ * the last statement writes var, nothing writes bound and there are no calls
+ * if a call can change either, nor returns if anything but the procedure sees
+ * var.  Then var is a local copy inside the loop, see cgFor().
+ */
+static bool
+loopCounted(void)
 {
-    const char* errstr;
+    TokenCursor c = cur;
+    const char* p;
+    const char* pName;
+    const char* pBound = nullptr;
+    size_t len, nameLen, boundLen = 0;
+    size_t idx = nRead; /* of the token c is at */
+    size_t blocks = 1, stepAt = SIZE_MAX;
+    bool bStart = true; /* at the first token of a statement in the body's block */
+    bool bShared;
+    const SymListNode* pVar;
+    const SymListNode* pSym;
+    const SymListNode* pBoundSym = nullptr;
+    long step = -1, bound = 0;
+    int kind;
+
+    if (!bTokens || cursorNext(&c, &pName, &nameLen) != TOK_IDENT ||
+        cursorNext(&c, &p, &len) != TOK_LESSTHAN)
+        return false;
+
+    pVar = symFind(pName, nameLen);
+    if (pVar == nullptr || pVar->data.type != TOK_VAR || pVar->data.size != 0)
+        return false;
+    bShared = symShared(pVar);
+
+    kind = cursorNext(&c, &p, &len);
+    if (kind == TOK_IDENT)
+    {
+        pSym = symFind(p, len);
+        if (pSym == nullptr || pSym->data.type == TOK_PROCEDURE || pSym->data.size != 0)
+            return false;
 
-    if (symtab.pLast->data.type != TOK_VAR)
-        error("arrays must be declared with \"var\"");
+        if (pSym->data.type == TOK_VAR)
+        {
+            pBound = p;
+            boundLen = len;
+            pBoundSym = pSym;
+            bShared |= symShared(pSym);
+        }
+        else
+        {
+            bound = pSym->data.value;
+        }
+    }
+    else if (kind == TOK_NUMBER)
+    {
+        bound = numberValue(p, len);
+    }
+    else
+    {
+        return false;
+    }
 
-    symtab.pLast->data.size = strtonum(token, 1, LONG_MAX, &errstr);
-    if (errstr)
-        error("invalid array size");
+    if (cursorNext(&c, &p, &len) != TOK_DO || cursorNext(&c, &p, &len) != TOK_BEGIN)
+        return false;
+    idx += 5;
+
+    for (; blocks > 0; idx++)
+    {
+        bool bFirst = bStart;
+
+        bStart = false;
+        kind = cursorNext(&c, &p, &len);
+
+        if (kind == 0 || kind == TOK_DOT)
+        {
+            return false;
+        }
+        else if (kind == TOK_BEGIN)
+        {
+            ++blocks;
+        }
+        else if (kind == TOK_END)
+        {
+            --blocks;
+        }
+        else if (kind == TOK_SEMICOLON)
+        {
+            bStart = blocks == 1;
+        }
+        else if (kind == TOK_FORALL)
+        {
+            return false; /* its body would capture var rather than the copy */
+        }
+        else if (kind == TOK_RETURN)
+        {
+            if (symShared(pVar))
+                return false; /* it would leave before the copy is stored back */
+        }
+        else if (isCall(kind, c))
+        {
+            if (bShared)
+                return false;
+        }
+        else if (kind == TOK_READINT || kind == TOK_READCHAR)
+        {
+            TokenCursor d = c;
+
+            if ((kind = cursorNext(&d, &p, &len)) == TOK_INTO)
+                kind = cursorNext(&d, &p, &len);
+            if (kind == TOK_IDENT && ((len == nameLen && !memcmp(p, pName, len)) ||
+                                      (len == boundLen && !memcmp(p, pBound, len))))
+                return false;
+        }
+        else if (kind == TOK_IDENT && len == nameLen && !memcmp(p, pName, len))
+        {
+            TokenCursor d = c;
+
+            if (cursorNext(&d, &p, &len) != TOK_ASSIGN)
+                continue;
+
+            /* var := var + step, and then the body's end */
+            if (!bFirst || blocks != 1 || cursorNext(&d, &p, &len) != TOK_IDENT || len != nameLen ||
+                memcmp(p, pName, len) != 0 || cursorNext(&d, &p, &len) != TOK_PLUS ||
+                cursorNext(&d, &p, &len) != TOK_NUMBER || (step = numberValue(p, len)) < 0 ||
+                cursorNext(&d, &p, &len) != TOK_END)
+                return false;
+
+            stepAt = idx;
+        }
+        else if (kind == TOK_IDENT && len == boundLen && !memcmp(p, pBound, len))
+        {
+            TokenCursor d = c;
+
+            if (cursorNext(&d, &p, &len) == TOK_ASSIGN)
+                return false;
+        }
+    }
+
+    if (stepAt == SIZE_MAX)
+        return false;
+
+    ArrCountedLoopPush(&aLoops,
+                       (CountedLoop){.pVar = pVar, .stepAt = stepAt, .step = step, .pBound = pBoundSym, .bound = bound});
+
+    return true;
 }
 
-static void
-arrayCheck(void)
+/*
+ * At "while" of a counted loop, with --parallel: whether it may be run in
+ * parallel, which the parser then checks, see cgParallel().  Its body has
+ * no calls, I/O or foralls, and whatever it names is a constant or has the
+ * same name in C inside and outside of the loop.
+ */
+static bool
+loopParallel(void)
 {
-    SymListNode* ret = nullptr;
+    TokenCursor c = cur;
+    const CountedLoop* pl = &aLoops.pData[aLoops.size - 1];
+    const SymListNode* pSym;
+    const char* p;
+    size_t len, blocks = 0;
+    int kind;
 
-    LIST_FOREACH(&symtab, it)
-        if (!strcmp(token, it->data.name))
-            ret = it;
+    if (!bParallel || bInstrument || bSafe || pForallVar != nullptr || pl->step != 1)
+        return false;
+
+    do
+    {
+        switch (kind = cursorNext(&c, &p, &len))
+        {
+            case 0:
+            case TOK_DOT:
+            case TOK_CALL:
+            case TOK_RETURN:
+            case TOK_FORALL:
+            case TOK_READINT:
+            case TOK_READCHAR:
+            case TOK_WRITEINT:
+            case TOK_WRITECHAR:
+            case TOK_WRITESTR:
+                return false;
+
+            case TOK_BEGIN:
+                ++blocks;
+                break;
 
-    if (!ret)
-        error("undefined symbol: '%s'", token);
+            case TOK_END:
+                --blocks;
+                break;
+
+            case TOK_IDENT:
+                if ((pSym = symFind(p, len)) == nullptr || pSym->data.type == TOK_PROCEDURE)
+                    return false;
+                if (pSym->data.type == TOK_VAR && pSym->data.depth != 0 &&
+                    (pSym->data.depth != scopeLevel() || pProcSym->data.bFrame))
+                    return false;
+                break;
+        }
+    } while (kind != TOK_END || blocks > 0);
+
+    return true;
 }
 
+
 /* Parser */
 
 static void
 next(void)
 {
-    type = lex();
-    ++raw;
+    int prev = statsEnter(PHASE_LEX);
+
+    prevLine = line;
+
+    if (bTokens)
+    {
+        type = tokenNext();
+    }
+    else
+    {
+        type = lex();
+        ++raw;
+    }
+
+    statsLeave(prev);
+
+    if (type != 0)
+        stats.nTokens++;
+    if (type == TOK_IDENT)
+        stats.nIdents++;
 
     /*COUT("list: ...\n");*/
     /*LIST_FOREACH(&symtab, it)*/
@@ -668,33 +3735,138 @@ static void
 expect(int match)
 {
     if (match != type)
-        error("syntax error: expected: %s, got %s\n", tokenStrings[match], tokenStrings[type]);
+        compileError("syntax error: expected: %s, got %s\n", tokenStrings[match], tokenStrings[type]);
     next();
 }
 
+/*
+ * "[" expression "]" after an array's name, checked with --safe unless it
+ * can't be out of range.  Returns its offset from the variable of the
+ * forall being compiled, see forallOffset().
+ */
+static long
+arrayIndex(void)
+{
+    const SymListNode* pArr = arrayCheck();
+    bool bCheck, bByVar;
+    size_t checkLine, at;
+    long offset;
+
+    cgSymbol();
+    expect(TOK_LBRACK);
+
+    bCheck = bSafe && pArr->data.size > 0;
+    if (bCheck)
+    {
+        stats.nChecks++;
+        if (rangeProven(pArr))
+        {
+            stats.nChecksProven++;
+            bCheck = false;
+        }
+    }
+
+    checkLine = line;
+    if (bCheck)
+        cgBoundsCheck();
+    /* without the tokens ahead, only the variable itself */
+    bByVar = pForallVar != nullptr && type == TOK_IDENT && symLookup(token) == pForallVar;
+    offset = forallOffset();
+    at = stats.nTokens;
+    expression();
+    if (bByVar && stats.nTokens == at + 1)
+        offset = 0;
+    if (bCheck)
+        cgBoundsEnd(pArr->data.size, checkLine);
+
+    if (type == TOK_RBRACK)
+        cgSymbol();
+    expect(TOK_RBRACK);
+
+    return offset;
+}
+
+/* after the name of procedure `pSym`: its arguments, which only a call statement may leave out */
+static void
+arguments(const SymListNode* pSym, bool bValue, bool bTail)
+{
+    int n = 0;
+
+    forallForbid("a call");
+    effCall(pSym);
+    if (bTail)
+        cgTail(pSym);
+    else
+        cgCall(pSym);
+
+    if (bValue || type == TOK_LPAREN)
+    {
+        expect(TOK_LPAREN);
+        if (type != TOK_RPAREN)
+        {
+            expression();
+            ++n;
+            while (type == TOK_COMMA)
+            {
+                cgSymbol();
+                expect(TOK_COMMA);
+                expression();
+                ++n;
+            }
+        }
+        expect(TOK_RPAREN);
+    }
+
+    if (n != pSym->data.nParams)
+        compileError("wrong number of arguments: %s takes %d", pSym->data.name, pSym->data.nParams);
+
+    if (bTail)
+    {
+        stats.nTailCalls++;
+        cgTailEnd(pSym);
+        bcTail(pSym, bValue);
+    }
+    else
+    {
+        cgCallEnd(pSym, bValue, n);
+        bcCall(pSym, bValue);
+    }
+}
+
 static void
 factor(void)
 {
     switch (type)
     {
         case TOK_IDENT:
-            symCheck(CHECK_RHS);
-            cgSymbol();
-            expect(TOK_IDENT);
-            if (type == TOK_LBRACK)
+        {
+            const SymListNode* pSym = symCheck(CHECK_FACTOR);
+            bool bIndexed;
+            long offset = FORALL_NO_OFFSET;
+
+            if (pSym->data.type == TOK_PROCEDURE)
             {
-                arrayCheck();
-                cgSymbol();
-                expect(TOK_LBRACK);
-                expression();
-                if (type == TOK_LBRACK)
-                    cgSymbol();
-                expect(TOK_RBRACK);
+                expect(TOK_IDENT);
+                arguments(pSym, true, false);
+                break;
             }
+
+            cgIdent(pSym);
+            expect(TOK_IDENT);
+            if ((bIndexed = type == TOK_LBRACK))
+                offset = arrayIndex();
+            if (bIndexed)
+                forallElement(pSym, false, offset);
+            else
+                forallRead(pSym);
+            effRead(pSym);
+            bcLoad(pSym, bIndexed);
             break;
+        }
 
         case TOK_NUMBER:
             cgSymbol();
+            bcNumber(token);
             next();
             break;
 
@@ -706,6 +3878,9 @@ factor(void)
                 cgSymbol();
             expect(TOK_RPAREN);
             break;
+
+        default:
+            compileError("syntax error: expected a factor, got %s\n", tokenStrings[type]);
     }
 }
 
@@ -716,15 +3891,20 @@ term(void)
 
     while (type == TOK_MULTIPLY || type == TOK_DIVIDE)
     {
+        int op = type;
+
         cgSymbol();
         next();
         factor();
+        bcBinary(op);
     }
 }
 
 static void
 expression(void)
 {
+    int sign = type;
+
     if (type == TOK_PLUS || type == TOK_MINUS)
     {
         cgSymbol();
@@ -732,12 +3912,17 @@ expression(void)
     }
 
     term();
+    if (sign == TOK_MINUS)
+        bcEmit(PL0B_NEG, 0);
 
     while (type == TOK_PLUS || type == TOK_MINUS)
     {
+        int op = type;
+
         cgSymbol();
         next();
         term();
+        bcBinary(op);
     }
 }
 
@@ -750,12 +3935,15 @@ condition(void)
         expect(TOK_ODD);
         expression();
         cgOdd();
+        bcEmit(PL0B_ODD, 0);
     }
     else
     {
+        int op;
+
         expression();
 
-        switch (type)
+        switch (op = type)
         {
             case TOK_EQUAL:
             case TOK_HASH:
@@ -766,56 +3954,117 @@ condition(void)
                 break;
 
             default:
-                error("invalid conditional");
+                compileError("invalid conditional");
         }
 
         expression();
+        bcBinary(op);
     }
 }
 
 static void
 statement(void)
 {
+    RangeInit prevInit = lastInit; /* of the statement before this one in the same sequence */
+    RangeInit init = {};
+    const SymListNode* pSym;
+    bool bIndexed;
+    long offset = FORALL_NO_OFFSET;
+    size_t at;
+    int use;
+    bool bTop = bMainBody; /* main's begin ... end, whose statements evaluation can stop between */
+    bool bAlways = bEffAlways;
+    bool bTail;
+    int tail = tailEnds;
+
+    bMainBody = false;
+    lastInit = (RangeInit){};
+    tailEnds = -1;
+
     switch (type)
     {
         case TOK_IDENT:
-            symCheck(CHECK_LHS);
-            cgSymbol();
-            expect(TOK_IDENT);
-            if (type == TOK_LBRACK)
+            /* a counted loop's step, which its for statement does */
+            if (aLoops.size > 0 && nRead - 1 == aLoops.pData[aLoops.size - 1].stepAt)
             {
-                arrayCheck();
-                cgSymbol();
-                expect(TOK_LBRACK);
-                expression();
-                if (type == TOK_RBRACK)
-                    cgSymbol();
-                expect(TOK_RBRACK);
+                if (aLoops.pData[aLoops.size - 1].pVar != pForallVar)
+                {
+                    forallRead(aLoops.pData[aLoops.size - 1].pVar);
+                    forallWrite(aLoops.pData[aLoops.size - 1].pVar);
+                }
+                effRead(aLoops.pData[aLoops.size - 1].pVar);
+                effWrite(aLoops.pData[aLoops.size - 1].pVar);
+                bcStep(&aLoops.pData[aLoops.size - 1]);
+                for (int i = 0; i < 5; i++)
+                    next();
+                break;
             }
+
+            pSym = symCheck(CHECK_LHS);
+            init = rangeInit();
+            if (forallSum(pSym))
+                forallReduce(pSym, FORALL_SUM);
+            cgIdent(pSym);
+            expect(TOK_IDENT);
+            if ((bIndexed = type == TOK_LBRACK))
+                offset = arrayIndex();
             if (type == TOK_ASSIGN)
                 cgSymbol();
             expect(TOK_ASSIGN);
             expression();
+            if (bIndexed)
+                forallElement(pSym, true, offset);
+            else
+                forallWrite(pSym);
+            effWrite(pSym);
+            bcStore(pSym, bIndexed);
             break;
 
         case TOK_CALL:
             expect(TOK_CALL);
-            if (type == TOK_IDENT)
+            pSym = type == TOK_IDENT ? symCheck(CHECK_CALL) : nullptr;
+            /* a function that hasn't returned yet would return 0 after it, like the call does */
+            bTail = !bEffReturned && tailCall(pSym, cur, tail);
+            expect(TOK_IDENT);
+            arguments(pSym, false, bTail);
+            break;
+
+        case TOK_RETURN:
+            if (proc == 0 || !pProcSym->data.bResult)
+                compileError("return outside a procedure with a parameter list");
+            forallForbid("return");
+            if ((bTail = tailReturn()))
             {
-                symCheck(CHECK_CALL);
-                cgCall();
+                expect(TOK_RETURN);
+                pSym = symCheck(CHECK_FACTOR);
+                expect(TOK_IDENT);
+                arguments(pSym, true, true);
             }
-            expect(TOK_IDENT);
+            else
+            {
+                cgReturn();
+                expect(TOK_RETURN);
+                expression();
+                cgReturnEnd();
+                bcEmit(PL0B_RETV, 0);
+            }
+            bEffReturned = true;
             break;
 
         case TOK_BEGIN:
             cgSymbol();
             expect(TOK_BEGIN);
+            if (bTop)
+                evalMark();
+            tailEnds = tail < 0 ? -1 : tail + 1;
             statement();
             while (type == TOK_SEMICOLON)
             {
                 cgSemicolon();
                 expect(TOK_SEMICOLON);
+                if (bTop)
+                    evalMark();
+                tailEnds = tail < 0 ? -1 : tail + 1;
                 statement();
             }
             if (type == TOK_END)
@@ -824,32 +4073,138 @@ statement(void)
             break;
 
         case TOK_IF:
+            if ((use = forallMinMax(&pSym)) != -1)
+                forallReduce(pSym, use);
             cgSymbol();
             expect(TOK_IF);
             condition();
             if (type == TOK_THEN)
                 cgSymbol();
             expect(TOK_THEN);
+            at = bcEmit(PL0B_JZ, 0);
+            effEnter(false);
+            forallEnter();
+            tailEnds = tail;
             statement();
+            forallLeave();
+            bcPatch(at);
             break;
 
         case TOK_WHILE:
-            cgSymbol();
+        {
+            bool bCounted = loopCounted();
+            bool bPar = bCounted && loopParallel();
+            if (bCounted)
+                cgFor();
+            size_t site = cgWhile();
+            size_t top = bcLabel();
+            bool bFact = rangeLoop(prevInit);
+            if (bPar)
+                cgParallel();
+            if (bCounted)
+                cgForHead();
+            else
+                cgSymbol();
             expect(TOK_WHILE);
             condition();
             if (type == TOK_DO)
-                cgSymbol();
+            {
+                if (bCounted)
+                    cgForStep();
+                else
+                    cgSymbol();
+                cgDo(site);
+            }
+            expect(TOK_DO);
+            at = bcEmit(PL0B_JZ, 0);
+            effEnter(true);
+            if (bPar)
+            {
+                cgParallelDo();
+                statement();
+                forallEnd(pForallVar);
+                cgParallelEnd();
+            }
+            else
+            {
+                forallEnter();
+                statement();
+                forallLeave();
+            }
+            int unrolled = bCounted ? bcUnroll(&aLoops.pData[aLoops.size - 1], prevInit, top, at, unroll) : BC_ROLLED;
+            if (unrolled == BC_ROLLED)
+            {
+                bcEmit(PL0B_JMP, top);
+                bcPatch(at);
+            }
+            stats.nUnrolled += unrolled != BC_ROLLED;
+            stats.nUnrolledFully += unrolled == BC_UNROLLED_FULLY;
+            cgWhileEnd(site);
+            if (bCounted)
+                cgForEnd();
+            if (bFact)
+                ArrRangeFactPop(&aFacts);
+            break;
+        }
+
+        case TOK_FORALL:
+        {
+            size_t idx = nForalls++;
+            bool bInner = pForallVar != nullptr;
+            ForallLoop loop = {};
+
+            /* the reduction and offset checks read ahead of the parser */
+            if (!bTokens)
+                compileError("forall can't be compiled with --stream");
+            expect(TOK_FORALL);
+            pSym = type == TOK_IDENT ? symCheck(CHECK_LHS) : nullptr;
+            expect(TOK_IDENT);
+            if (pSym->data.size != 0)
+                compileError("forall over an array: %s", pSym->data.name);
+            forallWrite(pSym);
+            expect(TOK_ASSIGN);
+            cgForall(idx);
+            expression();
+            expect(TOK_TO);
+            cgForallTo(idx);
+            expression();
+            bcForall(pSym, &loop);
             expect(TOK_DO);
+            cgForallDo(pSym, idx);
+            effEnter(true);
+            effWrite(pSym);
+
+            if (bInner)
+            {
+                forallVar(pSym, FORALL_PRIVATE)->bLoop = true;
+                forallEnter();
+            }
             statement();
+            if (bInner)
+            {
+                forallLeave();
+                forallVar(pSym, FORALL_PRIVATE)->bLoop = false;
+            }
+
+            bcForallEnd(pSym, &loop);
+            forallEnd(pSym);
+            cgForallEnd(pSym, idx);
             break;
+        }
 
         case TOK_WRITEINT:
+            forallForbid("writeInt");
+            effImpure();
             expect(TOK_WRITEINT);
             if (type == TOK_IDENT || type == TOK_NUMBER)
             {
-                if (type == TOK_IDENT)
-                    symCheck(CHECK_RHS);
-                cgWriteInt();
+                pSym = type == TOK_IDENT ? symCheck(CHECK_RHS) : nullptr;
+                if (pSym != nullptr)
+                    bcLoad(pSym, false);
+                else
+                    bcNumber(token);
+                cgWriteInt(pSym);
+                bcEmit(PL0B_WRITEINT, 0);
             }
 
             if (type == TOK_IDENT)
@@ -857,16 +4212,22 @@ statement(void)
             else if (type == TOK_NUMBER)
                 expect(TOK_NUMBER);
             else
-                error("writeInt takes an identifier or a number");
+                compileError("writeInt takes an identifier or a number");
             break;
 
         case TOK_WRITECHAR:
+            forallForbid("writeChar");
+            effImpure();
             expect(TOK_WRITECHAR);
             if (type == TOK_IDENT || type == TOK_NUMBER)
             {
-                if (type == TOK_IDENT)
-                    symCheck(CHECK_RHS);
-                cgWriteChar();
+                pSym = type == TOK_IDENT ? symCheck(CHECK_RHS) : nullptr;
+                if (pSym != nullptr)
+                    bcLoad(pSym, false);
+                else
+                    bcNumber(token);
+                cgWriteChar(pSym);
+                bcEmit(PL0B_WRITECHAR, 0);
             }
 
             if (type == TOK_IDENT)
@@ -874,43 +4235,53 @@ statement(void)
             else if (type == TOK_NUMBER)
                 expect(TOK_NUMBER);
             else
-                error("writeChar takes an identifier or a number");
+                compileError("writeChar takes an identifier or a number");
             break;
 
         case TOK_READINT:
+            forallForbid("readInt");
+            effImpure();
             expect(TOK_READINT);
             if (type == TOK_INTO)
                 expect(TOK_INTO);
 
             if (type == TOK_IDENT)
             {
-                symCheck(CHECK_LHS);
-                cgReadInt();
+                pSym = symCheck(CHECK_LHS);
+                cgReadInt(pSym);
+                bcEmit(PL0B_READINT, 0);
+                bcStore(pSym, false);
             }
 
             expect(TOK_IDENT);
             break;
 
         case TOK_READCHAR:
+            forallForbid("readChar");
+            effImpure();
             expect(TOK_READCHAR);
             if (type == TOK_INTO)
                 expect(TOK_INTO);
 
             if (type == TOK_IDENT)
             {
-                symCheck(CHECK_LHS);
-                cgReadChar();
+                pSym = symCheck(CHECK_LHS);
+                cgReadChar(pSym);
+                bcEmit(PL0B_READCHAR, 0);
+                bcStore(pSym, false);
             }
             expect(TOK_IDENT);
             break;
 
         case TOK_WRITESTR:
+            forallForbid("writeStr");
+            effImpure();
             expect(TOK_WRITESTR);
             if (type == TOK_IDENT || type == TOK_STRING)
             {
-                if (type == TOK_IDENT)
-                    symCheck(CHECK_LHS);
+                pSym = type == TOK_IDENT ? symCheck(CHECK_LHS) : nullptr;
                 cgWriteStr();
+                bcWriteStr(pSym, token);
 
                 if (type == TOK_IDENT)
                     expect(TOK_IDENT);
@@ -919,17 +4290,102 @@ statement(void)
             }
             else
             {
-                error("writeStr takes an array or a string");
+                compileError("writeStr takes an array or a string");
             }
             break;
     }
+
+    lastInit = init;
+    bEffAlways = bAlways && !bEffReturned;
+}
+
+/* appends a parameter to the C parameter list of `pn` */
+static void
+paramAdd(SymNode* pn, const char* fmt, ...)
+{
+    va_list ap;
+    size_t len = pn->params != nullptr ? strlen(pn->params) : 0;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(nullptr, 0, fmt, ap);
+    va_end(ap);
+
+    if ((pn->params = realloc(pn->params, len + n + sizeof(", "))) == nullptr)
+        LOG_FATAL("realloc failed");
+    if (len > 0)
+    {
+        strcpy(pn->params + len, ", ");
+        len += 2;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(pn->params + len, n + 1, fmt, ap);
+    va_end(ap);
+}
+
+/* one of the parameters of the procedure being compiled */
+static void
+parameter(void)
+{
+    SymNode* pn = &pProcSym->data;
+
+    if (type == TOK_IDENT)
+    {
+        addSymbol(TOK_VAR);
+        bcDeclare(&symtab.pLast->data);
+        paramAdd(pn, "long %s", token);
+        ++pn->nParams;
+    }
+    expect(TOK_IDENT);
+}
+
+/* the display of `pn`: the frames of `pOuter` and the procedures it is in, outermost first */
+static void
+paramDisplay(SymNode* pn, const SymNode* pOuter)
+{
+    if (pOuter == nullptr)
+        return;
+
+    paramDisplay(pn, pOuter->pParent);
+    paramAdd(pn, "struct __frame_%s* __d%d", procCName(pOuter), pOuter->depth + 1);
+}
+
+/* [ "(" [ ident { "," ident } ] ")" ] ";" after a procedure's name, in its scope */
+static void
+parameters(void)
+{
+    if (type == TOK_LPAREN)
+    {
+        expect(TOK_LPAREN);
+        pProcSym->data.bResult = true;
+
+        if (type != TOK_RPAREN)
+        {
+            parameter();
+            while (type == TOK_COMMA)
+            {
+                expect(TOK_COMMA);
+                parameter();
+            }
+        }
+        expect(TOK_RPAREN);
+    }
+    expect(TOK_SEMICOLON);
+
+    paramDisplay(&pProcSym->data, pProcSym->data.pParent);
+    bcParameters();
 }
 
 static void
 block(void)
 {
-    if (depth++ > 1)
-        error("nesting depth exceeded");
+    if (depth++ > NESTING_MAX)
+        compileError("nesting depth exceeded");
+
+    /* a procedure's parameters are its first locals */
+    if (proc != 0)
+        parameters();
 
     if (type == TOK_CONST)
     {
@@ -937,14 +4393,14 @@ block(void)
         if (type == TOK_IDENT)
         {
             addSymbol(TOK_CONST);
-            cgConst();
+            bcDeclare(&symtab.pLast->data);
         }
         expect(TOK_IDENT);
         expect(TOK_EQUAL);
         if (type == TOK_NUMBER)
         {
-            cgSymbol();
-            cgSemicolon();
+            constValue();
+            bcConst(&symtab.pLast->data);
         }
         expect(TOK_NUMBER);
         while (type == TOK_COMMA)
@@ -953,14 +4409,14 @@ block(void)
             if (type == TOK_IDENT)
             {
                 addSymbol(TOK_CONST);
-                cgConst();
+                bcDeclare(&symtab.pLast->data);
             }
             expect(TOK_IDENT);
             expect(TOK_EQUAL);
             if (type == TOK_NUMBER)
             {
-                cgSymbol();
-                cgSemicolon();
+                constValue();
+                bcConst(&symtab.pLast->data);
             }
             expect(TOK_NUMBER);
         }
@@ -973,7 +4429,7 @@ block(void)
         if (type == TOK_IDENT)
         {
             addSymbol(TOK_VAR);
-            cgVar();
+            bcDeclare(&symtab.pLast->data);
         }
         expect(TOK_IDENT);
         if (type == TOK_SIZE)
@@ -982,60 +4438,94 @@ block(void)
             if (type == TOK_NUMBER)
             {
                 arraySize();
-                cgArray();
+                bcArray(&symtab.pLast->data);
             }
             expect(TOK_NUMBER);
         }
-        cgSemicolon();
         while (type == TOK_COMMA)
         {
             expect(TOK_COMMA);
             if (type == TOK_IDENT)
             {
                 addSymbol(TOK_VAR);
-                cgVar();
+                bcDeclare(&symtab.pLast->data);
             }
             expect(TOK_IDENT);
             if (type == TOK_SIZE)
             {
-                arraySize();
-                cgArray();
+                expect(TOK_SIZE);
+                if (type == TOK_NUMBER)
+                {
+                    arraySize();
+                    bcArray(&symtab.pLast->data);
+                }
                 expect(TOK_NUMBER);
             }
-            cgSemicolon();
         }
         expect(TOK_SEMICOLON);
-        cgCrlf();
     }
 
+    /* the globals, a procedure's locals go after its header in cgProcedure() */
+    if (proc == 0)
+        cgDecls();
+
     while (type == TOK_PROCEDURE)
     {
+        SymListNode* pOuter = pProcSym;
+        int outer = proc;
+
+        /* the procedures inside reach this one's variables through its frame */
+        if (pOuter != nullptr && !pOuter->data.bFrame)
+        {
+            pOuter->data.bFrame = true;
+            cgFrame(pOuter);
+        }
+
         proc = 1;
 
         expect(TOK_PROCEDURE);
         if (type == TOK_IDENT)
         {
             addSymbol(TOK_PROCEDURE);
-            cgProcedure();
+            if (pOuter != nullptr)
+            {
+                SymNode* pn = &symtab.pLast->data;
+                size_t size = strlen(procCName(&pOuter->data)) + strlen(pn->name) + sizeof("__");
+
+                pn->pParent = &pOuter->data;
+                if ((pn->cname = malloc(size)) == nullptr)
+                    LOG_FATAL("malloc failed");
+                snprintf(pn->cname, size, "%s__%s", procCName(&pOuter->data), pn->name);
+            }
+            if (bMemoize)
+                symtab.pLast->data.pEff = effCreate();
+            bcDeclare(&symtab.pLast->data);
+            bcProcedure(&symtab.pLast->data);
+            pProcSym = symtab.pLast;
         }
         expect(TOK_IDENT);
-        expect(TOK_SEMICOLON);
 
         block();
 
         expect(TOK_SEMICOLON);
 
-        proc = 0;
-
-        destroySymbols();
+        destroySymbols(pProcSym);
+        proc = outer;
+        pProcSym = pOuter;
     }
 
-    if (proc == 0)
-        cgProcedure();
+    cgProcedure();
+    bcBody();
 
+    bMainBody = proc == 0;
+    bEffAlways = true;
+    bEffReturned = false;
+    tailEnds = proc != 0 ? 0 : -1;
     statement();
 
+    effEnd();
     cgEpilogue();
+    bcEpilogue();
 
     if (--depth < 0)
         LOG_FATAL("nesting depth fell below 0");
@@ -1044,43 +4534,496 @@ block(void)
 static void
 parse(void)
 {
+    emitSplit();
     cgInit();
+    bcInit();
+
+    /* whole sources are tokenized up front, the loop analyses look ahead */
+    if (!bStream)
+        lexAll();
 
     next();
     block();
     expect(TOK_DOT);
 
     if (type != 0)
-        error("extra tokens at end of file");
+        compileError("extra tokens at end of file");
 
     cgEnd();
+    moduleWrite();
+    evaluate();
+
+    if (splitDir)
+        emitUnits();
+    else if (bDefer)
+        emitFlush();
+}
+
+/* everything the generated C depends on: compiler, flags, profile and source */
+static CacheKey
+cacheKey(void)
+{
+    CacheKey key = cacheKeyInit();
+    char version[32];
+    unsigned char flags =
+        bInstrument | bPgo << 1 | bSafe << 2 | bBytecode << 3 | (evalSteps > 0) << 4 | bParallel << 5 |
+        bMemoize << 6 | bExecutable << 7;
+
+    snprintf(version, sizeof(version), "pl0c %g", PL0C_VERSION);
+    cacheKeyAdd(&key, version, strlen(version));
+    cacheKeyAdd(&key, &flags, sizeof(flags));
+    if (evalSteps)
+        cacheKeyAdd(&key, &evalSteps, sizeof(evalSteps));
+    if (unroll > 1)
+        cacheKeyAdd(&key, &unroll, sizeof(unroll));
+
+    if (bPgo)
+    {
+        FILE* fp;
+        char buf[1 << 16];
+        size_t n;
+
+        if ((fp = fopen(profPath, "r")) == nullptr)
+            compileError("couldn't open profile %s", profPath);
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            cacheKeyAdd(&key, buf, n);
+        fclose(fp);
+    }
+
+    cacheKeyAdd(&key, raw, rawSize);
+
+    return key;
+}
+
+char*
+readAll(FILE* fp, size_t* pSize)
+{
+    char* p = nullptr;
+    size_t size = 0, cap = 0, n;
+
+    do
+    {
+        if (size + 1 >= cap)
+        {
+            cap = cap ? cap * 2 : 1 << 16;
+            if ((p = realloc(p, cap)) == nullptr)
+                LOG_FATAL("realloc failed");
+        }
+
+        n = fread(p + size, 1, cap - size - 1, fp);
+        size += n;
+    } while (n > 0);
+
+    p[size] = '\0';
+    *pSize = size;
+
+    return p;
+}
+
+/* releases whatever a compilation holds, also when compileError() cut it short */
+static void
+compileCleanup(FILE* out)
+{
+    if (fpOut != fpUnit)
+        fclose(fpOut); /* a procedure's buffer, see cgProcedure() */
+    if (fpUnit != out)
+        fclose(fpUnit);
+    fpOut = fpUnit = out;
+
+    free(pUnit);
+    pUnit = nullptr;
+    free(rawStart);
+    rawStart = nullptr;
+    if (fdIn != -1 && fdIn != STDIN_FILENO)
+        close(fdIn);
+    fdIn = -1;
+    free(token);
+    token = nullptr;
+    tokenCap = 0;
+    bTokens = false;
+    aRuns.size = 0;
+    resync.size = 0;
+    lexFree();
+    emitFree();
+    splitDecls.size = 0;
+    aFacts.size = 0;
+    lastInit = (RangeInit){};
+    aLoops.size = 0;
+    depsReset();
+    forallBody.size = forallFns.size = 0;
+    nForalls = 0;
+    bcReset();
+    aMarks.size = 0;
+    bMainBody = false;
+
+    destroySymtab();
+
+    pErrJmp = nullptr;
 }
 
 int
-main(int argc, char* argv[])
+compile(const Options* pOpts, const char* path, char* src, size_t size, FILE* out, FILE* err)
 {
-    char* startp;
+    jmp_buf jmp;
+    CacheKey key;
+    int hit;
+    double ms0 = msTimeNow();
+
+    bStats = pOpts->bStats;
+    bInstrument = pOpts->bInstrument;
+    bPgo = pOpts->profPath != nullptr;
+    profPath = pOpts->profPath;
+    cacheDir = pOpts->cacheDir;
+    cacheMaxBytes = pOpts->cacheMaxBytes;
+    bStream = pOpts->bStream;
+    bSafe = pOpts->bSafe;
+    bParallel = pOpts->bParallel;
+    bMemoize = pOpts->bMemoize;
+    unroll = pOpts->unroll < UNROLL_MAX ? pOpts->unroll : UNROLL_MAX;
+    bBytecode = pOpts->bBytecode || pOpts->bExecutable;
+    bExecutable = pOpts->bExecutable;
+    evalSteps = pOpts->evalSteps;
+    bModule = bBytecode || evalSteps;
+    splitDir = pOpts->splitDir;
+    nUnits = pOpts->nUnits;
+    srcPath = path;
+
+    bDefer = false;
+    type = 0;
+    line = prevLine = 1;
+    depth = 0;
+    proc = 0;
+    pProcSym = nullptr;
+    profTotalTicks = 0;
+    stats = (Stats){.lastTick = tscNow(), .phase = PHASE_READ};
+
+    fpErr = err;
+    fpOut = fpUnit = out;
+    raw = rawStart = src;
+    rawEnd = src + size;
+    rawSize = size;
+    bEof = true;
+
+    initSymtab();
 
-    if (argc != 2)
+    if (setjmp(jmp))
     {
-        CERR("usage: pl0c file.pl0\n");
-        exit(1);
+        /* what a serial compilation would have written before the error */
+        if (bDefer && !splitDir)
+            emitFlush();
+        compileCleanup(out);
+        return 1;
     }
+    pErrJmp = &jmp;
+
+    if (bPgo)
+        loadProfile(profPath);
+
+    if (bStream)
+        openStream(path);
+    else if (src == nullptr)
+        readin((char*)path);
+
+    /*
+     * --profile lays procedures out itself and --stream writes as it goes,
+     * --split and --evaluate need them apart.  Below EMIT_PARALLEL_MIN
+     * waking the pool costs more than formatting takes.
+     */
+    if (!bBytecode && !bStream && !bPgo && rawSize >= EMIT_PARALLEL_MIN)
+        call_once(&workPoolOnce, workPoolInit);
+    bDefer = !bBytecode && ((rawSize >= EMIT_PARALLEL_MIN && nWorkThreads > 1 && !bStream && !bPgo) ||
+                            splitDir || evalSteps);
+
+    if (cacheDir)
+    {
+        key = cacheKey();
+        hit = cacheLookup(cacheDir, key, out);
+        if (hit == CACHE_BROKEN)
+            compileError("couldn't read the cache entry in %s: %s", cacheDir, strerror(errno));
+        if (hit == CACHE_HIT)
+        {
+            if (bStats)
+                fprintf(fpErr, "pl0c: stats: cache hit, %.3f ms\n", msTimeNow() - ms0);
+            compileCleanup(out);
+            return 0;
+        }
 
-    readin(argv[1]);
-    startp = raw;
+        if ((fpOut = fpUnit = open_memstream(&pUnit, &unitSize)) == nullptr)
+            LOG_FATAL("open_memstream failed");
+    }
 
-    initTokenHashMap();
-    initSymtab();
+    statsEnter(PHASE_PARSE);
 
     parse();
 
     /*LIST_FOREACH(&symtab, it)*/
     /*    COUT("%s\n", it->data.name);*/
 
-    free(startp);
-    destroySymtab();
-    destroyTokenHashMap();
+    if (cacheDir)
+    {
+        fclose(fpUnit);
+        fpOut = fpUnit = out;
+        fwrite(pUnit, 1, unitSize, out);
+        cacheStore(cacheDir, key, pUnit, unitSize, cacheMaxBytes);
+    }
+
+    if (bStats)
+    {
+        statsEnter(PHASE_EMIT);
+        fflush(out);
+        statsEnter(PHASE_PARSE);
+        statsPrint(msTimeNow() - ms0);
+    }
+
+    compileCleanup(out);
 
     return 0;
 }
+
+void
+compilerInit(size_t nThreads)
+{
+    nWorkThreads = nThreads;
+    initTokenHashMap();
+}
+
+/* the calling thread's tables, other threads' die with them */
+void
+compilerDestroy(void)
+{
+    ArrProfClean(&aProfSites);
+    ArrSizeClean(&aProfProcs);
+    ArrProcBufClean(&aProcBufs);
+    tokenBufClean(&resync);
+    ArrTokenRunClean(&aRuns);
+    ArrEmitSegClean(&aSegs);
+    ArrRangeFactClean(&aFacts);
+    ArrCountedLoopClean(&aLoops);
+    bcDestroy();
+    ArrEvalMarkClean(&aMarks);
+    free(emitRec.pData);
+    destroyTokenHashMap();
+
+    if (workPool.aThreads)
+    {
+        ThreadPoolStop(&workPool);
+        ThreadPoolClean(&workPool);
+    }
+}
+
+static void
+usage(void)
+{
+    CERR("usage: pl0c [--stats] [--instrument] [--safe] [--parallel] [--memoize] [--unroll n]\n"
+         "            [--profile file] [--cache dir] [--cache-size mb] [--jobs n] [--bytecode]\n"
+         "            [--evaluate steps] [--client socket] [-o prog] file.pl0 | -\n"
+         "       pl0c --split dir [--units n] [--stats] [--instrument] [--jobs n] file.pl0 | -\n"
+         "       pl0c --stream [--stats] [--instrument] file.pl0 | -\n"
+         "            (--stream rejects forall and doesn't turn tail calls into jumps)\n"
+         "       pl0c --server socket [--jobs n]\n");
+    exit(1);
+}
+
+int
+main(int argc, char* argv[])
+{
+    int ch, status;
+    const char* errstr;
+    const char* serverPath = nullptr;
+    const char* clientPath = nullptr;
+    const char* outPath = nullptr;
+    FILE* out = stdout;
+    long nJobs = 0;
+    Options opts = {.cacheMaxBytes = CACHE_DEFAULT_MAX_MB * 1024ul * 1024ul};
+
+    static const struct option aOpts[] = {
+        {"stats", no_argument, nullptr, 's'},
+        {"instrument", no_argument, nullptr, 'i'},
+        {"profile", required_argument, nullptr, 'p'},
+        {"cache", required_argument, nullptr, 'c'},
+        {"cache-size", required_argument, nullptr, 'C'},
+        {"server", required_argument, nullptr, 'S'},
+        {"client", required_argument, nullptr, 'L'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"stream", no_argument, nullptr, 'm'},
+        {"split", required_argument, nullptr, 'd'},
+        {"units", required_argument, nullptr, 'u'},
+        {"safe", no_argument, nullptr, 'b'},
+        {"parallel", no_argument, nullptr, 'P'},
+        {"memoize", no_argument, nullptr, 'M'},
+        {"unroll", required_argument, nullptr, 'U'},
+        {"bytecode", no_argument, nullptr, 'y'},
+        {"evaluate", required_argument, nullptr, 'e'},
+        {"output", required_argument, nullptr, 'o'},
+        {}
+    };
+
+    while ((ch = getopt_long(argc, argv, "o:", aOpts, nullptr)) != -1)
+    {
+        switch (ch)
+        {
+            case 's':
+                opts.bStats = true;
+                break;
+
+            case 'i':
+                opts.bInstrument = true;
+                break;
+
+            case 'p':
+                opts.profPath = optarg;
+                break;
+
+            case 'c':
+                opts.cacheDir = optarg;
+                break;
+
+            case 'C':
+                opts.cacheMaxBytes = strtonum(optarg, 1, LONG_MAX / (1024 * 1024), &errstr) * 1024 * 1024;
+                if (errstr)
+                    usage();
+                break;
+
+            case 'S':
+                serverPath = optarg;
+                break;
+
+            case 'L':
+                clientPath = optarg;
+                break;
+
+            case 'j':
+                nJobs = strtonum(optarg, 1, SERVER_MAX_JOBS, &errstr);
+                if (errstr)
+                    usage();
+                break;
+
+            case 'm':
+                opts.bStream = true;
+                break;
+
+            case 'd':
+                opts.splitDir = optarg;
+                break;
+
+            case 'b':
+                opts.bSafe = true;
+                break;
+
+            case 'P':
+                opts.bParallel = true;
+                break;
+
+            case 'M':
+                opts.bMemoize = true;
+                break;
+
+            case 'U':
+                opts.unroll = strtonum(optarg, 1, UNROLL_MAX, &errstr);
+                if (errstr)
+                    usage();
+                break;
+
+            case 'y':
+                opts.bBytecode = true;
+                break;
+
+            case 'e':
+                opts.evalSteps = strtonum(optarg, 1, LONG_MAX, &errstr);
+                if (errstr)
+                    usage();
+                break;
+
+            case 'o':
+                outPath = optarg;
+                opts.bExecutable = true;
+                break;
+
+            case 'u':
+                opts.nUnits = strtonum(optarg, 1, SPLIT_MAX_UNITS, &errstr);
+                if (errstr)
+                    usage();
+                break;
+
+            default:
+                usage();
+        }
+    }
+
+    /* these need the whole source or the whole output at once */
+    if (opts.bStream &&
+        (opts.profPath || opts.cacheDir || opts.evalSteps || clientPath || serverPath))
+        usage();
+    /* --split writes files instead, and --units only means something with it */
+    if (opts.splitDir ? opts.bStream || opts.profPath || opts.cacheDir || clientPath || serverPath : opts.nUnits != 0)
+        usage();
+    if (opts.nUnits == 0)
+        opts.nUnits = SPLIT_DEFAULT_UNITS;
+    /* a module has no C to instrument, lay out or split */
+    if (opts.bBytecode && (opts.bInstrument || opts.profPath || opts.splitDir))
+        usage();
+    /* the residual program is just main, and it writes its output itself */
+    if (opts.evalSteps && (opts.bBytecode || opts.bInstrument || opts.profPath || opts.splitDir))
+        usage();
+    /* an executable is made of the module */
+    if (opts.bExecutable && (opts.bBytecode || opts.bInstrument || opts.profPath || opts.splitDir || opts.evalSteps))
+        usage();
+
+    /* --jobs is the number of connections for the server, of worker threads otherwise */
+    compilerInit(serverPath ? 0 : nJobs);
+
+    if (serverPath)
+    {
+        if (optind != argc || outPath)
+            usage();
+
+        status = serverRun(serverPath, nJobs);
+    }
+    else
+    {
+        if (optind != argc - 1)
+            usage();
+
+        /* executable as far as the umask allows, like a linker's output */
+        if (outPath)
+        {
+            int fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+
+            if (fd == -1 || (out = fdopen(fd, "w")) == nullptr)
+            {
+                CERR("pl0c: couldn't create %s: %s\n", outPath, strerror(errno));
+                exit(1);
+            }
+        }
+
+        if (clientPath)
+        {
+            status = clientRun(clientPath, &opts, argv[optind], out);
+        }
+        else if (!strcmp(argv[optind], "-") && !opts.bStream)
+        {
+            size_t size;
+            char* src = readAll(stdin, &size);
+            status = compile(&opts, "-", src, size, out, stderr);
+        }
+        else
+        {
+            status = compile(&opts, argv[optind], nullptr, 0, out, stderr);
+        }
+
+        if (outPath)
+        {
+            if ((ferror(out) | fclose(out)) && status == 0)
+            {
+                CERR("pl0c: couldn't write %s\n", outPath);
+                status = 1;
+            }
+            if (status != 0)
+                unlink(outPath);
+        }
+    }
+
+    compilerDestroy();
+
+    return status;
+}
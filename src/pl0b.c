@@ -0,0 +1,453 @@
+#include "pl0b.h"
+#include "logs.h"
+#include "misc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum ARG
+{
+    ARG_NONE,
+    ARG_POOL,
+    ARG_GLOBAL,
+    ARG_LOCAL,
+    ARG_GLOBAL_ARRAY,
+    ARG_LOCAL_ARRAY,
+    ARG_OUTER, /* a variable of an enclosing procedure */
+    ARG_OUTER_ARRAY,
+    ARG_ARRAY, /* global, local or outer */
+    ARG_PC,
+    ARG_PROC
+};
+
+typedef struct OpInfo
+{
+    int8_t pop;
+    int8_t push;
+    uint8_t arg;
+} OpInfo;
+
+static const OpInfo aOps[PL0B_OP_ENUM_SIZE] = {
+    [PL0B_LIT] = {0, 1, ARG_POOL},
+    [PL0B_LDG] = {0, 1, ARG_GLOBAL},
+    [PL0B_STG] = {1, 0, ARG_GLOBAL},
+    [PL0B_LDL] = {0, 1, ARG_LOCAL},
+    [PL0B_STL] = {1, 0, ARG_LOCAL},
+    [PL0B_LDGX] = {1, 1, ARG_GLOBAL_ARRAY},
+    [PL0B_STGX] = {2, 0, ARG_GLOBAL_ARRAY},
+    [PL0B_LDLX] = {1, 1, ARG_LOCAL_ARRAY},
+    [PL0B_STLX] = {2, 0, ARG_LOCAL_ARRAY},
+    [PL0B_LDU] = {0, 1, ARG_OUTER},
+    [PL0B_STU] = {1, 0, ARG_OUTER},
+    [PL0B_LDUX] = {1, 1, ARG_OUTER_ARRAY},
+    [PL0B_STUX] = {2, 0, ARG_OUTER_ARRAY},
+    [PL0B_NEG] = {1, 1, ARG_NONE},
+    [PL0B_ADD] = {2, 1, ARG_NONE},
+    [PL0B_SUB] = {2, 1, ARG_NONE},
+    [PL0B_MUL] = {2, 1, ARG_NONE},
+    [PL0B_DIV] = {2, 1, ARG_NONE},
+    [PL0B_ODD] = {1, 1, ARG_NONE},
+    [PL0B_EQ] = {2, 1, ARG_NONE},
+    [PL0B_NE] = {2, 1, ARG_NONE},
+    [PL0B_LT] = {2, 1, ARG_NONE},
+    [PL0B_GT] = {2, 1, ARG_NONE},
+    [PL0B_JMP] = {0, 0, ARG_PC},
+    [PL0B_JZ] = {1, 0, ARG_PC},
+    [PL0B_CALL] = {0, 0, ARG_PROC},
+    [PL0B_RET] = {0, 0, ARG_NONE},
+    [PL0B_WRITEINT] = {1, 0, ARG_NONE},
+    [PL0B_WRITECHAR] = {1, 0, ARG_NONE},
+    [PL0B_READINT] = {0, 1, ARG_NONE},
+    [PL0B_READCHAR] = {0, 1, ARG_NONE},
+    [PL0B_WRITESTR] = {0, 0, ARG_ARRAY},
+    [PL0B_POP] = {1, 0, ARG_NONE},
+    [PL0B_RETV] = {1, 0, ARG_NONE},
+};
+
+static const size_t aRecordSizes[PL0B_SECTION_ENUM_SIZE] = {
+    [PL0B_POOL] = sizeof(int64_t),
+    [PL0B_SYMBOLS] = sizeof(Pl0bSymbol),
+    [PL0B_PROCS] = sizeof(Pl0bProc),
+    [PL0B_CODE] = sizeof(Pl0bInstr),
+    [PL0B_LINES] = sizeof(Pl0bLine),
+    [PL0B_STRINGS] = 1,
+};
+
+int
+pl0bStackEffect(int op)
+{
+    return aOps[op].push - aOps[op].pop;
+}
+
+static size_t
+alignUp(size_t n)
+{
+    return (n + PL0B_ALIGN - 1) / PL0B_ALIGN * PL0B_ALIGN;
+}
+
+static void
+moduleCounts(const Pl0bModule* pMod, size_t aCounts[PL0B_SECTION_ENUM_SIZE])
+{
+    aCounts[PL0B_POOL] = pMod->nPool;
+    aCounts[PL0B_SYMBOLS] = pMod->nSymbols;
+    aCounts[PL0B_PROCS] = pMod->nProcs;
+    aCounts[PL0B_CODE] = pMod->nCode;
+    aCounts[PL0B_LINES] = pMod->nLines;
+    aCounts[PL0B_STRINGS] = pMod->nStrings;
+}
+
+size_t
+pl0bWrite(FILE* fp, const Pl0bModule* pMod, uint32_t nGlobals, uint32_t mainProc)
+{
+    const void* aData[PL0B_SECTION_ENUM_SIZE] = {
+        pMod->aPool, pMod->aSymbols, pMod->aProcs, pMod->aCode, pMod->aLines, pMod->pStrings,
+    };
+    size_t aCounts[PL0B_SECTION_ENUM_SIZE];
+    Pl0bHeader h = {.format = PL0B_FORMAT, .nGlobals = nGlobals, .mainProc = mainProc};
+    size_t size = alignUp(sizeof(h));
+    char* pBuf;
+
+    memcpy(h.magic, PL0B_MAGIC, sizeof(h.magic));
+    snprintf(h.version, sizeof(h.version), "%g", PL0C_VERSION);
+    moduleCounts(pMod, aCounts);
+
+    for (int i = 0; i < PL0B_SECTION_ENUM_SIZE; i++)
+    {
+        h.aSections[i] = (Pl0bSection){.offset = size, .count = aCounts[i]};
+        size = alignUp(size + aCounts[i] * aRecordSizes[i]);
+    }
+    h.size = size;
+
+    /* zeroed, so that the padding is too */
+    if ((pBuf = calloc(1, size)) == nullptr)
+        LOG_FATAL("calloc failed");
+
+    for (int i = 0; i < PL0B_SECTION_ENUM_SIZE; i++)
+        if (aCounts[i] > 0)
+            memcpy(pBuf + h.aSections[i].offset, aData[i], aCounts[i] * aRecordSizes[i]);
+
+    h.checksum = hashFNVBytes(pBuf + sizeof(h), size - sizeof(h), 0xCBF29CE484222325);
+    memcpy(pBuf, &h, sizeof(h));
+
+    fwrite(pBuf, 1, size, fp);
+    free(pBuf);
+
+    return size;
+}
+
+static bool
+bad(const char* path, const char* why)
+{
+    CERR("pl0run: %s: %s\n", path, why);
+    return false;
+}
+
+/* names in the strings, and variables in their frame or the globals */
+/* whether the `n` slots at `slot` of procedure `pp`'s frame stay clear of its display */
+static bool
+displayClear(const Pl0bProc* pp, uint64_t slot, uint64_t n)
+{
+    return slot + n <= pp->nParams || slot >= (uint64_t)pp->nParams + (pp->depth > 1 ? pp->depth - 1 : 0);
+}
+
+static bool
+symbolCheck(const Pl0bModule* self, const Pl0bSymbol* ps)
+{
+    uint64_t nSlots;
+
+    if (ps->name >= self->nStrings || ps->kind >= PL0B_SYM_ENUM_SIZE)
+        return false;
+
+    if (ps->kind == PL0B_SYM_PROC)
+        return ps->slot < self->nProcs;
+    if (ps->kind == PL0B_SYM_CONST)
+        return true;
+
+    if (ps->depth == 0)
+        nSlots = self->pHeader->nGlobals;
+    else if (ps->proc < self->nProcs && self->aProcs[ps->proc].depth == ps->depth)
+        nSlots = self->aProcs[ps->proc].nLocals;
+    else
+        return false;
+
+    if (ps->kind == PL0B_SYM_VAR)
+        return ps->slot < nSlots && (ps->depth == 0 || displayClear(&self->aProcs[ps->proc], ps->slot, 1));
+
+    return ps->value >= 1 && (uint64_t)ps->value <= nSlots && ps->slot <= nSlots - ps->value &&
+           (ps->depth == 0 || displayClear(&self->aProcs[ps->proc], ps->slot, ps->value));
+}
+
+/* the procedure at `depth` that `iProc` is declared in, or is */
+static size_t
+ancestor(const Pl0bModule* self, size_t iProc, uint32_t depth)
+{
+    while (self->aProcs[iProc].depth > depth)
+        iProc = self->aProcs[iProc].parent;
+
+    return iProc;
+}
+
+/* whether the local `ps` is in the frame of a procedure `iProc` is declared in */
+static bool
+outerCheck(const Pl0bModule* self, size_t iProc, const Pl0bSymbol* ps)
+{
+    return ps->depth >= 1 && ps->depth < self->aProcs[iProc].depth && ancestor(self, iProc, ps->depth) == ps->proc;
+}
+
+/* the operand of `pi` in procedure `iProc` */
+static bool
+argCheck(const Pl0bModule* self, size_t iProc, const Pl0bInstr* pi)
+{
+    const Pl0bProc* pp = &self->aProcs[iProc];
+    const Pl0bSymbol* ps = pi->arg < self->nSymbols ? &self->aSymbols[pi->arg] : nullptr;
+
+    switch (aOps[pi->op].arg)
+    {
+        case ARG_NONE:
+            return true;
+        case ARG_POOL:
+            return pi->arg < self->nPool;
+        case ARG_GLOBAL:
+            return pi->arg < self->pHeader->nGlobals;
+        case ARG_LOCAL:
+            return pi->arg < pp->nLocals && displayClear(pp, pi->arg, 1);
+        case ARG_GLOBAL_ARRAY:
+            return ps && ps->kind == PL0B_SYM_ARRAY && ps->depth == 0;
+        case ARG_LOCAL_ARRAY:
+            return ps && ps->kind == PL0B_SYM_ARRAY && ps->depth != 0 && ps->proc == iProc;
+        case ARG_OUTER:
+            return ps && ps->kind == PL0B_SYM_VAR && outerCheck(self, iProc, ps);
+        case ARG_OUTER_ARRAY:
+            return ps && ps->kind == PL0B_SYM_ARRAY && outerCheck(self, iProc, ps);
+        case ARG_ARRAY:
+            return ps && ps->kind == PL0B_SYM_ARRAY &&
+                   (ps->depth == 0 || ps->proc == iProc || outerCheck(self, iProc, ps));
+        case ARG_PC:
+            return pi->arg >= pp->entry && pi->arg < pp->end;
+        case ARG_PROC:
+        {
+            /* visible from here, so that the callee's display is made of frames the caller has */
+            const Pl0bProc* pc = pi->arg < self->nProcs ? &self->aProcs[pi->arg] : nullptr;
+            return pc && (pc->depth == 0 || (pc->depth - 1 <= pp->depth && ancestor(self, iProc, pc->depth - 1) == pc->parent));
+        }
+    }
+
+    return false;
+}
+
+/*
+ * The code of procedure `iProc`: operands in range, jumps inside the
+ * procedure, an operand stack that stays within maxStack and is empty
+ * wherever control can arrive from elsewhere, calls with their arguments
+ * on it, and returns that match the procedure.  `aTarget` has a flag per
+ * instruction, all false.
+ */
+static bool
+procCheck(const Pl0bModule* self, size_t iProc, bool* aTarget)
+{
+    const Pl0bProc* pp = &self->aProcs[iProc];
+    size_t end = pp->end;
+    long depth = 0;
+    int op = PL0B_RET;
+
+    for (size_t pc = pp->entry; pc < end; pc++)
+    {
+        const Pl0bInstr* pi = &self->aCode[pc];
+
+        if (pi->op >= PL0B_OP_ENUM_SIZE || !argCheck(self, iProc, pi))
+            return false;
+        if (pi->op == PL0B_JMP || pi->op == PL0B_JZ)
+            aTarget[pi->arg] = true;
+    }
+
+    for (size_t pc = pp->entry; pc < end; pc++)
+    {
+        const Pl0bInstr* pi = &self->aCode[pc];
+        long pop = aOps[pi->op].pop, push = aOps[pi->op].push;
+
+        op = pi->op;
+        if (op == PL0B_CALL)
+        {
+            pop = self->aProcs[pi->arg].nParams;
+            push = self->aProcs[pi->arg].nResults;
+        }
+
+        if ((aTarget[pc] && depth != 0) || depth < pop)
+            return false;
+
+        depth += push - pop;
+        if (depth > pp->maxStack)
+            return false;
+
+        if ((op == PL0B_JMP || op == PL0B_JZ || op == PL0B_RET || op == PL0B_RETV) && depth != 0)
+            return false;
+        if ((op == PL0B_RET && pp->nResults != 0) || (op == PL0B_RETV && pp->nResults != 1))
+            return false;
+    }
+
+    /* nothing runs on past the procedure's code */
+    return op == PL0B_RET || op == PL0B_RETV || op == PL0B_JMP;
+}
+
+static bool
+moduleCheck(Pl0bModule* self, const char* path)
+{
+    const Pl0bHeader* h = self->pMap;
+    const char* p = self->pMap;
+    size_t aCounts[PL0B_SECTION_ENUM_SIZE];
+    char version[32];
+    bool* aTarget;
+    bool bOk = true;
+
+    if (self->mapSize < sizeof(*h) || memcmp(h->magic, PL0B_MAGIC, sizeof(h->magic)) != 0)
+        return bad(path, "not a pl0c module");
+    if (h->format != PL0B_FORMAT)
+        return bad(path, "module format of another pl0c version, recompile it");
+
+    snprintf(version, sizeof(version), "%g", PL0C_VERSION);
+    if (strncmp(h->version, version, sizeof(h->version)) != 0)
+        return bad(path, "compiled by another pl0c version, recompile it");
+
+    if (h->size != self->mapSize)
+        return bad(path, "truncated module");
+    if (h->checksum != hashFNVBytes(p + sizeof(*h), h->size - sizeof(*h), 0xCBF29CE484222325))
+        return bad(path, "checksum mismatch");
+
+    for (int i = 0; i < PL0B_SECTION_ENUM_SIZE; i++)
+    {
+        const Pl0bSection* ps = &h->aSections[i];
+
+        if (ps->offset % PL0B_ALIGN != 0 || ps->offset < sizeof(*h) || ps->offset > h->size ||
+            ps->count > (h->size - ps->offset) / aRecordSizes[i])
+            return bad(path, "malformed section table");
+
+        aCounts[i] = ps->count;
+    }
+
+    self->pHeader = h;
+    self->aPool = (const int64_t*)(p + h->aSections[PL0B_POOL].offset);
+    self->aSymbols = (const Pl0bSymbol*)(p + h->aSections[PL0B_SYMBOLS].offset);
+    self->aProcs = (const Pl0bProc*)(p + h->aSections[PL0B_PROCS].offset);
+    self->aCode = (const Pl0bInstr*)(p + h->aSections[PL0B_CODE].offset);
+    self->aLines = (const Pl0bLine*)(p + h->aSections[PL0B_LINES].offset);
+    self->pStrings = p + h->aSections[PL0B_STRINGS].offset;
+    self->nPool = aCounts[PL0B_POOL];
+    self->nSymbols = aCounts[PL0B_SYMBOLS];
+    self->nProcs = aCounts[PL0B_PROCS];
+    self->nCode = aCounts[PL0B_CODE];
+    self->nLines = aCounts[PL0B_LINES];
+    self->nStrings = aCounts[PL0B_STRINGS];
+
+    if (self->nStrings == 0 || self->pStrings[self->nStrings - 1] != '\0' || h->mainProc >= self->nProcs)
+        return bad(path, "malformed module");
+
+    for (size_t i = 0; i < self->nProcs; i++)
+    {
+        const Pl0bProc* pp = &self->aProcs[i];
+        uint64_t nFixed = (uint64_t)pp->nParams + (pp->depth > 1 ? pp->depth - 1 : 0);
+
+        if (pp->name >= self->nStrings || pp->entry >= pp->end || pp->end > self->nCode || nFixed > pp->nLocals ||
+            pp->nResults > 1 || pp->depth > UINT8_MAX)
+            return bad(path, "malformed procedure table");
+
+        /* every procedure but main is declared in one a level up, so parents end at main */
+        if (i == h->mainProc)
+            bOk = pp->depth == 0 && pp->nParams == 0 && pp->nResults == 0;
+        else
+            bOk = pp->parent < self->nProcs && self->aProcs[pp->parent].depth + 1 == pp->depth;
+
+        if (!bOk)
+            return bad(path, "malformed procedure table");
+    }
+
+    for (size_t i = 0; i < self->nSymbols; i++)
+        if (!symbolCheck(self, &self->aSymbols[i]))
+            return bad(path, "malformed symbol table");
+
+    for (size_t i = 0; i < self->nLines; i++)
+        if (self->aLines[i].pc >= self->nCode || (i > 0 && self->aLines[i].pc < self->aLines[i - 1].pc))
+            return bad(path, "malformed line table");
+
+    if ((aTarget = calloc(self->nCode, sizeof(bool))) == nullptr)
+        LOG_FATAL("calloc failed");
+
+    for (size_t i = 0; i < self->nProcs && bOk; i++)
+        bOk = procCheck(self, i, aTarget);
+
+    free(aTarget);
+
+    return bOk ? true : bad(path, "malformed code");
+}
+
+bool
+pl0bOpen(Pl0bModule* self, const char* path)
+{
+    struct stat st;
+    int fd;
+
+    *self = (Pl0bModule){};
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+    {
+        CERR("pl0run: %s: %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return bad(path, "not a pl0c module");
+    }
+
+    self->pMap = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (self->pMap == MAP_FAILED)
+    {
+        self->pMap = nullptr;
+        CERR("pl0run: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    self->mapSize = st.st_size;
+
+    if (!moduleCheck(self, path))
+    {
+        pl0bClose(self);
+        return false;
+    }
+
+    return true;
+}
+
+void
+pl0bClose(Pl0bModule* self)
+{
+    if (self->pMap)
+        munmap(self->pMap, self->mapSize);
+
+    *self = (Pl0bModule){};
+}
+
+uint32_t
+pl0bLine(const Pl0bModule* self, size_t pc)
+{
+    size_t lo = 0, hi = self->nLines;
+
+    /* the last entry at or before pc */
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (self->aLines[mid].pc <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo > 0 ? self->aLines[lo - 1].line : 0;
+}
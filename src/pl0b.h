@@ -0,0 +1,177 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * .pl0b -- compiled PL/0 modules, as written by `pl0c --bytecode` and run
+ * by pl0run.
+ *
+ * A module is a header followed by sections of fixed-size records, each at
+ * an offset from the start of the file that is a multiple of PL0B_ALIGN, so
+ * that a runner can mmap() it and use the sections in place.  Everything is
+ * in the byte order of the machine that wrote it.  The header names the
+ * compiler version, which has to match the runner's, and a checksum of
+ * everything after it.
+ *
+ * The code is for a stack machine.  A procedure's locals and its operand
+ * stack live in its frame; statements start and end with an empty operand
+ * stack, so jumps and returns only happen there.  A call takes its
+ * arguments from the top of the caller's operands, where they become the
+ * first locals of the callee's frame, and pushes the result if there is one.
+ *
+ * Procedures nest.  A procedure at depth d > 1 has a display after its
+ * parameters: d - 1 locals that point at the frames of the procedures it
+ * is declared in, depth 1 first, which the call fills in.  A variable of
+ * one of them is a load from the display away.
+ */
+
+#define PL0B_MAGIC "PL0B"
+#define PL0B_FORMAT 3
+#define PL0B_ALIGN 8
+
+enum PL0B_SECTION
+{
+    PL0B_POOL, /* int64_t: the constants LIT pushes */
+    PL0B_SYMBOLS, /* Pl0bSymbol: everything the program declares, main first */
+    PL0B_PROCS, /* Pl0bProc: main first, then in the order they are declared */
+    PL0B_CODE, /* Pl0bInstr */
+    PL0B_LINES, /* Pl0bLine: by increasing pc */
+    PL0B_STRINGS, /* NUL-terminated names */
+    PL0B_SECTION_ENUM_SIZE
+};
+
+typedef struct Pl0bSection
+{
+    uint64_t offset;
+    uint64_t count; /* of records, bytes for the strings */
+} Pl0bSection;
+
+typedef struct Pl0bHeader
+{
+    char magic[4];
+    uint32_t format;
+    char version[16]; /* PL0C_VERSION of the compiler that wrote it */
+    uint64_t checksum; /* hashFNVBytes() of everything after the header */
+    uint64_t size; /* of the module, header included */
+    uint32_t nGlobals; /* slots, one per scalar and per array element */
+    uint32_t mainProc;
+    Pl0bSection aSections[PL0B_SECTION_ENUM_SIZE];
+} Pl0bHeader;
+
+enum PL0B_SYM
+{
+    PL0B_SYM_CONST,
+    PL0B_SYM_VAR,
+    PL0B_SYM_ARRAY,
+    PL0B_SYM_PROC,
+    PL0B_SYM_ENUM_SIZE
+};
+
+typedef struct Pl0bSymbol
+{
+    uint32_t name; /* offset in the strings */
+    uint8_t kind;
+    uint8_t depth; /* 0 for globals, the depth of the procedure whose frame holds a local */
+    uint16_t pad;
+    uint32_t proc; /* whose frame holds a local */
+    uint32_t slot; /* of a variable in the globals or the frame, of a procedure in the procedures */
+    int64_t value; /* of a constant, the size of an array */
+} Pl0bSymbol;
+
+typedef struct Pl0bProc
+{
+    uint32_t name;
+    uint32_t entry; /* pc of the first instruction */
+    uint32_t end; /* pc after the last one */
+    uint32_t depth; /* 0 for main, 1 for the procedures it declares, and so on */
+    uint32_t parent; /* the procedure this one is declared in */
+    uint32_t nLocals;
+    uint32_t maxStack; /* operand slots above the locals */
+    uint32_t nParams; /* the first locals, which a call pops from the caller's operands */
+    uint32_t nResults; /* 1 if it returns with RETV and a call pushes the result, 0 */
+} Pl0bProc;
+
+/* `arg` is what the comment after each opcode says, "-" if it isn't used */
+enum PL0B_OP
+{
+    PL0B_LIT, /* pool index: push the constant */
+    PL0B_LDG, /* global slot: push it */
+    PL0B_STG, /* global slot: pop into it */
+    PL0B_LDL, /* local slot */
+    PL0B_STL, /* local slot */
+    PL0B_LDGX, /* symbol of a global array: pop an index, push the element */
+    PL0B_STGX, /* symbol of a global array: pop a value and an index, store the element */
+    PL0B_LDLX, /* symbol of a local array */
+    PL0B_STLX, /* symbol of a local array */
+    PL0B_LDU, /* symbol of a variable of an enclosing procedure: push it */
+    PL0B_STU, /* symbol of a variable of an enclosing procedure: pop into it */
+    PL0B_LDUX, /* symbol of an array of an enclosing procedure */
+    PL0B_STUX, /* symbol of an array of an enclosing procedure */
+    PL0B_NEG, /* - */
+    PL0B_ADD, /* -: the operations pop two, push one */
+    PL0B_SUB,
+    PL0B_MUL,
+    PL0B_DIV,
+    PL0B_ODD, /* -: pops one, pushes one */
+    PL0B_EQ,
+    PL0B_NE,
+    PL0B_LT,
+    PL0B_GT,
+    PL0B_JMP, /* pc */
+    PL0B_JZ, /* pc: pop, jump if it is 0 */
+    PL0B_CALL, /* procedure: pops its parameters, pushes its results */
+    PL0B_RET, /* -: from main it ends the program */
+    PL0B_WRITEINT, /* -: pop and write */
+    PL0B_WRITECHAR,
+    PL0B_READINT, /* -: read and push */
+    PL0B_READCHAR,
+    PL0B_WRITESTR, /* symbol of an array: write it up to its first 0 */
+    PL0B_POP, /* -: drop the result of a call */
+    PL0B_RETV, /* -: pop the result and return it */
+    PL0B_OP_ENUM_SIZE
+};
+
+typedef struct Pl0bInstr
+{
+    uint8_t op;
+    uint8_t pad[3];
+    uint32_t arg;
+} Pl0bInstr;
+
+typedef struct Pl0bLine
+{
+    uint32_t pc; /* the first instruction from this line */
+    uint32_t line;
+} Pl0bLine;
+
+/* a module's sections, in place in a mapped file or in the compiler's arrays */
+typedef struct Pl0bModule
+{
+    const Pl0bHeader* pHeader;
+    const int64_t* aPool;
+    const Pl0bSymbol* aSymbols;
+    const Pl0bProc* aProcs;
+    const Pl0bInstr* aCode;
+    const Pl0bLine* aLines;
+    const char* pStrings;
+    size_t nPool, nSymbols, nProcs, nCode, nLines, nStrings;
+    void* pMap;
+    size_t mapSize;
+} Pl0bModule;
+
+/* how many operands `op` leaves on the stack, minus how many it takes */
+int pl0bStackEffect(int op);
+
+/* writes the sections of `pMod` as a module, returns its size */
+size_t pl0bWrite(FILE* fp, const Pl0bModule* pMod, uint32_t nGlobals, uint32_t mainProc);
+
+/*
+ * Maps the module at `path` and checks it throughout, so that running it
+ * needs no checks beyond array indices, division and call depth.  Says why
+ * on stderr and returns false if it can't be run.
+ */
+bool pl0bOpen(Pl0bModule* self, const char* path);
+void pl0bClose(Pl0bModule* self);
+
+/* the source line of the instruction at `pc` */
+uint32_t pl0bLine(const Pl0bModule* self, size_t pc);
@@ -0,0 +1,107 @@
+#pragma once
+#include "logs.h"
+#include "adt/list.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+
+/*
+ * What the parts of pl0c share: symbols, the parser's position and its
+ * errors.  main.c owns all of it, bcgen.c and deps.c read the position
+ * and fill in their fields of the symbols.
+ */
+
+typedef struct SymNode
+{
+    int depth;
+    int type;
+    long size;
+    long value; /* of a constant, -1 if it doesn't fit a long */
+    int nParams; /* of a function */
+    bool bResult; /* a procedure with a parameter list, which returns a value */
+    bool bFrame; /* a procedure that declares procedures, which reach its variables through a frame */
+    char* params; /* of a procedure, its C parameter list with the display last, nullptr if empty */
+    char* cname; /* of a nested procedure, its name in C, nullptr if it is `name` */
+    const struct SymNode* pParent; /* of a nested procedure, the procedure it is declared in */
+    struct Effects* pEff; /* --memoize: of a procedure, what it does to the globals */
+    bool bMemo; /* --memoize: its callers go through a cache of its results, see cgMemo() */
+    uint32_t iSym; /* --bytecode: in the module's symbol table */
+    char* name;
+} SymNode;
+
+static inline int
+SymNodeCmp(const SymNode n0, const SymNode n1)
+{
+    return strcmp(n0.name, n1.name);
+}
+
+LIST_GEN_CODE(SymList, SymNode, SymNodeCmp);
+
+/* a growable run of bytes */
+typedef struct Bytes
+{
+    char* pData;
+    size_t size;
+    size_t capacity;
+} Bytes;
+
+static inline void
+bytesPut(Bytes* self, const void* p, size_t n)
+{
+    if (self->size + n > self->capacity)
+    {
+        self->capacity = (self->size + n) * 2;
+        if ((self->pData = realloc(self->pData, self->capacity)) == nullptr)
+            LOG_FATAL("realloc failed");
+    }
+
+    memcpy(self->pData + self->size, p, n);
+    self->size += n;
+}
+
+/* a position in the tokens lexed ahead, see cursorNext() */
+typedef struct TokenCursor
+{
+    size_t iRun;
+    size_t iToken;
+} TokenCursor;
+
+/* a statement `var := value` */
+typedef struct RangeInit
+{
+    const SymListNode* pVar;
+    long value;
+} RangeInit;
+
+/*
+ * `while var < bound do begin ...; var := var + step end`, emitted as a for
+ * loop over a local copy of var that C compilers can vectorize
+ */
+typedef struct CountedLoop
+{
+    const SymListNode* pVar;
+    size_t stepAt; /* the first token of `var := var + step` */
+    long step;
+    const SymListNode* pBound; /* a variable, or nullptr and the bound is `bound` */
+    long bound;
+} CountedLoop;
+
+extern thread_local char* token;
+extern thread_local int type;
+extern thread_local size_t line;
+extern thread_local size_t prevLine; /* of the token next() moved past */
+extern thread_local SymListNode* pProcSym; /* of the procedure being compiled, nullptr in main */
+extern thread_local TokenCursor cur; /* the token after the current one */
+extern thread_local bool bTokens; /* the parser reads tokens lexed ahead, which cursors can look at */
+extern thread_local bool bInstrument;
+
+/* reports an error at the current line and unwinds the compilation */
+void compileError(const char* fmt, ...);
+
+int scopeLevel(void);
+SymListNode* symLookup(const char* name);
+const SymListNode* symFind(const char* p, size_t len);
+int cursorNext(TokenCursor* pc, const char** ppText, size_t* pLen);
+bool isStatementEnd(int kind);
+long rangeValue(int kind, const char* p, size_t len);
@@ -333,7 +333,7 @@ static void
 cg_end(void)
 {
 
-	aout("/* PL/0 compiler %s */\n", PL0C_VERSION);
+	aout("/* PL/0 compiler %g */\n", PL0C_VERSION);
 }
 
 static void
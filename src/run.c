@@ -0,0 +1,168 @@
+#include "misc.h"
+#include "pl0b.h"
+#include "vm.h"
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * pl0run -- runs modules compiled with `pl0c --bytecode`.
+ *
+ * The module is mapped and used in place, so a program starts without
+ * lexing, parsing or relocating anything.  It is interpreted until a loop
+ * or a procedure turns out to be hot, which then runs as native code (see
+ * vmRun()); --no-jit keeps to the interpreter.  With --dump it lists the
+ * module instead.
+ */
+
+static const char* opStrings[] = {
+    "lit", "ldg", "stg", "ldl", "stl", "ldgx", "stgx", "ldlx", "stlx", "ldu", "stu", "ldux", "stux", "neg",
+    "add", "sub", "mul", "div", "odd", "eq", "ne", "lt", "gt", "jmp", "jz", "call", "ret", "writeint",
+    "writechar", "readint", "readchar", "writestr", "pop", "retv",
+};
+
+static const char* symStrings[] = {"const", "var", "array", "procedure"};
+
+static_assert(LENGTH(opStrings) == PL0B_OP_ENUM_SIZE);
+static_assert(LENGTH(symStrings) == PL0B_SYM_ENUM_SIZE);
+
+static void
+dump(const Pl0bModule* pMod)
+{
+    const Pl0bHeader* h = pMod->pHeader;
+    size_t iLine;
+
+    printf("pl0c %.16s module, %zu bytes, %u global slots\n", h->version, (size_t)h->size, h->nGlobals);
+
+    printf("\nsymbols:\n");
+    for (size_t i = 0; i < pMod->nSymbols; i++)
+    {
+        const Pl0bSymbol* ps = &pMod->aSymbols[i];
+        printf("%6zu %-9s %-16s depth %u slot %u", i, symStrings[ps->kind], pMod->pStrings + ps->name, ps->depth,
+               ps->slot);
+        if (ps->kind == PL0B_SYM_CONST || ps->kind == PL0B_SYM_ARRAY)
+            printf(" %s %ld", ps->kind == PL0B_SYM_CONST ? "value" : "size", (long)ps->value);
+        printf("\n");
+    }
+
+    for (size_t i = 0; i < pMod->nProcs; i++)
+    {
+        const Pl0bProc* pp = &pMod->aProcs[i];
+        printf("\nprocedure %zu %s: depth %u, %u parameters, %u locals, %u operands%s\n", i,
+               pMod->pStrings + pp->name, pp->depth, pp->nParams, pp->nLocals, pp->maxStack,
+               pp->nResults ? ", returns a value" : "");
+
+        /* procedures are listed as declared, their code is in the order it was compiled */
+        for (iLine = 0; iLine < pMod->nLines && pMod->aLines[iLine].pc < pp->entry;)
+            iLine++;
+
+        for (size_t pc = pp->entry; pc < pp->end; pc++)
+        {
+            const Pl0bInstr* pi = &pMod->aCode[pc];
+
+            while (iLine < pMod->nLines && pMod->aLines[iLine].pc <= pc)
+                printf("  ; line %u\n", pMod->aLines[iLine++].line);
+
+            printf("%6zu  %-10s", pc, opStrings[pi->op]);
+            switch (pi->op)
+            {
+                case PL0B_LIT:
+                    printf(" %ld", (long)pMod->aPool[pi->arg]);
+                    break;
+
+                case PL0B_LDGX:
+                case PL0B_STGX:
+                case PL0B_LDLX:
+                case PL0B_STLX:
+                case PL0B_LDU:
+                case PL0B_STU:
+                case PL0B_LDUX:
+                case PL0B_STUX:
+                case PL0B_WRITESTR:
+                    printf(" %s", pMod->pStrings + pMod->aSymbols[pi->arg].name);
+                    break;
+
+                case PL0B_CALL:
+                    printf(" %s", pMod->pStrings + pMod->aProcs[pi->arg].name);
+                    break;
+
+                case PL0B_LDG:
+                case PL0B_STG:
+                case PL0B_LDL:
+                case PL0B_STL:
+                case PL0B_JMP:
+                case PL0B_JZ:
+                    printf(" %u", pi->arg);
+                    break;
+            }
+            printf("\n");
+        }
+    }
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: pl0run [--dump] [--no-jit] [--stats] module.pl0b\n");
+    exit(1);
+}
+
+int
+main(int argc, char* argv[])
+{
+    int ch, status;
+    bool bDump = false;
+    VmOptions opts = {.bJit = true};
+    Pl0bModule mod;
+
+    static const struct option aOpts[] = {
+        {"dump", no_argument, nullptr, 'd'},
+        {"no-jit", no_argument, nullptr, 'i'},
+        {"stats", no_argument, nullptr, 's'},
+        {}
+    };
+
+    while ((ch = getopt_long(argc, argv, "", aOpts, nullptr)) != -1)
+    {
+        switch (ch)
+        {
+            case 'd':
+                bDump = true;
+                break;
+
+            case 'i':
+                opts.bJit = false;
+                break;
+
+            case 's':
+                opts.bStats = true;
+                break;
+
+            default:
+                usage();
+        }
+    }
+
+    if (optind != argc - 1)
+        usage();
+
+    if (!pl0bOpen(&mod, argv[optind]))
+        return 1;
+
+    if (bDump)
+    {
+        dump(&mod);
+        status = 0;
+    }
+    else
+    {
+        status = vmRun(&mod, &opts);
+    }
+
+    pl0bClose(&mod);
+
+    return status;
+}
@@ -0,0 +1,373 @@
+#include "server.h"
+#include "logs.h"
+#include "adt/threadpool.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Protocol.  A request is a header of "key value" lines ended by an empty
+ * line, followed by inline source if the header says so:
+ *
+ *	pl0c <version>
+ *	stats 0|1
+ *	instrument 0|1
+ *	profile <path>		(optional)
+ *	cache <dir>		(optional)
+ *	cache-size <bytes>	(with cache, more than 0)
+ *	path <path> | source <size>	(size at most SERVER_MAX_SOURCE)
+ *
+ *	[<size> bytes of source]
+ *
+ * Paths are absolute, the client resolves them against its own working
+ * directory.  The reply is "status <n>", "out <size>" and the generated C,
+ * then "err <size>" and the diagnostics.
+ */
+
+static const char* serverSockPath;
+
+static void
+onSignal(int sig)
+{
+    (void)sig;
+    unlink(serverSockPath);
+    _exit(0);
+}
+
+static bool
+writeAll(int fd, const char* p, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool
+copyN(FILE* from, FILE* to, size_t size)
+{
+    char buf[1 << 16];
+
+    while (size > 0)
+    {
+        size_t n = fread(buf, 1, size < sizeof(buf) ? size : sizeof(buf), from);
+        if (n == 0)
+            return false;
+
+        fwrite(buf, 1, n, to);
+        size -= n;
+    }
+
+    return true;
+}
+
+static int
+serveConn(void* pArg)
+{
+    int fd = (int)(intptr_t)pArg;
+    FILE* fpIn;
+    FILE* fpReplyOut, * fpReplyErr;
+    char* pReplyOut = nullptr, * pReplyErr = nullptr;
+    size_t replyOutSize = 0, replyErrSize = 0;
+    char* pLine = nullptr;
+    size_t lineCap = 0;
+    ssize_t len;
+    char version[32];
+    char* path = nullptr, * profPath = nullptr, * cacheDir = nullptr;
+    char* src = nullptr;
+    size_t srcSize = 0;
+    bool bSource = false, bVersion = false, bBad = false, bNoMem = false;
+    int status = 1;
+    Options opts = {};
+
+    if ((fpIn = fdopen(dup(fd), "r")) == nullptr)
+    {
+        close(fd);
+        return 0;
+    }
+
+    if ((fpReplyOut = open_memstream(&pReplyOut, &replyOutSize)) == nullptr ||
+        (fpReplyErr = open_memstream(&pReplyErr, &replyErrSize)) == nullptr)
+        LOG_FATAL("open_memstream failed");
+
+    snprintf(version, sizeof(version), "%g", PL0C_VERSION);
+
+    while ((len = getline(&pLine, &lineCap, fpIn)) > 0 && pLine[0] != '\n')
+    {
+        char* val;
+
+        pLine[len - 1] = '\0';
+        if ((val = strchr(pLine, ' ')) == nullptr)
+        {
+            bBad = true;
+            break;
+        }
+        *val++ = '\0';
+
+        if (!strcmp(pLine, "pl0c"))
+            bVersion = !strcmp(val, version);
+        else if (!strcmp(pLine, "stats"))
+            opts.bStats = *val == '1';
+        else if (!strcmp(pLine, "instrument"))
+            opts.bInstrument = *val == '1';
+        else if (!strcmp(pLine, "safe"))
+            opts.bSafe = *val == '1';
+        else if (!strcmp(pLine, "parallel"))
+            opts.bParallel = *val == '1';
+        else if (!strcmp(pLine, "memoize"))
+            opts.bMemoize = *val == '1';
+        else if (!strcmp(pLine, "unroll"))
+            opts.unroll = strtoull(val, nullptr, 10);
+        else if (!strcmp(pLine, "bytecode"))
+            opts.bBytecode = *val == '1';
+        else if (!strcmp(pLine, "executable"))
+            opts.bExecutable = *val == '1';
+        else if (!strcmp(pLine, "evaluate"))
+            opts.evalSteps = strtoull(val, nullptr, 10);
+        else if (!strcmp(pLine, "profile"))
+            opts.profPath = profPath = strdup(val);
+        else if (!strcmp(pLine, "cache"))
+            opts.cacheDir = cacheDir = strdup(val);
+        else if (!strcmp(pLine, "cache-size"))
+            opts.cacheMaxBytes = strtoull(val, nullptr, 10);
+        else if (!strcmp(pLine, "path"))
+            path = strdup(val);
+        else if (!strcmp(pLine, "source"))
+            bSource = true, srcSize = strtoull(val, nullptr, 10);
+        else
+            bBad = true;
+    }
+
+    /* the size comes from the client: no wrapping around in srcSize + 1, nor more than the server will hold */
+    if (bSource && srcSize > SERVER_MAX_SOURCE)
+        bBad = true;
+    /* a cache of 0 bytes would be emptied by every store */
+    if (opts.cacheDir && opts.cacheMaxBytes == 0)
+        bBad = true;
+
+    if (bSource && !bBad)
+    {
+        if ((src = malloc(srcSize + 1)) == nullptr)
+            bNoMem = true;
+        else if (fread(src, 1, srcSize, fpIn) != srcSize)
+            bBad = true;
+        else
+            src[srcSize] = '\0';
+    }
+
+    if (!bVersion)
+        fprintf(fpReplyErr, "pl0c: server: client and server versions differ\n");
+    else if (bNoMem)
+        fprintf(fpReplyErr, "pl0c: server: out of memory for %zu bytes of source\n", srcSize);
+    else if (bBad || (path == nullptr) == (src == nullptr))
+        fprintf(fpReplyErr, "pl0c: server: malformed request\n");
+    else
+    {
+        status = compile(&opts, path, src, srcSize, fpReplyOut, fpReplyErr);
+        src = nullptr; /* compile() owns it */
+    }
+
+    fclose(fpReplyOut);
+    fclose(fpReplyErr);
+
+    /* the client might be gone, which is its problem */
+    dprintf(fd, "status %d\nout %zu\n", status, replyOutSize);
+    writeAll(fd, pReplyOut, replyOutSize);
+    dprintf(fd, "err %zu\n", replyErrSize);
+    writeAll(fd, pReplyErr, replyErrSize);
+
+    fclose(fpIn);
+    close(fd);
+
+    free(src);
+    free(path);
+    free(profPath);
+    free(cacheDir);
+    free(pLine);
+    free(pReplyOut);
+    free(pReplyErr);
+
+    return 0;
+}
+
+static bool
+sockAddr(struct sockaddr_un* pAddr, const char* sockPath)
+{
+    *pAddr = (struct sockaddr_un){.sun_family = AF_UNIX};
+
+    if (strlen(sockPath) >= sizeof(pAddr->sun_path))
+        return false;
+
+    strcpy(pAddr->sun_path, sockPath);
+
+    return true;
+}
+
+int
+serverRun(const char* sockPath, long nJobs)
+{
+    struct sockaddr_un addr;
+    int sfd;
+
+    if (!sockAddr(&addr, sockPath))
+    {
+        CERR("pl0c: server: socket path too long: %s\n", sockPath);
+        return 1;
+    }
+
+    if ((sfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        CERR("pl0c: server: socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    unlink(sockPath); /* left over from a server that was killed */
+
+    if (bind(sfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sfd, SOMAXCONN) == -1)
+    {
+        CERR("pl0c: server: %s: %s\n", sockPath, strerror(errno));
+        close(sfd);
+        return 1;
+    }
+
+    serverSockPath = sockPath;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    ThreadPool tp = ThreadPoolCreate(nJobs > 0 ? (size_t)nJobs : (size_t)hwConcurrency());
+    ThreadPoolStart(&tp);
+
+    while (true)
+    {
+        int fd = accept(sfd, nullptr, nullptr);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            CERR("pl0c: server: accept: %s\n", strerror(errno));
+            break;
+        }
+
+        ThreadPoolSubmit(&tp, (TaskNode){.pFn = serveConn, .pArg = (void*)(intptr_t)fd});
+    }
+
+    ThreadPoolWait(&tp);
+    ThreadPoolStop(&tp);
+    ThreadPoolClean(&tp);
+    close(sfd);
+    unlink(sockPath);
+
+    return 1;
+}
+
+/* `path` as seen from the server, which doesn't share our working directory */
+static void
+putPath(FILE* fp, const char* key, const char* path)
+{
+    char cwd[PATH_MAX];
+
+    if (path[0] == '/' || getcwd(cwd, sizeof(cwd)) == nullptr)
+        fprintf(fp, "%s %s\n", key, path);
+    else
+        fprintf(fp, "%s %s/%s\n", key, cwd, path);
+}
+
+int
+clientRun(const char* sockPath, const Options* pOpts, const char* path, FILE* out)
+{
+    struct sockaddr_un addr;
+    int fd, status;
+    char* pReq = nullptr, * src = nullptr;
+    size_t reqSize = 0, srcSize = 0, size;
+    FILE* fpReq, * fpReply;
+
+    if (!strcmp(path, "-"))
+        src = readAll(stdin, &srcSize);
+
+    if (srcSize > SERVER_MAX_SOURCE || !sockAddr(&addr, sockPath) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        return compile(pOpts, path, src, srcSize, out, stderr);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return compile(pOpts, path, src, srcSize, out, stderr);
+    }
+
+    if ((fpReq = open_memstream(&pReq, &reqSize)) == nullptr)
+        LOG_FATAL("open_memstream failed");
+
+    fprintf(fpReq, "pl0c %g\n", PL0C_VERSION);
+    fprintf(fpReq, "stats %d\n", pOpts->bStats);
+    fprintf(fpReq, "instrument %d\n", pOpts->bInstrument);
+    fprintf(fpReq, "safe %d\n", pOpts->bSafe);
+    fprintf(fpReq, "parallel %d\n", pOpts->bParallel);
+    fprintf(fpReq, "memoize %d\n", pOpts->bMemoize);
+    fprintf(fpReq, "unroll %zu\n", pOpts->unroll);
+    fprintf(fpReq, "bytecode %d\n", pOpts->bBytecode);
+    fprintf(fpReq, "executable %d\n", pOpts->bExecutable);
+    fprintf(fpReq, "evaluate %zu\n", pOpts->evalSteps);
+    if (pOpts->profPath)
+        putPath(fpReq, "profile", pOpts->profPath);
+    if (pOpts->cacheDir)
+        putPath(fpReq, "cache", pOpts->cacheDir);
+    fprintf(fpReq, "cache-size %zu\n", pOpts->cacheMaxBytes);
+    if (src)
+        fprintf(fpReq, "source %zu\n\n", srcSize);
+    else
+    {
+        putPath(fpReq, "path", path);
+        fprintf(fpReq, "\n");
+    }
+    fclose(fpReq);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!writeAll(fd, pReq, reqSize) || (src && !writeAll(fd, src, srcSize)))
+    {
+        CERR("pl0c: client: couldn't send request: %s\n", strerror(errno));
+        close(fd);
+        free(pReq);
+        free(src);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    free(pReq);
+    free(src);
+
+    if ((fpReply = fdopen(fd, "r")) == nullptr)
+        LOG_FATAL("fdopen failed");
+
+    /* the payloads may start with whitespace, so the newline is read by hand */
+    if (fscanf(fpReply, "status %d out %zu", &status, &size) != 2 || fgetc(fpReply) != '\n' ||
+        !copyN(fpReply, out, size) ||
+        fscanf(fpReply, "err %zu", &size) != 1 || fgetc(fpReply) != '\n' ||
+        !copyN(fpReply, stderr, size))
+    {
+        CERR("pl0c: client: malformed reply\n");
+        status = 1;
+    }
+
+    fclose(fpReply);
+
+    return status;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "compile.h"
+
+#define SERVER_MAX_JOBS 1024
+#define SERVER_MAX_SOURCE ((size_t)1 << 30) /* bytes of inline source a request may send */
+
+/*
+ * Persistent compile server: listens on a Unix domain socket and compiles
+ * each request on a thread pool with the tables built once at startup.
+ * `nJobs` of 0 means one thread per CPU.  Runs until SIGINT or SIGTERM.
+ */
+int serverRun(const char* sockPath, long nJobs);
+
+/*
+ * Sends a compilation to the server and relays its output to `out`, its
+ * diagnostics and its exit status.  Compiles locally if no server is
+ * listening.  A `path` of "-" sends stdin.
+ */
+int clientRun(const char* sockPath, const Options* pOpts, const char* path, FILE* out);
@@ -22,7 +22,12 @@ initTokenHashMap()
     TokenMapInsert(&hmTokens, (StrToken){.str = "writeChar", .token = TOK_WRITECHAR});
     TokenMapInsert(&hmTokens, (StrToken){.str = "readInt", .token = TOK_READINT});
     TokenMapInsert(&hmTokens, (StrToken){.str = "readChar", .token = TOK_READCHAR});
+    TokenMapInsert(&hmTokens, (StrToken){.str = "writeStr", .token = TOK_WRITESTR});
     TokenMapInsert(&hmTokens, (StrToken){.str = "into", .token = TOK_INTO});
+    TokenMapInsert(&hmTokens, (StrToken){.str = "size", .token = TOK_SIZE});
+    TokenMapInsert(&hmTokens, (StrToken){.str = "return", .token = TOK_RETURN});
+    TokenMapInsert(&hmTokens, (StrToken){.str = "forall", .token = TOK_FORALL});
+    TokenMapInsert(&hmTokens, (StrToken){.str = "to", .token = TOK_TO});
 }
 
 void
@@ -66,10 +66,14 @@ TokenMapSearchValue(TokenMap* self, char* key)
 #define TOK_RBRACK ']'
 #define TOK_WRITESTR 'S'
 #define TOK_STRING '"'
+#define TOK_RETURN 'r'
+#define TOK_FORALL 'F'
+#define TOK_TO 't'
+#define TOK_LEXERROR '!' /* where lexing failed, only in pre-lexed tokens */
 
 extern TokenMap hmTokens;
 
-static const char* tokenStrings[] = {
+[[maybe_unused]] static const char* tokenStrings[] = {
     [TOK_IDENT] = "IDENT",
     [TOK_NUMBER] = "NUMBER",
     [TOK_CONST] = "CONST",
@@ -101,10 +105,16 @@ static const char* tokenStrings[] = {
     [TOK_WRITECHAR] = "writeChar",
     [TOK_READINT] = "readInt",
     [TOK_READCHAR] = "readChar",
+    [TOK_WRITESTR] = "writeStr",
+    [TOK_STRING] = "STRING",
     [TOK_INTO] = "into",
     [TOK_SIZE] = "SIZE",
     [TOK_LBRACK] = "LBRACK",
     [TOK_RBRACK] = "RBRACK",
+    [TOK_RETURN] = "RETURN",
+    [TOK_FORALL] = "FORALL",
+    [TOK_TO] = "TO",
+    [TOK_LEXERROR] = "LEXERROR",
 };
 
 void initTokenHashMap();
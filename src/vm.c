@@ -0,0 +1,491 @@
+#include "vm.h"
+#include "jit.h"
+#include "logs.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+/* the same buffered I/O as compiled programs */
+#define PL0RT_MAIN
+#include "pl0rt.h"
+
+#define VM_MARK PL0B_OP_ENUM_SIZE /* a breakpoint of a run at compile time, never in a module */
+
+typedef struct Frame
+{
+    const Pl0bInstr* pRet;
+    long* aLocals;
+    uint32_t proc;
+} Frame;
+
+[[noreturn]] static void
+vmError(const Pl0bModule* pMod, const Pl0bInstr* pi, const char* fmt, ...)
+{
+    va_list ap;
+
+    __pl0_flush();
+
+    fprintf(stderr, "line %u: ", pl0bLine(pMod, pi - pMod->aCode));
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+
+    exit(1);
+}
+
+/* appends to the output of a run at compile time, false once it is over the limit */
+static bool
+evalPut(VmEval* pe, const char* p, size_t n)
+{
+    if (n > pe->maxOutput - pe->outSize)
+        return false;
+
+    if (pe->outSize + n > pe->outCap)
+    {
+        pe->outCap = pe->outCap ? pe->outCap * 2 : 4096;
+        if (pe->outCap < pe->outSize + n)
+            pe->outCap = pe->outSize + n;
+        if ((pe->pOut = realloc(pe->pOut, pe->outCap)) == nullptr)
+            LOG_FATAL("realloc failed");
+    }
+
+    memcpy(pe->pOut + pe->outSize, p, n);
+    pe->outSize += n;
+
+    return true;
+}
+
+/*
+ * Everything starts in the interpreter, which counts the back-edges into each
+ * loop and the calls of each procedure.  Once a loop or a procedure is hot,
+ * its procedure is compiled, and from then on execution moves to native code
+ * wherever that procedure is reached: at a back-edge in the middle of a loop,
+ * on a call or on the return from one.
+ *
+ * With pOpts->pEval the same loop runs a module at compile time instead:
+ * output goes to memory, nothing is compiled, and the run stops, rather
+ * than failing or waiting, at the first input, the first error, or once the
+ * budget is spent.
+ */
+static inline __attribute__((always_inline)) int
+vmExecute(const Pl0bModule* pMod, const VmOptions* pOpts, VmEval* pEval)
+{
+    const Pl0bInstr* aCode = pMod->aCode;
+    Pl0bInstr* aPatched = nullptr; /* the code with breakpoints at the marks */
+    uint8_t* aMarkOps = nullptr; /* the instructions they replace */
+    size_t nextMark = 0;
+    const Pl0bSymbol* aSyms = pMod->aSymbols;
+    const int64_t* aPool = pMod->aPool;
+    const Pl0bProc* pMain = &pMod->aProcs[pMod->pHeader->mainProc];
+    size_t nGlobals = pMod->pHeader->nGlobals;
+    long* aGlobals = calloc(nGlobals + 1, sizeof(long));
+    long* aStack = malloc(VM_STACK_SLOTS * sizeof(long));
+    Frame* aFrames = malloc(VM_MAX_CALLS * sizeof(Frame));
+    uint32_t* aHeat = calloc(pMod->nCode, sizeof(uint32_t)); /* by loop head and procedure entry */
+    Jit* pJit = pOpts->bJit && pEval == nullptr ? jitCreate(pMod) : nullptr;
+    size_t nFrames = 0;
+    const Pl0bInstr* pc;
+    size_t steps = 0, maxSteps = pEval != nullptr ? pEval->maxSteps : SIZE_MAX;
+    uint32_t proc = pMod->pHeader->mainProc;
+    long* aLocals = aStack;
+    long* sp;
+    long* p;
+
+    if (aGlobals == nullptr || aStack == nullptr || aFrames == nullptr || aHeat == nullptr)
+        LOG_FATAL("malloc failed");
+
+    if (pEval != nullptr)
+    {
+        pEval->status = VM_DONE;
+        pEval->mark = 0;
+        pEval->outSize = pEval->outMark = 0;
+        if ((pEval->aGlobals = calloc(nGlobals + 1, sizeof(long))) == nullptr)
+            LOG_FATAL("malloc failed");
+
+        aPatched = malloc(pMod->nCode * sizeof(Pl0bInstr));
+        aMarkOps = malloc(pEval->nMarks + 1);
+        if (aPatched == nullptr || aMarkOps == nullptr)
+            LOG_FATAL("malloc failed");
+
+        memcpy(aPatched, pMod->aCode, pMod->nCode * sizeof(Pl0bInstr));
+        for (size_t i = 0; i < pEval->nMarks; i++)
+            aMarkOps[i] = aPatched[pEval->aMarks[i]].op;
+        for (size_t i = 0; i < pEval->nMarks; i++)
+            aPatched[pEval->aMarks[i]].op = VM_MARK;
+        aCode = aPatched;
+    }
+
+    pc = &aCode[pMain->entry];
+
+/* stops a run at compile time with `why`, or fails the program */
+#define VM_FAIL(...)                                                                                                  \
+    do                                                                                                                \
+    {                                                                                                                 \
+        if (pEval != nullptr)                                                                                         \
+        {                                                                                                             \
+            pEval->status = VM_ERROR;                                                                                 \
+            goto done;                                                                                                \
+        }                                                                                                             \
+        vmError(pMod, pi, __VA_ARGS__);                                                                               \
+    } while (0)
+
+#define VM_STOP(why)                                                                                                  \
+    do                                                                                                                \
+    {                                                                                                                 \
+        pEval->status = (why);                                                                                        \
+        goto done;                                                                                                    \
+    } while (0)
+
+/* the frame of the procedure at the local `ps`'s depth that the current one is declared in, from its display */
+#define VM_OUTER(ps) ((long*)(intptr_t)aLocals[pMod->aProcs[proc].nParams + (ps)->depth - 1])
+
+/* points `p` at element `i` of the array pi->arg, whose slots start at `aSlots` */
+#define VM_ELEMENT(aSlots, i)                                                                                         \
+    do                                                                                                                \
+    {                                                                                                                 \
+        const Pl0bSymbol* ps = &aSyms[pi->arg];                                                                       \
+        if (__builtin_expect((unsigned long)(i) >= (unsigned long)ps->value, 0))                                      \
+            VM_FAIL("index %ld out of bounds for size %ld", (long)(i), (long)ps->value);                             \
+        p = &(aSlots)[ps->slot + (i)];                                                                                \
+    } while (0)
+
+    if ((size_t)pMain->nLocals + pMain->maxStack > VM_STACK_SLOTS)
+    {
+        const Pl0bInstr* pi = pc;
+        VM_FAIL("stack overflow");
+    }
+    memset(aLocals, 0, pMain->nLocals * sizeof(long));
+    sp = aLocals + pMain->nLocals;
+
+/* continues at `pc` in native code if the current procedure has it, or gets it now that `heat` says so */
+#define VM_TIER_UP(heat)                                                                                              \
+    do                                                                                                                \
+    {                                                                                                                 \
+        if (pJit != nullptr && (jitReady(pJit, proc) || ((heat) >= VM_HOT && jitCompile(pJit, proc))))               \
+            pc = &aCode[jitRun(pJit, proc, pc - aCode, &sp, aLocals, aGlobals)];                                      \
+    } while (0)
+
+    for (;;)
+    {
+        const Pl0bInstr* pi = pc++;
+
+        switch (pi->op)
+        {
+            case PL0B_LIT:
+                *sp++ = aPool[pi->arg];
+                break;
+
+            case PL0B_LDG:
+                *sp++ = aGlobals[pi->arg];
+                break;
+
+            case PL0B_STG:
+                aGlobals[pi->arg] = *--sp;
+                break;
+
+            case PL0B_LDL:
+                *sp++ = aLocals[pi->arg];
+                break;
+
+            case PL0B_STL:
+                aLocals[pi->arg] = *--sp;
+                break;
+
+            case PL0B_LDGX:
+                VM_ELEMENT(aGlobals, sp[-1]);
+                sp[-1] = *p;
+                break;
+
+            case PL0B_STGX:
+                VM_ELEMENT(aGlobals, sp[-2]);
+                *p = sp[-1];
+                sp -= 2;
+                break;
+
+            case PL0B_LDLX:
+                VM_ELEMENT(aLocals, sp[-1]);
+                sp[-1] = *p;
+                break;
+
+            case PL0B_STLX:
+                VM_ELEMENT(aLocals, sp[-2]);
+                *p = sp[-1];
+                sp -= 2;
+                break;
+
+            case PL0B_LDU:
+            {
+                const Pl0bSymbol* ps = &aSyms[pi->arg];
+                *sp++ = VM_OUTER(ps)[ps->slot];
+                break;
+            }
+
+            case PL0B_STU:
+            {
+                const Pl0bSymbol* ps = &aSyms[pi->arg];
+                VM_OUTER(ps)[ps->slot] = *--sp;
+                break;
+            }
+
+            case PL0B_LDUX:
+                VM_ELEMENT(VM_OUTER(&aSyms[pi->arg]), sp[-1]);
+                sp[-1] = *p;
+                break;
+
+            case PL0B_STUX:
+                VM_ELEMENT(VM_OUTER(&aSyms[pi->arg]), sp[-2]);
+                *p = sp[-1];
+                sp -= 2;
+                break;
+
+            /* wrapping around like the C compilers pl0c targets do in practice */
+            case PL0B_NEG:
+                sp[-1] = -(unsigned long)sp[-1];
+                break;
+
+            case PL0B_ADD:
+                --sp;
+                sp[-1] = (unsigned long)sp[-1] + (unsigned long)sp[0];
+                break;
+
+            case PL0B_SUB:
+                --sp;
+                sp[-1] = (unsigned long)sp[-1] - (unsigned long)sp[0];
+                break;
+
+            case PL0B_MUL:
+                --sp;
+                sp[-1] = (unsigned long)sp[-1] * (unsigned long)sp[0];
+                break;
+
+            case PL0B_DIV:
+                --sp;
+                if (sp[0] == 0)
+                    VM_FAIL("division by zero");
+                sp[-1] = sp[0] == -1 ? (long)-(unsigned long)sp[-1] : sp[-1] / sp[0];
+                break;
+
+            case PL0B_ODD:
+                sp[-1] &= 1;
+                break;
+
+            case PL0B_EQ:
+                --sp;
+                sp[-1] = sp[-1] == sp[0];
+                break;
+
+            case PL0B_NE:
+                --sp;
+                sp[-1] = sp[-1] != sp[0];
+                break;
+
+            case PL0B_LT:
+                --sp;
+                sp[-1] = sp[-1] < sp[0];
+                break;
+
+            case PL0B_GT:
+                --sp;
+                sp[-1] = sp[-1] > sp[0];
+                break;
+
+            case PL0B_JMP:
+                pc = &aCode[pi->arg];
+                if (pc <= pi)
+                {
+                    if (pEval != nullptr && ++steps > maxSteps)
+                        VM_STOP(VM_BUDGET);
+                    VM_TIER_UP(++aHeat[pi->arg]);
+                }
+                break;
+
+            case PL0B_JZ:
+                if (*--sp == 0)
+                    pc = &aCode[pi->arg];
+                if (pc <= pi)
+                {
+                    if (pEval != nullptr && ++steps > maxSteps)
+                        VM_STOP(VM_BUDGET);
+                    VM_TIER_UP(++aHeat[pi->arg]);
+                }
+                break;
+
+            case PL0B_CALL:
+            {
+                const Pl0bProc* pp = &pMod->aProcs[pi->arg];
+
+                if (pEval != nullptr && ++steps > maxSteps)
+                    VM_STOP(VM_BUDGET);
+                if (nFrames == VM_MAX_CALLS || (size_t)(aStack + VM_STACK_SLOTS - sp) < (size_t)pp->nLocals + pp->maxStack)
+                    VM_FAIL("stack overflow");
+
+                /* the arguments on top of the operands are the first locals */
+                aFrames[nFrames++] = (Frame){.pRet = pc, .aLocals = aLocals, .proc = proc};
+                aLocals = sp - pp->nParams;
+                memset(sp, 0, (pp->nLocals - pp->nParams) * sizeof(long));
+                sp = aLocals + pp->nLocals;
+
+                /* the display: the caller is at least as deep as the callee's parent */
+                if (pp->depth > 1)
+                {
+                    const Pl0bProc* pCaller = &pMod->aProcs[proc];
+                    const long* aCaller = aFrames[nFrames - 1].aLocals;
+
+                    for (uint32_t d = 1; d < pp->depth; d++)
+                        aLocals[pp->nParams + d - 1] =
+                            d == pCaller->depth ? (long)(intptr_t)aCaller : aCaller[pCaller->nParams + d - 1];
+                }
+                pc = &aCode[pp->entry];
+                proc = pi->arg;
+                VM_TIER_UP(++aHeat[pp->entry]);
+                break;
+            }
+
+            case PL0B_RET:
+                if (nFrames == 0)
+                    goto done;
+
+                sp = aLocals;
+                --nFrames;
+                pc = aFrames[nFrames].pRet;
+                aLocals = aFrames[nFrames].aLocals;
+                proc = aFrames[nFrames].proc;
+                VM_TIER_UP(0);
+                break;
+
+            case PL0B_RETV:
+            {
+                long v = sp[-1];
+
+                sp = aLocals;
+                *sp++ = v;
+                --nFrames;
+                pc = aFrames[nFrames].pRet;
+                aLocals = aFrames[nFrames].aLocals;
+                proc = aFrames[nFrames].proc;
+                VM_TIER_UP(0);
+                break;
+            }
+
+            case PL0B_POP:
+                --sp;
+                break;
+
+            case PL0B_WRITEINT:
+                if (pEval != nullptr)
+                {
+                    char buf[24];
+                    if (!evalPut(pEval, buf, snprintf(buf, sizeof(buf), "%ld", sp[-1])))
+                        VM_STOP(VM_BUDGET);
+                    --sp;
+                }
+                else
+                {
+                    __pl0_writeint(*--sp);
+                }
+                break;
+
+            case PL0B_WRITECHAR:
+                if (pEval != nullptr)
+                {
+                    char c = (unsigned char)sp[-1];
+                    if (!evalPut(pEval, &c, 1))
+                        VM_STOP(VM_BUDGET);
+                    --sp;
+                }
+                else
+                {
+                    __pl0_writechar(*--sp);
+                }
+                break;
+
+            case PL0B_READINT:
+                if (pEval != nullptr)
+                    VM_STOP(VM_INPUT);
+                *sp++ = __pl0_readint();
+                break;
+
+            case PL0B_READCHAR:
+                if (pEval != nullptr)
+                    VM_STOP(VM_INPUT);
+                *sp++ = __pl0_readchar();
+                break;
+
+            /* main's next statement starts: keep the state, then run the instruction the mark replaced */
+            case VM_MARK:
+                memcpy(pEval->aGlobals, aGlobals, nGlobals * sizeof(long));
+                pEval->outMark = pEval->outSize;
+                while (nextMark < pEval->nMarks && &aCode[pEval->aMarks[nextMark]] == pi)
+                {
+                    pEval->mark = nextMark;
+                    aPatched[pi - aCode].op = aMarkOps[nextMark++];
+                }
+                pc = pi;
+                break;
+
+            case PL0B_WRITESTR:
+            {
+                const Pl0bSymbol* ps = &aSyms[pi->arg];
+                const long* pStr = (ps->depth == 0 ? aGlobals : ps->proc == proc ? aLocals : VM_OUTER(ps)) + ps->slot;
+
+                for (long i = 0; i < ps->value && pStr[i] != '\0'; i++)
+                {
+                    if (pEval == nullptr)
+                    {
+                        __pl0_writechar(pStr[i]);
+                    }
+                    else
+                    {
+                        char c = (unsigned char)pStr[i];
+                        if (!evalPut(pEval, &c, 1))
+                            VM_STOP(VM_BUDGET);
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+#undef VM_TIER_UP
+#undef VM_ELEMENT
+#undef VM_STOP
+#undef VM_FAIL
+
+done:
+    if (pEval != nullptr && pEval->status == VM_DONE)
+    {
+        memcpy(pEval->aGlobals, aGlobals, nGlobals * sizeof(long));
+        pEval->mark = pEval->nMarks;
+        pEval->outMark = pEval->outSize;
+    }
+    else if (pEval == nullptr)
+    {
+        __pl0_flush();
+    }
+
+    if (pOpts->bStats && pJit != nullptr)
+        CERR("pl0run: %zu procedures compiled, native code entered %zu times\n", jitCompiled(pJit),
+             jitEntries(pJit));
+
+    free(aGlobals);
+    free(aStack);
+    free(aFrames);
+    free(aHeat);
+    free(aPatched);
+    free(aMarkOps);
+    if (pJit != nullptr)
+        jitDestroy(pJit);
+
+    return 0;
+}
+
+int
+vmRun(const Pl0bModule* pMod, const VmOptions* pOpts)
+{
+    /* one copy of the loop each, so that running programs pays nothing for evaluating them */
+    if (pOpts->pEval != nullptr)
+        return vmExecute(pMod, pOpts, pOpts->pEval);
+
+    return vmExecute(pMod, pOpts, nullptr);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "pl0b.h"
+
+#define VM_STACK_SLOTS (1 << 20) /* locals and operands of all active calls */
+#define VM_MAX_CALLS (1 << 16)
+#define VM_HOT 1000 /* back-edges into a loop or calls of a procedure before it gets native code */
+
+enum VM_STATUS
+{
+    VM_DONE, /* the program ended */
+    VM_ERROR, /* it would fail */
+    VM_INPUT, /* it reads */
+    VM_BUDGET /* it runs or writes longer than allowed */
+};
+
+/*
+ * A run at compile time.  It keeps the globals and the output as they were
+ * when main's statements started at the pcs in aMarks, the last one reached
+ * before the run stopped; when the program ends they are its final state.
+ */
+typedef struct VmEval
+{
+    size_t maxSteps; /* back-edges and calls */
+    size_t maxOutput; /* bytes */
+    const uint32_t* aMarks;
+    size_t nMarks;
+
+    int status; /* VM_STATUS */
+    size_t mark; /* main's statements done: aMarks[mark] is where to resume, nMarks if it ended */
+    long* aGlobals; /* malloc()ed by vmRun() */
+    char* pOut; /* malloc()ed by vmRun(), up to outSize */
+    size_t outSize, outCap;
+    size_t outMark; /* the output up to the mark */
+} VmEval;
+
+typedef struct VmOptions
+{
+    bool bJit; /* compile hot procedures, or only interpret */
+    bool bStats; /* report on stderr what was compiled */
+    VmEval* pEval; /* run at compile time instead */
+} VmOptions;
+
+/* runs the main procedure of a module pl0bOpen() or pl0c accepted, returns the exit status */
+int vmRun(const Pl0bModule* pMod, const VmOptions* pOpts);
@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# bench.sh -- end-to-end compiler throughput on generated programs.
+#
+# usage: bench.sh [procs ...]
+#
+# For every size (number of procedures, the other pl0gen parameters scale
+# along) a program is generated once and compiled RUNS times by pl0c and by
+# ref; the best wall time is reported as MB/s and tokens/s.  GENFLAGS is
+# passed to pl0gen and defaults to -r, the subset that ref understands.
+# A second table breaks a pl0c run down by phase using `pl0c --stats`.
+
+cd $(dirname $0)
+
+BUILD=${BUILD:-../build}
+RUNS=${RUNS:-5}
+GENFLAGS=${GENFLAGS:--r}
+SIZES=${*:-16 256 4096 16384}
+
+TMP=$(mktemp -d)
+trap 'rm -rf $TMP' EXIT
+
+# best wall time of $RUNS runs in nanoseconds, or nothing if the command fails
+best()
+{
+    b=
+    i=0
+    while [ $i -lt $RUNS ] ; do
+        s=$(date +%s%N)
+        "$@" > /dev/null 2>&1 || return
+        e=$(date +%s%N)
+        t=$((e - s))
+        if [ -z "$b" ] || [ $t -lt $b ] ; then
+            b=$t
+        fi
+        i=$((i + 1))
+    done
+    echo $b
+}
+
+# rate of $2 units in $1 ns, scaled down by $3
+rate()
+{
+    if [ -z "$1" ] ; then
+        echo -
+    else
+        awk "BEGIN { printf \"%.2f\", $2 / ($1 / 1e9) / $3 }"
+    fi
+}
+
+ms()
+{
+    if [ -z "$1" ] ; then
+        echo -
+    else
+        awk "BEGIN { printf \"%.2f\", $1 / 1e6 }"
+    fi
+}
+
+echo PL/0 compiler throughput
+echo ========================
+
+printf "%8s %10s %9s | %10s %8s %9s | %10s %8s %9s\n" \
+    procs bytes tokens "pl0c ms" MB/s Mtok/s "ref ms" MB/s Mtok/s
+
+for n in $SIZES ; do
+    src=$TMP/gen$n.pl0
+    $BUILD/pl0gen $GENFLAGS -t -s $n -p $n -c $n -v $n > $src 2> $TMP/tokens || exit 1
+    bytes=$(wc -c < $src)
+    tokens=$(cat $TMP/tokens)
+
+    t0=$(best $BUILD/pl0c $src)
+    t1=$(best $BUILD/ref $src)
+
+    printf "%8s %10s %9s | %10s %8s %9s | %10s %8s %9s\n" $n $bytes $tokens \
+        $(ms "$t0") $(rate "$t0" $bytes 1e6) $(rate "$t0" $tokens 1e6) \
+        $(ms "$t1") $(rate "$t1" $bytes 1e6) $(rate "$t1" $tokens 1e6)
+done
+
+echo
+echo pl0c phases, ms
+echo ===============
+
+printf "%8s %10s %10s %10s %10s %10s %12s\n" procs readin lex parse symbols emit "scan length"
+
+for n in $SIZES ; do
+    $BUILD/pl0c --stats $TMP/gen$n.pl0 2>&1 > /dev/null | awk -v n=$n '
+        $2 == "ms" || $3 == "ms" { t[$1] = $2 }
+        /average scan length/ { scan = $NF }
+        END { printf "%8s %10s %10s %10s %10s %10s %12s\n",
+            n, t["readin"], t["lex"], t["parse"], t["symbols"], t["emit"], scan }'
+done
@@ -1,16 +1,83 @@
 #!/bin/sh
+#
+# A test passes when pl0c compiles it.  With an NNNN.out next to it, the
+# compiled program must also print exactly that, and so must its bytecode
+# run by pl0run and, on x86-64 Linux, its executable from pl0c -o: its
+# output, its errors, and "exit n" if it exits with n other than 0.  With an NNNN.err, pl0c must instead fail with exactly that
+# message.  NNNN.flags holds options for pl0c, NNNN.not strings its C must
+# not contain.  Programs run with 4 threads, for forall and --parallel.
 
 cd $(dirname $0)
 
+CC=${CC:-cc}
+EXE=$([ "$(uname -sm)" = "Linux x86_64" ] && echo 1)
+export PL0THREADS=4
+
+TMP=$(mktemp -d)
+trap 'rm -rf $TMP' EXIT
+
+# what a program prints, for .out
+run()
+{
+    "$@" > $TMP/run 2>&1
+    s=$?
+    cat $TMP/run
+    if [ $s -ne 0 ] ; then
+        echo exit $s
+    fi
+}
+
 echo PL/0 compiler test suite
 echo ========================
 
 for i in *.pl0 ; do
+    n=${i%.pl0}
+    flags=$(cat $n.flags 2> /dev/null)
     /usr/bin/printf "%.4s... " $i
-    ../build/pl0c $i > /dev/null 2>&1
-    if [ $? -eq 0 ] ; then
+    if [ -f $n.err ] ; then
+        ../build/pl0c $flags $i > /dev/null 2> $TMP/err
+        if [ $? -ne 0 ] && cmp -s $TMP/err $n.err ; then
+            echo ok
+        else
+            echo fail
+        fi
+        continue
+    fi
+
+    ../build/pl0c $flags $i > $TMP/$n.c 2> /dev/null
+    if [ $? -ne 0 ] ; then
+        echo fail
+        continue
+    fi
+
+    bad=
+    if [ -f $n.not ] && grep -q -F -f $n.not $TMP/$n.c ; then
+        bad=" code"
+    fi
+    if [ -f $n.out ] ; then
+        $CC -std=c2x -I.. -o $TMP/$n $TMP/$n.c -lpthread > /dev/null 2>&1 &&
+            run $TMP/$n | cmp -s - $n.out || bad="$bad c"
+        ../build/pl0c $flags --bytecode $i > $TMP/$n.pl0b 2> /dev/null &&
+            run ../build/pl0run $TMP/$n.pl0b | cmp -s - $n.out || bad="$bad pl0run"
+        if [ -n "$EXE" ] ; then
+            ../build/pl0c $flags -o $TMP/$n.exe $i 2> /dev/null &&
+                run $TMP/$n.exe | cmp -s - $n.out || bad="$bad exe"
+        fi
+    fi
+    if [ -z "$bad" ] ; then
         echo ok
     else
-        echo fail
+        echo "fail:$bad"
     fi
 done
+
+# above EMIT_PARALLEL_MIN the C is formatted on the worker pool, and must not change
+/usr/bin/printf "jobs... "
+../build/pl0gen -s 1 -p 400 > $TMP/gen.pl0
+../build/pl0c --jobs 1 $TMP/gen.pl0 > $TMP/gen1.c 2> /dev/null &&
+    ../build/pl0c --jobs 4 $TMP/gen.pl0 > $TMP/gen4.c 2> /dev/null
+if [ $? -eq 0 ] && [ $(wc -c < $TMP/gen.pl0) -ge 1048576 ] && cmp -s $TMP/gen1.c $TMP/gen4.c ; then
+    echo ok
+else
+    echo fail
+fi